@@ -20,6 +20,7 @@ import mididings.setup as _setup
 import mididings.constants as _constants
 import mididings.overload as _overload
 import mididings.arguments as _arguments
+import mididings.units.call as _call
 from mididings.units.base import _UNIT_TYPES
 from mididings.scene import _SCENE_TYPES
 
@@ -27,87 +28,284 @@ import time as _time
 import weakref as _weakref
 import threading as _threading
 import gc as _gc
+import collections as _collections
 import atexit as _atexit
 import os as _os
 import sys as _sys
+import signal as _signal
+import runpy as _runpy
 
 if _sys.version_info >= (3,):
     raw_input = input
 
 
 _TheBackend = None
+_TheBackendConfig = None
 _TheEngine = None
 
+# true while the script is being executed again for a warm restart
+_restarting = False
+# the engine set up by the script during a warm restart
+_restarted_engine = None
+
+
+class _BackendChanged(Exception):
+    pass
+
 
 def _start_backend():
-    global _TheBackend
+    global _TheBackend, _TheBackendConfig
+
+    backend_config = (
+        _setup.get_config('backend'),
+        _setup.get_config('client_name'),
+        _setup._in_portnames,
+        _setup._out_portnames
+    )
+
+    if (_restarting and _TheBackend is not None and
+            backend_config != _TheBackendConfig):
+        # the existing backend can't be reused
+        raise _BackendChanged()
+
     if _TheBackend is None:
-        _TheBackend = _mididings.create_backend(
-            _setup.get_config('backend'),
-            _setup.get_config('client_name'),
-            _setup._in_portnames,
-            _setup._out_portnames
-        )
-        if _TheBackend:
-            _TheBackend.connect_ports(_setup._in_port_connections,
-                                      _setup._out_port_connections)
+        _TheBackend = _create_backend(backend_config[0])
+        _TheBackendConfig = backend_config
+
+
+def _fork_process_worker():
+    """
+    Fork the worker process that runs all Call(process=...) functions.
+    This must happen before the backend or any engine starts its threads,
+    none of which would exist in the child process.
+    Returns the worker object and the child's process id.
+    """
+    worker = _mididings.ProcessWorker()
+    pid = _os.fork()
+    if pid == 0:
+        # worker process. leave KeyboardInterrupt to the parent, and never
+        # return to the caller
+        try:
+            _signal.signal(_signal.SIGINT, _signal.SIG_IGN)
+            worker.run(_call._process_functions)
+        finally:
+            _os._exit(0)
+    return worker, pid
+
+
+def _create_backend(name):
+    backend = _mididings.create_backend(
+        name,
+        _setup.get_config('client_name'),
+        _setup._in_portnames,
+        _setup._out_portnames
+    )
+    if backend:
+        backend.connect_ports(_setup._in_port_connections,
+                              _setup._out_port_connections)
+    return backend
 
 
 class Engine(_mididings.Engine):
-    def __init__(self):
-        _start_backend()
+    def __init__(self, backend=None):
+        """
+        Create an engine using the backend configured with :func:`config()`,
+        which is shared by all engines created this way.
+
+        If backend is given, a new backend of that name (e.g. ``'dummy'`` for
+        offline processing) is created for this engine alone, using the
+        configured client name and ports. Such an engine is independent of
+        all others, and of module-level functions like :func:`switch_scene()`,
+        which always refer to the engine using the shared backend, and
+        don't use the configured :c:data:`state_file`.
+        """
+        if backend is None:
+            _start_backend()
+            backend_obj = _TheBackend
+        else:
+            backend_obj = _create_backend(backend)
 
         verbose = not _setup.get_config('silent')
         # initialize C++ base class
-        _mididings.Engine.__init__(self, _TheBackend, verbose)
+        _mididings.Engine.__init__(self, backend_obj, verbose)
+
+        self._backend = backend_obj
+        self._independent = backend is not None
+
+        tick_interval = _setup.get_config('tick_interval')
+        if tick_interval is not None:
+            self.set_tick_interval(tick_interval)
+
+        for types, port in _setup.get_config('bypass').items():
+            self.set_bypass(types, _util.actual(_util.port_number(port))
+                                    if port is not None else -1)
+
+        gil_timeout = _setup.get_config('gil_timeout')
+        if gil_timeout is not None:
+            fallback = _setup.get_config('gil_fallback')
+            self.set_gil_timeout(gil_timeout,
+                    getattr(_mididings.GilFallback, fallback.upper()))
+
+        # the state file belongs to the process' main engine. another engine
+        # would overwrite it, and resume from a scene it never was in
+        state_file = _setup.get_config('state_file')
+        if state_file is not None and not self._independent:
+            self.open_state_file(state_file)
 
         self._scenes = {}
+        self._warm_restart = False
+        # set to make run() return, possibly even before it's called
+        self._quit = _threading.Event()
 
     def setup(self, scenes, control, pre, post):
-        # build and setup all scenes and scene groups
+        # identical modules are shared between all patches
+        self._patch_modules = {}
+
+        self._lazy_scenes = _setup.get_config('lazy_scenes')
+        self._max_resident_scenes = _setup.get_config('max_resident_scenes')
+        # parsed scene objects for each scene number, so that scenes can be
+        # built later on
+        self._scene_objects = {}
+        # scene numbers of all scenes that have been built, least recently
+        # used first
+        self._resident_scenes = _collections.OrderedDict()
+
+        # setup all scenes and scene groups
         for number, scene in scenes.items():
             if isinstance(scene, _scene.SceneGroup):
                 self._scenes[number] = (scene.name, [])
 
+                sceneobjs = []
                 for subscene in scene.subscenes:
                     sceneobj = _scene._parse_scene(subscene)
                     self._scenes[number][1].append(sceneobj.name)
-
-                    # build patches
-                    patch = _patch.Patch(sceneobj.patch)
-                    init_patch = _patch.Patch(sceneobj.init_patch)
-                    exit_patch = _patch.Patch(sceneobj.exit_patch)
-                    # add scene to base class object
-                    self.add_scene(_util.actual(number),
-                                   patch, init_patch, exit_patch)
+                    sceneobjs.append(sceneobj)
             else:
                 sceneobj = _scene._parse_scene(scene)
                 self._scenes[number] = (sceneobj.name, [])
+                sceneobjs = [sceneobj]
+
+            for sceneobj in sceneobjs:
+                if self._lazy_scenes:
+                    # add scene to base class object, it will be built when
+                    # it's needed
+                    self.add_scene(_util.actual(number), None, None, None)
+                else:
+                    # build patches and add scene to base class object
+                    self.add_scene(_util.actual(number),
+                                   *self._build_scene_patches(sceneobj))
 
-                # build patches
-                patch = _patch.Patch(sceneobj.patch)
-                init_patch = _patch.Patch(sceneobj.init_patch)
-                exit_patch = _patch.Patch(sceneobj.exit_patch)
-                # add scene to base class object
-                self.add_scene(_util.actual(number),
-                               patch, init_patch, exit_patch)
+            if self._lazy_scenes:
+                self._scene_objects[number] = sceneobjs
+
+        self._scene_numbers = sorted(self._scene_objects)
+
+        if self._lazy_scenes:
+            # the first scene is needed right away when processing events
+            # offline
+            self._build_scene(min(self._scenes))
 
         # build and setup control, pre, and post patches
-        control_patch = _patch.Patch(control) if control else None
-        pre_patch = _patch.Patch(pre) if pre else None
-        post_patch = _patch.Patch(post) if post else None
+        control_patch = self._build_patch(control) if control else None
+        pre_patch = self._build_patch(pre) if pre else None
+        post_patch = self._build_patch(post) if post else None
         # tell base class object about these patches
         self.set_processing(control_patch, pre_patch, post_patch)
 
-        global _TheEngine
-        _TheEngine = _weakref.ref(self)
+        if not self._independent:
+            global _TheEngine
+            _TheEngine = _weakref.ref(self)
+
+        if not self._lazy_scenes:
+            # the modules themselves are kept alive by the patches using them
+            del self._patch_modules
 
         _gc.collect()
         _gc.disable()
 
-    def run(self):
-        self._quit = _threading.Event()
+    def _build_patch(self, p):
+        patch = _patch.Patch(p, self._patch_modules)
+        if not _setup.get_config('silent'):
+            for r in patch.removed:
+                print("optimized away: %s" % r)
+        return patch
+
+    def _build_scene_patches(self, sceneobj):
+        return (self._build_patch(sceneobj.patch),
+                self._build_patch(sceneobj.init_patch),
+                self._build_patch(sceneobj.exit_patch))
+
+    def _build_scene(self, number):
+        """
+        Build all patches of the given scene, unless it has already been
+        built, and mark it as the most recently used scene.
+        """
+        if number in self._resident_scenes:
+            del self._resident_scenes[number]
+        else:
+            for n, sceneobj in enumerate(self._scene_objects[number]):
+                self.set_scene(_util.actual(number), n,
+                               *self._build_scene_patches(sceneobj))
+        self._resident_scenes[number] = True
+
+    def _unload_scenes(self, keep):
+        """
+        Unload the least recently used scenes, until no more than the
+        maximum number of scenes are resident. The scene keep and the
+        current scene are never unloaded.
+        """
+        pinned = set([keep])
+        current = _mididings.Engine.current_scene(self)
+        if current != -1:
+            pinned.add(_util.offset(current))
+
+        unloaded = False
+        for number in list(self._resident_scenes):
+            if len(self._resident_scenes) <= self._max_resident_scenes:
+                break
+            if number in pinned:
+                continue
+            # scenes that are still in use are skipped
+            if self.unload_scene(_util.actual(number)):
+                del self._resident_scenes[number]
+                unloaded = True
+
+        if unloaded:
+            # forget all shared modules, so that those no longer used by any
+            # patch can be freed
+            self._patch_modules.clear()
+
+    def scene_build_callback(self, scene):
+        # scene number is the actual number without offset!
+        number = _util.offset(scene)
+        if number not in self._scene_objects:
+            return
+
+        if number not in self._resident_scenes:
+            # a scene switch is waiting for this scene, so don't waste any
+            # time. unloading other scenes has to wait until the switch is
+            # done, and this callback is called again
+            self._build_scene(number)
+            return
+
+        if (self._max_resident_scenes is None or
+                self._max_resident_scenes >= 3):
+            # prefetch the neighbouring scenes, which are the most likely to
+            # be switched to next
+            index = self._scene_numbers.index(number)
+            for n in self._scene_numbers[max(index - 1, 0):index + 2]:
+                if n not in self._resident_scenes:
+                    self._build_scene(n)
+            # the requested scene remains the most recently used one
+            self._build_scene(number)
+
+        else:
+            self._build_scene(number)
 
+        if self._max_resident_scenes is not None:
+            self._unload_scenes(number)
+
+    def run(self):
         # delay before actually sending any midi data (give qjackctl
         # patchbay time to react...)
         self._start_delay()
@@ -117,6 +315,19 @@ class Engine(_mididings.Engine):
         initial_scene, initial_subscene = \
             self._parse_scene_number(_setup.get_config('initial_scene'))
 
+        if self.restored_scene() != -1:
+            # resume in the scene stored in the state file, if it still
+            # exists
+            restored = self._parse_scene_number(
+                    (_util.offset(self.restored_scene()),
+                     _util.offset(self.restored_subscene())))
+            if restored[0] != -1:
+                initial_scene, initial_subscene = restored
+
+        if self._lazy_scenes and initial_scene != -1:
+            # the initial scene can't be built on the fly
+            self._build_scene(_util.offset(initial_scene))
+
         # start the actual event processing
         self.start(initial_scene, initial_subscene)
 
@@ -129,8 +340,20 @@ class Engine(_mididings.Engine):
             pass
         finally:
             self._call_hooks('on_exit')
-            global _TheEngine
-            _TheEngine = None
+            self._stop_process_worker()
+            if not self._independent:
+                global _TheEngine
+                _TheEngine = None
+
+    def _set_process_worker(self, worker):
+        self.set_process_worker(worker[0])
+        self._process_worker_pid = worker[1]
+
+    def _stop_process_worker(self):
+        if getattr(self, '_process_worker_pid', None) is not None:
+            self.stop_process_worker()
+            _os.waitpid(self._process_worker_pid, 0)
+            self._process_worker_pid = None
 
     def _start_delay(self):
         delay = _setup.get_config('start_delay')
@@ -233,12 +456,19 @@ class Engine(_mididings.Engine):
         ev._finalize()
         _mididings.Engine.output_event(self, ev)
 
+    def inject_event(self, ev):
+        ev._finalize()
+        _mididings.Engine.inject_event(self, ev)
+
     def process(self, ev):
         ev._finalize()
         return _mididings.Engine.process(self, ev)
 
-    def restart(self):
-        _atexit.register(self._restart)
+    def restart(self, warm=False):
+        if warm:
+            self._warm_restart = True
+        else:
+            _atexit.register(self._restart)
         self.quit()
 
     @staticmethod
@@ -249,6 +479,14 @@ class Engine(_mididings.Engine):
     def quit(self):
         self._quit.set()
 
+    def finished_callback(self):
+        # the backend ran out of input, e.g. reading from a pipe that was
+        # closed. there's nothing left to do
+        self.quit()
+
+    def backend_stats(self):
+        return self._backend.stats() if self._backend else {}
+
 
 
 @_overload.mark(
@@ -282,9 +520,7 @@ def run(patch):
         # the given dict could be accepted as a split
         run(scenes=patch)
     else:
-        e = Engine()
-        e.setup({_util.offset(0): patch}, None, None, None)
-        e.run()
+        _run_engine(_setup_engine({_util.offset(0): patch}, None, None, None))
 
 @_overload.mark
 @_arguments.accept(
@@ -294,9 +530,75 @@ def run(patch):
     _arguments.nullable(_UNIT_TYPES)
 )
 def run(scenes, control=None, pre=None, post=None):
+    _run_engine(_setup_engine(scenes, control, pre, post))
+
+
+def _setup_engine(scenes, control, pre, post):
+    # during a warm restart, the backend and the previous engine are still
+    # running, so forking isn't safe. functions defined by the new script
+    # can't be passed to an existing worker either, so they're called
+    # asynchronously in this process instead
+    worker = (_fork_process_worker()
+              if _call._process_functions and not _restarting else None)
+
     e = Engine()
+    if worker is not None:
+        e._set_process_worker(worker)
     e.setup(scenes, control, pre, post)
-    e.run()
+    return e
+
+
+def _run_engine(e):
+    global _restarted_engine
+
+    if _restarting:
+        # the script is being executed again for a warm restart. the new
+        # engine is started by the original call to run(), once the script
+        # has finished
+        _restarted_engine = e
+        return
+
+    while e is not None:
+        e.run()
+        if not e._warm_restart:
+            break
+
+        # stay in the current scene, if it still exists after the restart
+        scene = (e.current_scene(), e.current_subscene())
+        e.stop()
+        e = _reload_script()
+        if e is not None:
+            _setup._config_impl(initial_scene=scene)
+
+
+def _reload_script():
+    """
+    Execute the main script again, keeping the current backend alive.
+    Returns the engine set up by the script, or None if the script didn't
+    call run().
+    """
+    global _restarting, _restarted_engine
+
+    # keep config options that were overridden on the command line
+    overridden = dict((k, _setup.get_config(k))
+                      for k in _setup._config_overridden)
+    _setup.reset()
+    _setup._config_impl(override=True, **overridden)
+    del _call._process_functions[:]
+
+    _restarting = True
+    try:
+        _runpy.run_path(_sys.argv[0], run_name='__main__')
+    except _BackendChanged:
+        # backend or ports were changed, start over from scratch
+        if not _setup.get_config('silent'):
+            print("backend configuration changed, restarting...")
+        Engine._restart()
+    finally:
+        _restarting = False
+
+    e, _restarted_engine = _restarted_engine, None
+    return e
 
 
 def switch_scene(scene, subscene=None):
@@ -338,6 +640,12 @@ def output_event(ev):
     """
     _TheEngine().output_event(ev)
 
+def inject_event(ev):
+    """
+    Process an event as if it had been received on an input port.
+    """
+    _TheEngine().inject_event(ev)
+
 def in_ports():
     """
     Return a list of the configured input port names.
@@ -350,6 +658,80 @@ def out_ports():
     """
     return _setup._out_portnames
 
+def _set_portnames(portnames, out):
+    # the backend configuration refers to the lists as they were when the
+    # backend was created, so a warm restart can tell whether the script
+    # still configures the same ports. never modify them in place
+    if out:
+        _setup._out_portnames = portnames
+    else:
+        _setup._in_portnames = portnames
+
+def _add_port(name, connections, out):
+    if not _TheBackend:
+        raise RuntimeError("backend doesn't support adding ports")
+
+    portnames = _setup._out_portnames if out else _setup._in_portnames
+    if name is None:
+        name = _setup._default_portname(len(portnames), out)
+
+    port = _TheBackend.add_port(out, name)
+    _set_portnames(portnames + [name], out)
+
+    if connections:
+        c = {name: list(connections)}
+        _TheBackend.connect_ports({} if out else c, c if out else {})
+
+    return _util.offset(port)
+
+def _remove_port(port, out):
+    if not _TheBackend:
+        raise RuntimeError("backend doesn't support removing ports")
+
+    portnames = _setup._out_portnames if out else _setup._in_portnames
+    n = _util.actual(_util.port_number(port))
+
+    _TheBackend.remove_port(out, n)
+    # keep the numbers of all other ports unchanged
+    portnames = list(portnames)
+    portnames[n] = ''
+    _set_portnames(portnames, out)
+
+def add_in_port(name=None, *connections):
+    """
+    Add an input port while mididings is running, and connect it to all
+    external ports matching any of the given regular expressions, now or
+    when they appear later.
+    Returns the new port's number.
+    """
+    return _add_port(name, connections, False)
+
+def add_out_port(name=None, *connections):
+    """
+    Add an output port while mididings is running, and connect it to all
+    external ports matching any of the given regular expressions, now or
+    when they appear later.
+    Returns the new port's number.
+    """
+    return _add_port(name, connections, True)
+
+def remove_in_port(port):
+    """
+    Remove an input port, given by its name or number.
+    The numbers of all other ports remain unchanged, and the removed port's
+    entry in :func:`in_ports()` becomes an empty string.
+    """
+    _remove_port(port, False)
+
+def remove_out_port(port):
+    """
+    Remove an output port, given by its name or number.
+    The numbers of all other ports remain unchanged, and the removed port's
+    entry in :func:`out_ports()` becomes an empty string. Events sent to the
+    removed port are discarded.
+    """
+    _remove_port(port, True)
+
 def time():
     """
     Return the time in seconds (floating point) since some unspecified
@@ -358,6 +740,37 @@ def time():
     """
     return _TheEngine().time()
 
+def tempo():
+    """
+    Return the tempo of incoming MIDI clock events in beats per minute,
+    or 0 if no clock has been received.
+    """
+    return _TheEngine().tempo()
+
+def song_position():
+    """
+    Return the current song position in beats (quarter notes), based on the
+    number of MIDI clock events received since the most recent start or song
+    position message.
+    """
+    return _TheEngine().song_position()
+
+def gil_timeouts():
+    """
+    Return the number of :func:`~.Process()` calls that couldn't acquire the
+    GIL within the configured :c:data:`gil_timeout`.
+    """
+    return _TheEngine().gil_timeouts()
+
+def backend_stats():
+    """
+    Return a dictionary of backend-specific statistics, such as the number
+    of network packets lost by the ``'udp'`` backend.
+    """
+    if not _TheBackend:
+        return {}
+    return _TheBackend.stats()
+
 def active():
     """
     Return ``True`` if the mididings engine is active (the :func:`~.run()`
@@ -365,15 +778,24 @@ def active():
     """
     return _TheEngine is not None and _TheEngine() is not None
 
-def restart():
+def restart(warm=False):
     """
     Restart the mididings script by terminating the current process, and then
     running the same Python interpreter with the same arguments again.
     This will not work properly if :func:`~.run()` is not the last call in
     your script, or if you're running mididings in an interactive Python
     interpreter.
+
+    If *warm* is true, the script is instead executed again within the same
+    process. The backend is kept alive, so all MIDI ports and their
+    connections are preserved, and MIDI input received during the restart is
+    processed once the new patches are in place. Modules imported by the
+    script are not reloaded. If the backend or port configuration was
+    changed, a normal restart is performed instead.
+    After a warm restart, functions passed to :func:`~.Call()` as *process*
+    run in the main process, like those passed as *function*.
     """
-    _TheEngine().restart()
+    _TheEngine().restart(warm)
 
 def quit():
     """
@@ -389,9 +811,9 @@ def process_file(infile, outfile, patch):
     """
     import smf
 
-    # create dummy engine with no inputs or outputs
-    _setup._config_impl(backend='dummy')
-    engine = Engine()
+    # create dummy engine with no inputs or outputs, leaving the configured
+    # backend alone
+    engine = Engine(backend='dummy')
     engine.setup({_util.offset(0): patch}, None, None, None)
 
     # open input file
@@ -131,6 +131,8 @@ class MidiEvent(_mididings.MidiEvent):
             lambda self: 'SysRt Sensing',
         _constants.SYSRT_RESET:
             lambda self: 'SysRt Reset',
+        _constants.TICK:
+            lambda self: 'Tick:     %5d' % self.data1,
         _constants.DUMMY:
             lambda self: 'Dummy',
     }
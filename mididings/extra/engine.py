@@ -14,11 +14,11 @@ from mididings import Call as _Call
 import mididings.engine as _engine
 
 
-def Restart():
+def Restart(warm=False):
     """
     Call :func:`.engine.restart()`.
     """
-    return _Call(lambda ev: _engine.restart())
+    return _Call(lambda ev: _engine.restart(warm))
 
 def Quit():
     """
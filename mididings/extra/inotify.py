@@ -35,10 +35,16 @@ class AutoRestart(object):
 
     :param filenames:
         a list of additional files to be monitored.
+
+    :param warm:
+        If true, perform a warm restart (see :func:`.engine.restart()`),
+        which keeps all ports and connections alive. Note that changed
+        modules other than the main script are not reloaded in this case.
     """
-    def __init__(self, modules=True, filenames=[]):
+    def __init__(self, modules=True, filenames=[], warm=False):
         self.modules = modules
         self.filenames = filenames
+        self.warm = warm
 
     def on_start(self):
         self.wm = _pyinotify.WatchManager()
@@ -79,4 +85,4 @@ class AutoRestart(object):
 
     def _process_IN_MODIFY(self, event):
         print("file '%s' changed, restarting..." % event.pathname)
-        _engine.restart()
+        _engine.restart(self.warm)
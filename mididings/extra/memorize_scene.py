@@ -23,6 +23,9 @@ class MemorizeScene(object):
 
     :param memo_file:
         the path of the file to be used to store the scene number.
+
+    To also survive crashes, and keep track of held notes, use the
+    :c:data:`state_file` setting instead.
     """
     def __init__(self, memo_file):
         self.memo_file = memo_file
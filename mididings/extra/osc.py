@@ -11,14 +11,21 @@
 #
 
 from mididings import Call as _Call
+from mididings.units.base import _Unit
 import mididings.engine as _engine
 import mididings.setup as _setup
 import mididings.util as _util
 import mididings.misc as _misc
+import mididings.constants as _constants
 
 import mididings.extra.panic as _panic
 
-import liblo as _liblo
+import _mididings
+
+try:
+    import liblo as _liblo
+except ImportError:
+    _liblo = None
 
 
 class OSCInterface(object):
@@ -31,6 +38,11 @@ class OSCInterface(object):
     :param notify_ports:
         a list of OSC ports to notify when the current scene changes.
 
+    :param native:
+        if true, use the OSC server built into mididings instead of pyliblo.
+        Scene switching and panic messages are then handled entirely without
+        the Python interpreter, and pyliblo isn't required.
+
     These messages are currently understood:
 
     - **/mididings/switch_scene ,i**: switch to the given scene number.
@@ -41,77 +53,118 @@ class OSCInterface(object):
     - **/mididings/next_subscene**: switch to the next subscene.
     - **/mididings/panic**: send all-notes-off on all channels and on all
       output ports.
+    - **/mididings/query**: resend the list of scenes and the current scene.
+    - **/mididings/restart**: restart mididings.
+    - **/mididings/restart ,i**: restart mididings, performing a warm
+      restart if the argument is non-zero.
     - **/mididings/quit**: terminate mididings.
     """
-    def __init__(self, port=56418, notify_ports=[56419]):
+    def __init__(self, port=56418, notify_ports=[56419], native=True):
         self.port = port
         if _misc.issequence(notify_ports):
             self.notify_ports = notify_ports
         else:
             self.notify_ports = [notify_ports]
+        self.native = native or _liblo is None
+
+        self._methods = {
+            ('/mididings/query', ''): self.query_cb,
+            ('/mididings/switch_scene', 'i'): self.switch_scene_cb,
+            ('/mididings/switch_scene', 'ii'): self.switch_scene_cb,
+            ('/mididings/switch_subscene', 'i'): self.switch_subscene_cb,
+            ('/mididings/prev_scene', ''): self.prev_scene_cb,
+            ('/mididings/next_scene', ''): self.next_scene_cb,
+            ('/mididings/prev_subscene', ''): self.prev_subscene_cb,
+            ('/mididings/prev_subscene', 'i'): self.prev_subscene_cb,
+            ('/mididings/next_subscene', ''): self.next_subscene_cb,
+            ('/mididings/next_subscene', 'i'): self.next_subscene_cb,
+            ('/mididings/panic', ''): self.panic_cb,
+            ('/mididings/restart', ''): self.restart_cb,
+            ('/mididings/restart', 'i'): self.restart_cb,
+            ('/mididings/quit', ''): self.quit_cb,
+        }
 
     def on_start(self):
         if self.port is not None:
-            self.server = _liblo.ServerThread(self.port)
-            self.server.register_methods(self)
-            self.server.start()
+            if self.native:
+                # messages not handled by the engine itself end up in
+                # _dispatch()
+                _engine._TheEngine().start_osc_server(
+                    self.port, _setup.get_config('data_offset'),
+                    self._dispatch)
+            else:
+                self.server = _liblo.ServerThread(self.port)
+                for (path, types), method in self._methods.items():
+                    self.server.add_method(path, types,
+                        lambda path, args, method=method: method(path, args))
+                self.server.start()
 
         self.send_config()
 
     def on_exit(self):
         if self.port is not None:
-            self.server.stop()
-            del self.server
+            if self.native:
+                _engine._TheEngine().stop_osc_server()
+            else:
+                self.server.stop()
+                del self.server
 
     def on_switch_scene(self, scene, subscene):
         for p in self.notify_ports:
-            _liblo.send(p, '/mididings/current_scene', scene, subscene)
+            self._send(p, '/mididings/current_scene', scene, subscene)
+
+    def _dispatch(self, path, types, args):
+        method = self._methods.get((path, types))
+        if method is not None:
+            method(path, args)
+
+    def _send(self, port, path, *args):
+        osc_args = _osc_arguments(args) if self.native else None
+        if osc_args is not None:
+            _mididings.send_osc('', port, path, osc_args)
+        elif _liblo is not None:
+            _liblo.send(port, path, *args)
+        elif not _setup.get_config('silent'):
+            # e.g. a scene without a name
+            print("can't send OSC message %s without pyliblo" % path)
 
     def send_config(self):
         for p in self.notify_ports:
             # send data offset
-            _liblo.send(p, '/mididings/data_offset',
-                        _setup.get_config('data_offset'))
+            self._send(p, '/mididings/data_offset',
+                       _setup.get_config('data_offset'))
 
             # send list of scenes
-            _liblo.send(p, '/mididings/begin_scenes')
+            self._send(p, '/mididings/begin_scenes')
             s = _engine.scenes()
             for n in sorted(s.keys()):
-                _liblo.send(p, '/mididings/add_scene', n, s[n][0], *s[n][1])
-            _liblo.send(p, '/mididings/end_scenes')
+                self._send(p, '/mididings/add_scene', n, s[n][0], *s[n][1])
+            self._send(p, '/mididings/end_scenes')
 
-    @_liblo.make_method('/mididings/query', '')
     def query_cb(self, path, args):
         self.send_config()
         for p in self.notify_ports:
-            _liblo.send(p, '/mididings/current_scene',
-                        _engine.current_scene(), _engine.current_subscene())
+            self._send(p, '/mididings/current_scene',
+                       _engine.current_scene(), _engine.current_subscene())
 
-    @_liblo.make_method('/mididings/switch_scene', 'i')
-    @_liblo.make_method('/mididings/switch_scene', 'ii')
     def switch_scene_cb(self, path, args):
         _engine.switch_scene(*args)
 
-    @_liblo.make_method('/mididings/switch_subscene', 'i')
     def switch_subscene_cb(self, path, args):
         _engine.switch_subscene(*args)
 
-    @_liblo.make_method('/mididings/prev_scene', '')
     def prev_scene_cb(self, path, args):
         s = sorted(_engine.scenes().keys())
         n = s.index(_engine.current_scene()) - 1
         if n >= 0:
             _engine.switch_scene(s[n])
 
-    @_liblo.make_method('/mididings/next_scene', '')
     def next_scene_cb(self, path, args):
         s = sorted(_engine.scenes().keys())
         n = s.index(_engine.current_scene()) + 1
         if n < len(s):
             _engine.switch_scene(s[n])
 
-    @_liblo.make_method('/mididings/prev_subscene', '')
-    @_liblo.make_method('/mididings/prev_subscene', 'i')
     def prev_subscene_cb(self, path, args):
         s = _engine.scenes()[_engine.current_scene()]
         n = _util.actual(_engine.current_subscene()) - 1
@@ -120,8 +173,6 @@ class OSCInterface(object):
         if n >= 0:
             _engine.switch_subscene(_util.offset(n))
 
-    @_liblo.make_method('/mididings/next_subscene', '')
-    @_liblo.make_method('/mididings/next_subscene', 'i')
     def next_subscene_cb(self, path, args):
         s = _engine.scenes()[_engine.current_scene()]
         n = _util.actual(_engine.current_subscene()) + 1
@@ -130,19 +181,42 @@ class OSCInterface(object):
         if n < len(s[1]):
             _engine.switch_subscene(_util.offset(n))
 
-    @_liblo.make_method('/mididings/panic', '')
     def panic_cb(self, path, args):
         _panic._panic_bypass()
 
-    @_liblo.make_method('/mididings/restart', '')
     def restart_cb(self, path, args):
-        _engine.restart()
+        _engine.restart(bool(args and args[0]))
 
-    @_liblo.make_method('/mididings/quit', '')
     def quit_cb(self, path, args):
         _engine.quit()
 
 
+# event attributes that are subject to the data offset
+_OFFSET_ATTRIBUTES = ('EVENT_PORT', 'EVENT_CHANNEL', 'EVENT_PROGRAM')
+
+
+def _osc_arguments(args):
+    """
+    Convert a list of values to the (tag, value) tuples expected by the
+    native OSC implementation. Returns None if any value can't be sent
+    natively.
+    """
+    r = []
+    for a in args:
+        if isinstance(a, _constants._EventAttribute):
+            r.append(('o' if a.name in _OFFSET_ATTRIBUTES else 'a', int(a)))
+        elif isinstance(a, bool):
+            return None
+        elif isinstance(a, int):
+            r.append(('i', a))
+        elif isinstance(a, float):
+            r.append(('f', a))
+        elif isinstance(a, str):
+            r.append(('s', a))
+        else:
+            return None
+    return r
+
 
 class _SendOSC(object):
     def __init__(self, target, path, args):
@@ -161,6 +235,24 @@ def SendOSC(target, path, *args):
     Parameters are the same as for :func:`liblo.send()`.
     Additionally, instead of a specific value, each data argument may also
     be a Python function that takes a single :class:`~.MidiEvent` parameter,
-    and returns the value to be sent.
+    and returns the value to be sent, or an event attribute like
+    :data:`~.EVENT_NOTE`.
+
+    If the target is a port number or a ``(host, port)`` tuple, and all
+    arguments are integers, floats, strings or event attributes, messages
+    are sent without calling into Python, and pyliblo isn't required.
     """
-    return _Call(_SendOSC(target, path, args))
+    if isinstance(target, int):
+        host, port = '', target
+    elif isinstance(target, tuple) and len(target) == 2:
+        host, port = target
+    else:
+        host, port = None, None
+
+    osc_args = _osc_arguments(args)
+
+    if host is not None and osc_args is not None:
+        return _Unit(_mididings.SendOSC(host, port, path, osc_args,
+                                        _setup.get_config('data_offset')))
+    else:
+        return _Call(_SendOSC(target, path, args))
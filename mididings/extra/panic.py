@@ -16,10 +16,16 @@ import mididings.event as _event
 import mididings.util as _util
 
 
+def _out_ports():
+    # numbers of all output ports that haven't been removed
+    return [_util.offset(n) for n, name in enumerate(_engine.out_ports())
+                if name]
+
+
 def _panic_bypass():
     # send all notes off (CC #123) and sustain off (CC #64) to all output
     # ports and on all channels
-    for p in _engine.out_ports():
+    for p in _out_ports():
         for c in range(16):
             _engine.output_event(
                 _event.CtrlEvent(p, _util.offset(c), 123, 0))
@@ -43,6 +49,6 @@ def Panic(bypass=True):
         return _m.Fork([
             (_m.Ctrl(p, _util.offset(c), 123, 0) //
              _m.Ctrl(p, _util.offset(c), 64, 0))
-                for p in _engine.out_ports()
+                for p in _out_ports()
                 for c in range(16)
         ])
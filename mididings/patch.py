@@ -17,43 +17,500 @@ import mididings.constants as _constants
 
 
 class Patch(_mididings.Patch):
-    def __init__(self, p):
-        _mididings.Patch.__init__(self, self.build(p))
+    def __init__(self, p, modules=None):
+        # modules that have already been built, shared by all patches using
+        # the same dict. maps each module's key to the module itself, and
+        # the object it was built from (keeping object ids in the key valid)
+        self._modules = modules if modules is not None else {}
+
+        optimizer = _Optimizer()
+        _mididings.Patch.__init__(self, self.build(optimizer.optimize(p)))
+        # descriptions of everything that was optimized away
+        self.removed = optimizer.removed
 
     def build(self, p):
+        return self._build(p)[0]
+
+    def _build(self, p):
+        """
+        Build the module for p. Returns the module and a key identifying its
+        structure, or None if it can't be shared.
+        """
         if isinstance(p, _units.base._Chain):
-            return Patch.Chain(self.build(i) for i in p)
+            modules = [self._build(i) for i in p]
+            key = _module_key('Chain', modules)
+            return self._share(key, p, lambda:
+                    Patch.Chain(m for m, k in modules))
 
         elif isinstance(p, list):
-            gen = (self.build(i) for i in p)
+            modules = [self._build(i) for i in p]
 
             remove_duplicates = True
             if hasattr(p, 'remove_duplicates'):
                 remove_duplicates = (p.remove_duplicates != False)
 
-            return Patch.Fork(gen, remove_duplicates)
+            key = _module_key(('Fork', remove_duplicates), modules)
+            return self._share(key, p, lambda:
+                    Patch.Fork((m for m, k in modules), remove_duplicates))
 
         elif isinstance(p, dict):
-            return self.build(
+            return self._build(
                 _units.splits._make_split(_units.base.Filter, p, unpack=True)
             )
 
         elif isinstance(p, _units.init._InitExit):
-            return Patch.Single(_mididings.Pass(False))
+            return self._share(('Discard',), p, lambda:
+                    Patch.Single(_mididings.Pass(False)))
 
         elif isinstance(p, _units.base._Unit):
             if isinstance(p.unit, _mididings.Unit):
-                return Patch.Single(p.unit)
+                return self._share(_unit_key(p), p, lambda:
+                        Patch.Single(p.unit))
             elif isinstance(p.unit, _mididings.UnitEx):
-                return Patch.Extended(p.unit)
+                return self._share(_unit_key(p), p, lambda:
+                        Patch.Extended(p.unit))
 
         elif isinstance(p, _constants._EventType):
-            return Patch.Single(_mididings.TypeFilter(p))
+            return self._share(('Filter', int(p)), p, lambda:
+                    Patch.Single(_mididings.TypeFilter(p)))
 
         raise TypeError(
                 "type '%s' not allowed in patch. offending object is: %r" %
                 (type(p).__name__, p))
 
+    def _share(self, key, p, make_module):
+        """
+        Return the existing module with the given key, or build a new one.
+        """
+        if key is None:
+            return make_module(), None
+        if key not in self._modules:
+            self._modules[key] = (make_module(), p)
+        return self._modules[key][0], key
+
+
+def _module_key(kind, modules):
+    # modules are identified by the ids of their (already shared) children
+    if any(k is None for m, k in modules):
+        return None
+    return (kind,) + tuple(id(m) for m, k in modules)
+
+
+def _unit_key(p):
+    if isinstance(p, _units.base._InvertedFilter):
+        key = _unit_key(p.filt)
+        return ('~', p.negate, key) if key is not None else None
+    elif hasattr(p, '_function'):
+        # all units created by the same function with equal arguments are
+        # identical
+        return (p._function, _freeze(p._args))
+    else:
+        return None
+
+
+def _freeze(x):
+    """
+    Convert x to something hashable that compares equal only to objects
+    that are equivalent when used as a unit parameter.
+    """
+    if isinstance(x, (list, tuple)):
+        return (type(x),) + tuple(_freeze(i) for i in x)
+    elif isinstance(x, (set, frozenset)):
+        return (type(x), frozenset(_freeze(i) for i in x))
+    elif isinstance(x, dict):
+        return (type(x), frozenset((_freeze(k), _freeze(v))
+                                   for k, v in x.items()))
+    elif isinstance(x, bytearray):
+        return (type(x), bytes(x))
+    try:
+        hash(x)
+    except TypeError:
+        return (type(x), id(x))
+    return (type(x), x)
+
+
+# event types that carry a channel number
+_CHANNEL_TYPES = int(_constants.ANY) & ~int(_constants.SYSTEM |
+                                            _constants.TICK |
+                                            _constants.DUMMY)
+
+# for each generator unit, the event type it creates (None if given as the
+# first argument), and the positions of its port and channel arguments
+_GENERATORS = {
+    'Generator':        (None, 1, 2),
+    'NoteOn':           (_constants.NOTEON, 0, 1),
+    'NoteOff':          (_constants.NOTEOFF, 0, 1),
+    'Ctrl':             (_constants.CTRL, 0, 1),
+    'Pitchbend':        (_constants.PITCHBEND, 0, 1),
+    'Aftertouch':       (_constants.AFTERTOUCH, 0, 1),
+    'PolyAftertouch':   (_constants.POLY_AFTERTOUCH, 0, 1),
+    'Program':          (_constants.PROGRAM, 0, 1),
+    'SysEx':            (_constants.SYSEX, 0, None),
+}
+
+
+def _is_unit(p, name):
+    return (isinstance(p, _units.base._Unit) and
+            getattr(p, '_name', None) == name)
+
+
+def _is_discard(p):
+    return (_is_unit(p, 'Discard') or
+            isinstance(p, _units.init._InitExit))
+
+
+def _is_init_exit(p):
+    # Init() and Exit() only carry their patches to the scene, so removing
+    # them from the event processing isn't worth reporting
+    return isinstance(p, _units.init._InitExit)
+
+
+def _is_pure(p):
+    """
+    Return True if p is a unit that does nothing but modify or filter the
+    event it's given.
+    """
+    return (isinstance(p, _constants._EventType) or
+            (isinstance(p, _units.base._Unit) and
+             isinstance(getattr(p, 'unit', None), _mididings.Unit)))
+
+
+def _is_modifier(p):
+    """
+    Return True if p is a unit whose effect is entirely overwritten by a
+    subsequent constant generator.
+    """
+    return (_is_pure(p) and
+            not isinstance(p, _constants._EventType) and
+            not isinstance(p.unit, (_mididings.Filter, _mididings.Pass)))
+
+
+def _generator_type(p):
+    if (isinstance(p, _units.base._Unit) and
+            getattr(p, '_name', None) in _GENERATORS):
+        t = _GENERATORS[p._name][0]
+        return p._args[0] if t is None else t
+    return None
+
+
+def _is_constant_generator(p):
+    return (_generator_type(p) is not None and
+            not any(isinstance(a, _constants._EventAttribute)
+                    for a in p._args[1 if p._name == 'Generator' else 0:]))
+
+
+def _chain_to_string(units):
+    if len(units) == 1:
+        return repr(units[0])
+    return repr(_units.base._Chain(units))
+
+
+def _chain_head(p):
+    if isinstance(p, _units.base._Chain):
+        return p[0]
+    return p
+
+
+def _chain_tail(p):
+    if not isinstance(p, _units.base._Chain):
+        return _units.base.Pass()
+    elif len(p) == 2:
+        return p[1]
+    else:
+        return _units.base._Chain(p[1:])
+
+
+def _same_unit(a, b):
+    """
+    Return True if a and b are the same kind of unit, constructed with the
+    same parameters.
+    """
+    if (isinstance(a, _constants._EventType) or
+            isinstance(b, _constants._EventType)):
+        return (isinstance(a, _constants._EventType) and
+                isinstance(b, _constants._EventType) and int(a) == int(b))
+    elif (isinstance(a, _units.base._InvertedFilter) and
+            isinstance(b, _units.base._InvertedFilter)):
+        return a.negate == b.negate and _same_unit(a.filt, b.filt)
+    else:
+        return (_is_pure(a) and _is_pure(b) and
+                hasattr(a, '_function') and hasattr(b, '_function') and
+                a._function is b._function and a._args == b._args)
+
+
+def _fork_remove_duplicates(p):
+    if hasattr(p, 'remove_duplicates'):
+        return (p.remove_duplicates != False)
+    return True
+
+
+class _ChainState(object):
+    """
+    What's known about all events at some point in a chain: the set of
+    possible event types, and their port and channel if they're constant.
+    """
+    def __init__(self):
+        self.types = int(_constants.ANY)
+        self.port = None
+        self.channel = None
+
+
+class _Optimizer(object):
+    """
+    Simplifies a patch without changing its behavior, by removing units and
+    branches that can never affect any event, flattening unnecessary nesting,
+    and folding modifiers into constant generators.
+    """
+    # results of evaluating a unit in the context of a chain
+    KEEP, REDUNDANT, DEAD = range(3)
+
+    def __init__(self):
+        self.removed = []
+
+    def optimize(self, p):
+        if isinstance(p, _units.base._Chain):
+            return self.optimize_chain(p)
+        elif isinstance(p, list):
+            return self.optimize_fork(p)
+        elif isinstance(p, dict):
+            return self.optimize(
+                _units.splits._make_split(_units.base.Filter, p, unpack=True)
+            )
+        else:
+            return p
+
+    def optimize_chain(self, chain):
+        units = []
+        for u in chain:
+            u = self.optimize(u)
+            if isinstance(u, _units.base._Chain):
+                units.extend(u)
+            else:
+                units.append(u)
+
+        r = []
+        state = _ChainState()
+
+        for n, u in enumerate(units):
+            if _is_unit(u, 'Pass'):
+                self.removed.append("no-op unit %r" % u)
+                continue
+
+            if ((_is_unit(u, 'Port') or _is_unit(u, 'Channel')) and
+                    r and _generator_type(r[-1]) is not None):
+                g = self.fold_generator(r[-1], u)
+                if g is not None:
+                    self.removed.append(
+                        "unit %r, folded into %r" % (u, g))
+                    self.evaluate(u, state)
+                    r.pop()
+                    u = g
+                    result = self.KEEP
+                else:
+                    result = self.evaluate(u, state)
+            else:
+                result = self.evaluate(u, state)
+
+            if _is_constant_generator(u):
+                # the generator replaces whatever the preceding modifiers did
+                while r and _is_modifier(r[-1]):
+                    self.removed.append(
+                        "unit %r, overridden by %r" % (r.pop(), u))
+
+            if result == self.REDUNDANT:
+                self.removed.append("filter %r, which always passes" % u)
+            elif result == self.DEAD:
+                if all(_is_pure(x) for x in r):
+                    removed = units
+                    r = _units.base.Discard()
+                else:
+                    # units before this point may still have side effects
+                    removed = units[n:]
+                    r = _units.base._Chain(r + [_units.base.Discard()])
+                removed = [x for x in removed if not _is_init_exit(x)]
+                if removed and not (len(removed) == 1 and
+                                    _is_discard(removed[0])):
+                    self.removed.append("%s, which never passes any event" %
+                                        _chain_to_string(removed))
+                return r
+            else:
+                r.append(u)
+
+        if not r:
+            return _units.base.Pass()
+        elif len(r) == 1:
+            return r[0]
+        else:
+            return _units.base._Chain(r)
+
+    def optimize_fork(self, fork):
+        remove_duplicates = _fork_remove_duplicates(fork)
+
+        branches = []
+        for u in fork:
+            if _is_discard(u):
+                if not _is_init_exit(u):
+                    self.removed.append("branch %r" % u)
+                continue
+
+            o = self.optimize(u)
+
+            if _is_discard(o):
+                # already reported when optimizing the branch
+                continue
+            elif (isinstance(o, list) and
+                    not isinstance(o, _units.base._Chain) and
+                    _fork_remove_duplicates(o) == remove_duplicates):
+                branches.extend(o)
+            else:
+                branches.append(o)
+
+        branches = self.hoist_prefixes(
+                        branches, getattr(fork, 'remove_duplicates', None))
+
+        if not branches:
+            return _units.base.Discard()
+        elif len(branches) == 1:
+            return branches[0]
+        else:
+            return _units.base._Fork(branches,
+                                     getattr(fork, 'remove_duplicates', None))
+
+    def hoist_prefixes(self, branches, remove_duplicates):
+        """
+        Merge adjacent fork branches that start with the same unit, so that
+        this unit is evaluated only once, before the remaining parts of the
+        branches are forked.
+        """
+        r = []
+        n = 0
+        while n < len(branches):
+            head = _chain_head(branches[n])
+            m = n + 1
+            # only units that return at most one event can be hoisted,
+            # otherwise the fork would see different input events
+            if _is_pure(head) and not _is_unit(head, 'Pass'):
+                while (m < len(branches) and
+                        _same_unit(_chain_head(branches[m]), head)):
+                    m += 1
+
+            if m - n > 1:
+                self.removed.append("%d copies of unit %r" % (m - n - 1, head))
+                tails = self.hoist_prefixes(
+                    [_chain_tail(b) for b in branches[n:m]], remove_duplicates)
+                if len(tails) == 1:
+                    tail = tails[0]
+                else:
+                    tail = _units.base._Fork(tails, remove_duplicates)
+                if isinstance(tail, _units.base._Chain):
+                    r.append(_units.base._Chain([head] + tail))
+                else:
+                    r.append(_units.base._Chain([head, tail]))
+            else:
+                r.append(branches[n])
+            n = m
+        return r
+
+    def fold_generator(self, g, u):
+        """
+        Return a copy of generator g with the port or channel set by unit u,
+        or None if that's not possible.
+        """
+        port_index, channel_index = _GENERATORS[g._name][1:]
+        index = port_index if u._name == 'Port' else channel_index
+        if index is None or (u._name == 'Channel' and
+                             not int(_generator_type(g)) & _CHANNEL_TYPES):
+            return None
+
+        args = list(g._args)
+        args[index] = u._args[0]
+
+        # call the undecorated function, and store its arguments just like
+        # unitrepr.store() does
+        r = g._function(*args)
+        r._name = g._name
+        r._function = g._function
+        r._args = tuple(args)
+        return r
+
+    def evaluate(self, u, state):
+        """
+        Update the chain state to reflect unit u, and return whether u is
+        needed, redundant, or discards all events.
+        """
+        if _is_discard(u):
+            return self.DEAD
+
+        elif isinstance(u, _constants._EventType) or _is_unit(u, 'Filter'):
+            types = int(u if isinstance(u, _constants._EventType)
+                          else u._args[0])
+            if not state.types & types:
+                return self.DEAD
+            if not state.types & ~types:
+                return self.REDUNDANT
+            state.types &= types
+
+        elif _is_unit(u, 'ChannelFilter'):
+            channels = u._args[0]
+            if not state.types & _CHANNEL_TYPES:
+                return self.DEAD
+            if state.channel is not None:
+                if state.channel not in channels:
+                    return self.DEAD
+                if not state.types & ~_CHANNEL_TYPES:
+                    return self.REDUNDANT
+            state.types &= _CHANNEL_TYPES
+            if len(channels) == 1:
+                state.channel = channels[0]
+
+        elif _is_unit(u, 'PortFilter'):
+            ports = u._args[0]
+            if state.port is not None:
+                if state.port not in ports:
+                    return self.DEAD
+                return self.REDUNDANT
+            if len(ports) == 1:
+                state.port = ports[0]
+
+        elif _is_unit(u, 'Port'):
+            state.port = u._args[0]
+
+        elif _is_unit(u, 'Channel'):
+            state.channel = u._args[0]
+
+        elif _generator_type(u) is not None:
+            port_index, channel_index = _GENERATORS[u._name][1:]
+            port = u._args[port_index]
+            if port == _constants.EVENT_PORT:
+                port = state.port
+            elif isinstance(port, _constants._EventAttribute):
+                port = None
+            if channel_index is not None:
+                channel = u._args[channel_index]
+                if (channel == _constants.EVENT_CHANNEL and
+                        not state.types & ~_CHANNEL_TYPES):
+                    channel = state.channel
+                elif isinstance(channel, _constants._EventAttribute):
+                    channel = None
+            else:
+                channel = None
+            state.types = int(_generator_type(u))
+            state.port = port
+            state.channel = channel
+
+        elif (_is_pure(u) and
+                not isinstance(u.unit, (_mididings.Generator,
+                                        _mididings.SysExGenerator))):
+            # other modifiers and filters don't change the type, port or
+            # channel of any event
+            pass
+
+        else:
+            # no idea what this does
+            state.__init__()
+
+        return self.KEEP
+
 
 def get_init_patches(patch):
     if isinstance(patch, _units.base._Chain):
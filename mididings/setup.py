@@ -13,6 +13,7 @@
 import _mididings
 
 import mididings.arguments as _arguments
+import mididings.constants as _constants
 import mididings.misc as _misc
 
 _VALID_BACKENDS = _mididings.available_backends()
@@ -26,6 +27,13 @@ _DEFAULT_CONFIG = {
     'octave_offset':    2,
     'initial_scene':    None,
     'start_delay':      None,
+    'tick_interval':    None,
+    'bypass':           {},
+    'lazy_scenes':      False,
+    'max_resident_scenes': None,
+    'gil_timeout':      None,
+    'gil_fallback':     'pass',
+    'state_file':       None,
     'silent':           False,
 }
 
@@ -97,6 +105,28 @@ def reset():
                             _arguments.each(tuple, [int, int])
                         ),
     'start_delay':      (int, float, type(None)),
+    'tick_interval':    _arguments.either(
+                            type(None),
+                            _arguments.each((int, float),
+                                _arguments.condition(lambda x: x > 0)),
+                        ),
+    'bypass':           _arguments.mappingof(
+                            _constants._EventType,
+                            _arguments.nullable((int, str))
+                        ),
+    'lazy_scenes':      bool,
+    'max_resident_scenes': _arguments.either(
+                            type(None),
+                            _arguments.each(int,
+                                _arguments.condition(lambda x: x > 0)),
+                        ),
+    'gil_timeout':      _arguments.either(
+                            type(None),
+                            _arguments.each((int, float),
+                                _arguments.condition(lambda x: x > 0)),
+                        ),
+    'gil_fallback':     ('pass', 'drop', 'defer'),
+    'state_file':       _arguments.nullable(str),
     'silent':           bool,
 })
 def config(**kwargs):
@@ -17,6 +17,7 @@ from mididings.units.splits import *
 from mididings.units.modifiers import *
 from mididings.units.generators import *
 from mididings.units.call import *
+from mididings.units.timing import *
 from mididings.units.printing import *
 from mididings.units.init import *
 
@@ -32,8 +32,13 @@ import collections as _collections
 import inspect as _inspect
 
 
+# functions called by Call(process=...), looked up by index in the worker
+# process
+_process_functions = []
+
+
 class _CallBase(_Unit):
-    def __init__(self, function, async, cont):
+    def __init__(self, function, async, cont, process=False):
         def do_call(ev):
             # add additional properties that don't exist on the C++ side
             ev.__class__ = _event.MidiEvent
@@ -53,7 +58,22 @@ class _CallBase(_Unit):
                 ev._finalize()
             return ret
 
-        _Unit.__init__(self, _mididings.Call(do_call, async, cont))
+        if process:
+            _process_functions.append(do_call)
+            unit = _mididings.CallProcess(len(_process_functions) - 1,
+                                          do_call, cont)
+        else:
+            unit = _mididings.Call(do_call, async, cont)
+        _Unit.__init__(self, unit)
+
+
+class _CallInPlace(_Unit):
+    def __init__(self, function):
+        # the same event object is passed to every call made directly from
+        # the processing thread, and copied back afterwards
+        proxy = _mididings.MidiEvent()
+        proxy.__class__ = _event.MidiEvent
+        _Unit.__init__(self, _mididings.CallInPlace(function, proxy))
 
 
 class _CallThread(_CallBase):
@@ -105,10 +125,16 @@ def _call_partial(function, args, kwargs, require_event=False):
         return function
 
 
-@_unitrepr.accept(_collections.Callable, None, kwargs={ None: None })
-def Process(function, *args, **kwargs):
+def _warn_process():
+    if _get_config('backend') == 'jack-rt' and not _get_config('silent'):
+        print("WARNING: using Process() with the 'jack-rt' backend"
+              " is probably a bad idea")
+
+
+@_overload.mark(
     """
     Process(function, *args, **kwargs)
+    Process(inplace=..., **kwargs)
 
     Process the incoming MIDI event using a Python function, then continue
     executing the mididings patch with the events returned from that
@@ -127,6 +153,16 @@ def Process(function, *args, **kwargs):
         may also be a generator that ``yield``\ s :class:`~.MidiEvent`
         objects.
 
+    :param inplace:
+        like *function*, but the event is modified in place: the same
+        :class:`~.MidiEvent` object is passed to every call, and must not
+        be used after the function returns.
+        The event is discarded if the function returns ``False``, and kept
+        (including any changes made to it) otherwise.
+        This avoids creating new Python objects for each event, and is
+        considerably faster for functions that just modify some attributes
+        of the event.
+
     :param \*args:
         optional positional arguments that will be passed to *function*.
 
@@ -139,16 +175,25 @@ def Process(function, *args, **kwargs):
     Use :func:`Call()` for tasks that may take longer and/or don't require
     returning any MIDI events.
     """
-    if _get_config('backend') == 'jack-rt' and not _get_config('silent'):
-        print("WARNING: using Process() with the 'jack-rt' backend"
-              " is probably a bad idea")
+)
+@_unitrepr.accept(_collections.Callable, None, kwargs={ None: None })
+def Process(function, *args, **kwargs):
+    _warn_process()
     return _CallBase(_call_partial(function, args, kwargs, True), False, False)
 
 
+@_overload.mark
+@_unitrepr.accept(_collections.Callable, kwargs={ None: None })
+def Process(inplace, **kwargs):
+    _warn_process()
+    return _CallInPlace(_call_partial(inplace, (), kwargs, True))
+
+
 @_overload.mark(
     """
     Call(function, *args, **kwargs)
     Call(thread=..., **kwargs)
+    Call(process=..., **kwargs)
 
     Schedule a Python function for execution.
     The incoming event is discarded.
@@ -163,6 +208,17 @@ def Process(function, *args, **kwargs):
     :param thread:
         like *function*, but causes the function to be run in its own thread.
 
+    :param process:
+        like *function*, but causes the function to be run in a separate
+        worker process, which is forked when :func:`~.run()` is called.
+        The function doesn't compete for Python's global interpreter lock
+        with any other Python code in mididings, but it also can't modify
+        any state of the main process.
+        Sysex events larger than 256 bytes are not passed to the worker
+        process.
+        After a warm :func:`~.engine.restart()`, no worker process is
+        forked, and the function is called like *function* instead.
+
     :param \*args:
         optional positional arguments that will be passed to *function*.
 
@@ -179,6 +235,11 @@ def Call(function, *args, **kwargs):
 def Call(thread, **kwargs):
     return _CallThread(_call_partial(thread, (), kwargs))
 
+@_overload.mark
+@_unitrepr.accept(_collections.Callable, kwargs={ None: None })
+def Call(process, **kwargs):
+    return _CallBase(_call_partial(process, (), kwargs), True, False, True)
+
 
 @_unitrepr.accept((str, _collections.Callable))
 def System(command):
@@ -0,0 +1,66 @@
+# -*- coding: utf-8 -*-
+#
+# mididings
+#
+# Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+
+import _mididings
+
+from mididings.units.base import _Unit
+
+import mididings.overload as _overload
+import mididings.arguments as _arguments
+import mididings.unitrepr as _unitrepr
+
+
+@_overload.mark(
+    """
+    Delay(frames)
+    Delay(seconds=...)
+    Delay(beats=...)
+
+    Delay events by the given number of frames, seconds, or beats (quarter
+    notes).
+    The length of a frame depends on the backend: with JACK it's one audio
+    sample, with ALSA it's one microsecond.
+    The length of a beat is based on the tempo of incoming MIDI clock events,
+    assuming 120 BPM until the first clocks are received.
+    Events are scheduled by the backend and sent at the exact point in time,
+    processing of other events continues immediately.
+    With backends that don't support timestamps, events are sent without
+    delay.
+    """
+)
+@_unitrepr.accept(_arguments.each(int, _arguments.condition(lambda x: x >= 0)))
+def Delay(frames):
+    return _Unit(_mididings.Delay(frames, _mididings.DelayMode.FRAMES))
+
+@_overload.mark
+@_unitrepr.accept(_arguments.each((float, int),
+                                  _arguments.condition(lambda x: x >= 0)))
+def Delay(seconds):
+    return _Unit(_mididings.Delay(seconds, _mididings.DelayMode.SECONDS))
+
+@_overload.mark
+@_unitrepr.accept(_arguments.each((float, int),
+                                  _arguments.condition(lambda x: x >= 0)))
+def Delay(beats):
+    return _Unit(_mididings.Delay(beats, _mididings.DelayMode.BEATS))
+
+
+@_unitrepr.accept(_arguments.each(int, _arguments.condition(lambda x: x > 0)))
+def ClockDivide(divisor):
+    """
+    ClockDivide(divisor)
+
+    Divide the rate of MIDI clock events, letting only every *divisor*-th
+    :const:`SYSRT_CLOCK` event pass, counting from the most recent start or
+    song position message. All other events are unaffected.
+    """
+    return _Unit(_mididings.ClockDivide(divisor))
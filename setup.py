@@ -141,9 +141,16 @@ sources = [
     'src/engine.cc',
     'src/patch.cc',
     'src/python_caller.cc',
+    'src/process_worker.cc',
     'src/send_midi.cc',
+    'src/osc.cc',
+    'src/state_file.cc',
     'src/python_module.cc',
     'src/backend/base.cc',
+    'src/backend/midi_parser.cc',
+    'src/backend/raw.cc',
+    'src/backend/udp.cc',
+    'src/backend/shm.cc',
 ]
 
 include_dirs.append('src')
@@ -153,6 +160,7 @@ if sys.version_info[0] == 3:
     boost_python_suffixes.append('3')
 libraries.append(boost_lib_name('boost_python', boost_python_suffixes))
 libraries.append(boost_lib_name('boost_thread'))
+libraries.append('rt')
 
 library_dirs.extend(library_path_dirs())
 
@@ -16,10 +16,12 @@
 #include <alsa/asoundlib.h>
 
 #include <iostream>
+#include <algorithm>
 #include <unistd.h>
 
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
 
 #include "util/string.hh"
 #include "util/debug.hh"
@@ -33,7 +35,22 @@ ALSABackend::ALSABackend(
         std::string const & client_name,
         PortNameVector const & in_port_names,
         PortNameVector const & out_port_names)
+  : _tick_interval(0)
+  , _in_ports(config::MAX_PORTS)
+  , _in_ports_rev(256)
+  , _out_ports(config::MAX_PORTS)
+  , _started(false)
+  , _watching_ports(false)
 {
+    _num_in_ports = 0;
+    _num_out_ports = 0;
+    _wake_pending = 0;
+    _input_frame = 0;
+
+    std::fill(_in_ports.begin(), _in_ports.end(), -1);
+    std::fill(_in_ports_rev.begin(), _in_ports_rev.end(), -1);
+    std::fill(_out_ports.begin(), _out_ports.end(), -1);
+
     ASSERT(!client_name.empty());
 
     // create sequencer client
@@ -45,35 +62,21 @@ ALSABackend::ALSABackend(
 
     // create input ports
     BOOST_FOREACH (std::string const & port_name, in_port_names) {
-        int id = snd_seq_create_simple_port(_seq, port_name.c_str(),
-                                            SND_SEQ_PORT_CAP_WRITE |
-                                            SND_SEQ_PORT_CAP_SUBS_WRITE,
-                                            SND_SEQ_PORT_TYPE_APPLICATION |
-                                            SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-        if (id < 0) {
-            throw Error("error creating sequencer input port");
-        }
-
-        int index = &port_name - &in_port_names[0];
-
-        _in_ports.push_back(id);
-        _in_ports_rev[id] = index;
+        create_port(false, port_name);
     }
 
     // create output ports
     BOOST_FOREACH (std::string const & port_name, out_port_names) {
-        int id = snd_seq_create_simple_port(_seq, port_name.c_str(),
-                                            SND_SEQ_PORT_CAP_READ |
-                                            SND_SEQ_PORT_CAP_SUBS_READ,
-                                            SND_SEQ_PORT_TYPE_APPLICATION |
-                                            SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-        if (id < 0) {
-            throw Error("error creating sequencer output port");
-        }
+        create_port(true, port_name);
+    }
 
-        _out_ports.push_back(id);
+    // create control port. nobody else can subscribe to it
+    _control_port = snd_seq_create_simple_port(_seq, "control",
+                                            SND_SEQ_PORT_CAP_WRITE |
+                                            SND_SEQ_PORT_CAP_NO_EXPORT,
+                                            SND_SEQ_PORT_TYPE_APPLICATION);
+    if (_control_port < 0) {
+        throw Error("error creating sequencer control port");
     }
 
     // initialize MIDI event parser.
@@ -83,38 +86,139 @@ ALSABackend::ALSABackend(
     }
     snd_midi_event_init(_parser);
     snd_midi_event_no_status(_parser, 1);
+
+    // allocate queue for scheduled output
+    _queue = snd_seq_alloc_named_queue(_seq, client_name.c_str());
+    if (_queue < 0) {
+        throw Error("error allocating sequencer queue");
+    }
 }
 
 
 ALSABackend::~ALSABackend()
 {
+    // the watcher thread may still be connecting ports
+    _port_watcher.reset();
+
+    snd_seq_free_queue(_seq, _queue);
+
     snd_midi_event_free(_parser);
 
+    snd_seq_delete_port(_seq, _control_port);
+
     BOOST_FOREACH (int i, _in_ports) {
-        snd_seq_delete_port(_seq, i);
+        if (i >= 0) snd_seq_delete_port(_seq, i);
     }
 
     BOOST_FOREACH (int i, _out_ports) {
-        snd_seq_delete_port(_seq, i);
+        if (i >= 0) snd_seq_delete_port(_seq, i);
     }
 
     snd_seq_close(_seq);
 }
 
 
+int ALSABackend::create_port(bool out, std::string const & name)
+{
+    PortIdVector & ports = out ? _out_ports : _in_ports;
+    das::atomic_size_t & num_ports = out ? _num_out_ports : _num_in_ports;
+
+    std::size_t n = num_ports;
+
+    if (n == ports.size()) {
+        throw Error("too many ports");
+    }
+
+    unsigned int caps =
+            out ? SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ
+                : SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+
+    int id = snd_seq_create_simple_port(_seq, name.c_str(), caps,
+                                        SND_SEQ_PORT_TYPE_APPLICATION |
+                                        SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+
+    if (id < 0 || id >= static_cast<int>(_in_ports_rev.size())) {
+        throw Error(out ? "error creating sequencer output port"
+                        : "error creating sequencer input port");
+    }
+
+    // other threads won't look at the new entry before the number of ports
+    // is increased
+    ports[n] = id;
+    if (!out) {
+        _in_ports_rev[id] = n;
+    }
+    num_ports = n + 1;
+
+    return n;
+}
+
+
+int ALSABackend::add_port(bool out, std::string const & name)
+{
+    return create_port(out, name);
+}
+
+
+void ALSABackend::remove_port(bool out, int port)
+{
+    PortIdVector & ports = out ? _out_ports : _in_ports;
+    das::atomic_size_t & num_ports = out ? _num_out_ports : _num_in_ports;
+
+    if (port < 0 || port >= static_cast<int>(num_ports) || ports[port] < 0) {
+        throw Error("invalid port");
+    }
+
+    int id = ports[port];
+
+    {
+        // forget the port's connection patterns
+        boost::mutex::scoped_lock lock(_connection_mutex);
+
+        ConnectionPatternVector::iterator it = _connection_patterns.begin();
+        while (it != _connection_patterns.end()) {
+            if (it->own_port.port_id == id && it->out == out) {
+                it = _connection_patterns.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    {
+        // events still arriving on the port are ignored from now on, and
+        // events sent to it are discarded. an event that's being sent right
+        // now still needs the port
+        boost::mutex::scoped_lock lock(_out_port_mutex);
+        ports[port] = -1;
+        if (!out) {
+            _in_ports_rev[id] = -1;
+        }
+    }
+
+    snd_seq_delete_port(_seq, id);
+}
+
+
 void ALSABackend::connect_ports(
         PortConnectionMap const & in_port_connections,
         PortConnectionMap const & out_port_connections)
 {
-    connect_ports_impl(in_port_connections, _in_ports, false);
-    connect_ports_impl(out_port_connections, _out_ports, true);
+    if (in_port_connections.empty() && out_port_connections.empty()) return;
+
+    // start watching for new ports before connecting to the existing ones,
+    // so that none can slip through in between
+    bool watching = watch_ports();
+
+    connect_ports_impl(in_port_connections, _in_ports, false, watching);
+    connect_ports_impl(out_port_connections, _out_ports, true, watching);
 }
 
 
 void ALSABackend::connect_ports_impl(
         PortConnectionMap const & port_connections,
         PortIdVector const & port_ids,
-        bool out)
+        bool out, bool watching)
 {
     if (port_connections.empty()) return;
 
@@ -132,6 +236,8 @@ void ALSABackend::connect_ports_impl(
 
     // for each of our own ports...
     BOOST_FOREACH (int port_id, port_ids) {
+        if (port_id < 0) continue;
+
         // get our own port name
         snd_seq_port_info_t *port_info;
         snd_seq_port_info_alloca(&port_info);
@@ -150,12 +256,34 @@ void ALSABackend::connect_ports_impl(
 
         // for each regex pattern defined for this port...
         BOOST_FOREACH (std::string const & pattern, element->second) {
+            ConnectionPattern p(own_port, pattern, out);
+
+            try {
+                // compile pattern into regex object
+                p.regex = das::regex(pattern, true);
+            }
+            catch (das::regex::compile_error & ex) {
+                throw std::runtime_error(das::make_string()
+                        << "failed to parse regular expression '"
+                        << pattern << "': " << ex.what());
+            }
+
+            boost::mutex::scoped_lock lock(_connection_mutex);
+            _connection_patterns.push_back(p);
+
             // connect to all ports that match the pattern
-            if (connect_matching_ports(own_port, ext_ports,
-                                       pattern, out) == 0) {
-                std::cerr << "warning: regular expression '" << pattern
-                          << "' didn't match any ALSA sequencer ports"
-                          << std::endl;
+            if (connect_matching_ports(_connection_patterns.back(),
+                                       ext_ports) == 0) {
+                if (watching) {
+                    std::cerr << "regular expression '" << pattern
+                              << "' doesn't match any ALSA sequencer ports "
+                                 "yet, waiting for one to appear"
+                              << std::endl;
+                } else {
+                    std::cerr << "warning: regular expression '" << pattern
+                              << "' didn't match any ALSA sequencer ports"
+                              << std::endl;
+                }
             }
         }
     }
@@ -163,24 +291,14 @@ void ALSABackend::connect_ports_impl(
 
 
 int ALSABackend::connect_matching_ports(
-        ClientPortInfo const & own_port,
-        ClientPortInfoVector const & ext_ports,
-        std::string const & pattern,
-        bool out)
+        ConnectionPattern & pattern,
+        ClientPortInfoVector const & ext_ports)
 {
-    das::regex regex;
+    das::regex & regex = pattern.regex;
+    ClientPortInfo const & own_port = pattern.own_port;
+    bool out = pattern.out;
     int count = 0;
 
-    try {
-        // compile pattern into regex object
-        regex = das::regex(pattern, true);
-    }
-    catch (das::regex::compile_error & ex) {
-        throw std::runtime_error(das::make_string()
-                << "failed to parse regular expression '"
-                << pattern << "': " << ex.what());
-    }
-
     // for each external ALSA MIDI port we might connect to...
     BOOST_FOREACH (ClientPortInfo const & ext_port, ext_ports)
     {
@@ -277,10 +395,87 @@ ALSABackend::ClientPortInfoVector ALSABackend::get_external_ports(bool out)
 }
 
 
+bool ALSABackend::watch_ports()
+{
+    boost::mutex::scoped_lock lock(_port_watcher_mutex);
+
+    if (_watching_ports) return _port_watcher.get() != NULL;
+    _watching_ports = true;
+
+    if (snd_seq_connect_from(_seq, _control_port, SND_SEQ_CLIENT_SYSTEM,
+                             SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0) {
+        // not fatal, ports just won't be reconnected
+        std::cerr << "warning: can't subscribe to ALSA sequencer "
+                     "announcements" << std::endl;
+        return false;
+    }
+
+    _port_watcher.reset(new PortWatcher<snd_seq_addr_t>(
+                boost::bind(&ALSABackend::port_started, this, _1)));
+    return true;
+}
+
+
+void ALSABackend::port_started(snd_seq_addr_t const & addr)
+{
+    if (addr.client == snd_seq_client_id(_seq)) return;
+
+    snd_seq_client_info_t *client_info;
+    snd_seq_client_info_alloca(&client_info);
+    snd_seq_port_info_t *port_info;
+    snd_seq_port_info_alloca(&port_info);
+
+    // the port may already be gone again
+    if (snd_seq_get_any_client_info(_seq, addr.client, client_info) < 0 ||
+        snd_seq_get_any_port_info(_seq, addr.client, addr.port,
+                                  port_info) < 0) {
+        return;
+    }
+
+    unsigned int capability = snd_seq_port_info_get_capability(port_info);
+
+    if (capability & SND_SEQ_PORT_CAP_NO_EXPORT) return;
+
+    ClientPortInfoVector ext_ports(1, ClientPortInfo(
+                            addr.client, addr.port,
+                            snd_seq_client_info_get_name(client_info),
+                            snd_seq_port_info_get_name(port_info)));
+
+    unsigned int const read_flags =
+            SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+    unsigned int const write_flags =
+            SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+
+    boost::mutex::scoped_lock lock(_connection_mutex);
+
+    // re-apply only those patterns whose direction fits the new port
+    BOOST_FOREACH (ConnectionPattern & p, _connection_patterns) {
+        unsigned int flags = p.out ? write_flags : read_flags;
+        if ((capability & flags) == flags) {
+            connect_matching_ports(p, ext_ports);
+        }
+    }
+}
+
+
 void ALSABackend::start(InitFunction init, CycleFunction cycle)
 {
-    // discard events which were received while processing wasn't ready
-    snd_seq_drop_input(_seq);
+    // discard events which were received while processing wasn't ready.
+    // when restarting, keep those received in the meantime
+    if (!_started) {
+        snd_seq_drop_input(_seq);
+        _started = true;
+    }
+
+    // start the queue, event frames are relative to this point in time
+    snd_seq_start_queue(_seq, _queue, NULL);
+    snd_seq_drain_output(_seq);
+
+    _input_frame = 0;
+
+    if (_tick_interval) {
+        schedule_tick(_tick_interval);
+    }
 
     // start processing thread.
     // cycle doesn't return until the program is shut down
@@ -292,22 +487,64 @@ void ALSABackend::start(InitFunction init, CycleFunction cycle)
 void ALSABackend::stop()
 {
     if (_thread) {
-        // send event to ourselves to make snd_seq_event_input() return
-        snd_seq_event_t ev;
-        snd_seq_ev_clear(&ev);
-
-        snd_seq_ev_set_direct(&ev);
-        ev.type = SND_SEQ_EVENT_USR0;
-        ev.dest.client = snd_seq_client_id(_seq);
-        ev.dest.port = _in_ports[0];
-        snd_seq_event_output_direct(_seq, &ev);
+        // make snd_seq_event_input() return, and input_event() with it
+        send_control_event(SND_SEQ_EVENT_USR0);
 
         // wait for event processing thread to terminate
         _thread->join();
+        _thread.reset();
+
+        snd_seq_stop_queue(_seq, _queue, NULL);
+        snd_seq_drain_output(_seq);
     }
 }
 
 
+void ALSABackend::wake()
+{
+    // one event in flight is enough, the processing thread runs all
+    // commands queued until it gets there
+    if (!_wake_pending) {
+        _wake_pending = 1;
+        send_control_event(SND_SEQ_EVENT_USR1);
+    }
+}
+
+
+void ALSABackend::send_control_event(snd_seq_event_type_t type)
+{
+    // send event to ourselves, bypassing the queue
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+
+    snd_seq_ev_set_direct(&ev);
+    ev.type = type;
+    ev.dest.client = snd_seq_client_id(_seq);
+    ev.dest.port = _control_port;
+
+    if (snd_seq_event_output_direct(_seq, &ev) < 0) {
+        DEBUG_PRINT("couldn't send ALSA sequencer control event");
+    }
+}
+
+
+uint64_t ALSABackend::current_frame()
+{
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca(&status);
+
+    if (snd_seq_get_queue_status(_seq, _queue, status) < 0) {
+        DEBUG_PRINT("couldn't get ALSA sequencer queue status");
+        return 0;
+    }
+
+    snd_seq_real_time_t const *t =
+                        snd_seq_queue_status_get_real_time(status);
+
+    return static_cast<uint64_t>(t->tv_sec) * 1000000 + t->tv_nsec / 1000;
+}
+
+
 void ALSABackend::process_thread(InitFunction init, CycleFunction cycle)
 {
     init();
@@ -319,7 +556,13 @@ void ALSABackend::alsa_to_midi_event(
         MidiEvent & ev,
         snd_seq_event_t const & alsa_ev)
 {
-    ev.port = _in_ports_rev[alsa_ev.dest.port];
+    ev.port = static_cast<int>(_in_ports_rev[alsa_ev.dest.port]);
+
+    if (ev.port == -1) {
+        // the port has been removed
+        ev.type = MIDI_EVENT_NONE;
+        return;
+    }
 
     switch (alsa_ev.type)
     {
@@ -443,7 +686,8 @@ void ALSABackend::alsa_to_midi_event_generic(
     std::size_t len = snd_midi_event_decode(_parser, buf, sizeof(buf),
                                             &alsa_ev);
 
-    ev = buffer_to_midi_event(buf, len, _in_ports_rev[alsa_ev.dest.port], 0);
+    int port = _in_ports_rev[alsa_ev.dest.port];
+    ev = buffer_to_midi_event(buf, len, port, 0);
 }
 
 
@@ -452,7 +696,7 @@ void ALSABackend::midi_event_to_alsa(
         MidiEvent const & ev, std::size_t & count)
 {
     ASSERT(ev.type != MIDI_EVENT_NONE);
-    ASSERT((uint)ev.port < _out_ports.size());
+    ASSERT((uint)ev.port < _num_out_ports);
     if (ev.type != MIDI_EVENT_PITCHBEND) {
         ASSERT(ev.data1 >= 0x0 && ev.data1 <= 0x7f);
         ASSERT(ev.data2 >= 0x0 && ev.data2 <= 0x7f);
@@ -542,26 +786,108 @@ void ALSABackend::midi_event_to_alsa_generic(
 }
 
 
+void ALSABackend::schedule_tick(uint64_t frame)
+{
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+
+    snd_seq_real_time_t t;
+    t.tv_sec = frame / 1000000;
+    t.tv_nsec = (frame % 1000000) * 1000;
+
+    ev.type = SND_SEQ_EVENT_ECHO;
+    snd_seq_ev_schedule_real(&ev, _queue, 0, &t);
+    snd_seq_ev_set_dest(&ev, snd_seq_client_id(_seq), _control_port);
+
+    if (snd_seq_event_output_direct(_seq, &ev) < 0) {
+        DEBUG_PRINT("couldn't schedule ALSA sequencer tick event");
+    }
+}
+
+
+bool ALSABackend::handle_control_event(MidiEvent & ev,
+                                       snd_seq_event_t const & alsa_ev)
+{
+    switch (alsa_ev.type)
+    {
+      case SND_SEQ_EVENT_USR1:
+        // woken up to run queued commands. clear the flag first, so that
+        // commands queued from now on send another event
+        _wake_pending = 0;
+        ev = MidiEvent();
+        ev.type = MIDI_EVENT_NONE;
+        return true;
+
+      case SND_SEQ_EVENT_ECHO:
+        // tick event sent to ourselves
+        if (_tick_interval) {
+            uint64_t frame =
+                    static_cast<uint64_t>(alsa_ev.time.time.tv_sec) * 1000000
+                        + alsa_ev.time.time.tv_nsec / 1000;
+
+            // schedule the next tick before processing this one
+            schedule_tick(frame + _tick_interval);
+
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_TICK;
+            ev.data1 = frame / _tick_interval;
+            ev.frame = frame;
+            return true;
+        }
+        return false;
+
+      case SND_SEQ_EVENT_PORT_START:
+        // a port appeared somewhere on the system
+        {
+            boost::mutex::scoped_lock lock(_port_watcher_mutex);
+            if (_port_watcher) {
+                _port_watcher->port_added(alsa_ev.data.addr);
+            }
+        }
+        return false;
+
+      default:
+        return false;
+    }
+}
+
+
 bool ALSABackend::input_event(MidiEvent & ev)
 {
     snd_seq_event_t *alsa_ev;
 
     // loop until we've received an event we're interested in
     for (;;) {
+        // if no events are buffered, the next call reads a new batch from
+        // the kernel
+        bool refill = snd_seq_event_input_pending(_seq, 0) == 0;
+
         if (snd_seq_event_input(_seq, &alsa_ev) < 0 || !alsa_ev) {
             DEBUG_PRINT("couldn't retrieve ALSA sequencer event");
             continue;
         }
 
-        // check for program termination
-        if (alsa_ev->type == SND_SEQ_EVENT_USR0) {
-            return false;
+        if (refill) {
+            // all events in one batch share the same timestamp
+            _input_frame = current_frame();
+        }
+
+        if (alsa_ev->dest.port == _control_port) {
+            if (alsa_ev->type == SND_SEQ_EVENT_USR0) {
+                // program termination
+                return false;
+            }
+            if (handle_control_event(ev, *alsa_ev)) {
+                return true;
+            }
+            continue;
         }
 
         // convert event from alsa
         alsa_to_midi_event(ev, *alsa_ev);
 
         if (ev.type != MIDI_EVENT_NONE) {
+            ev.frame = _input_frame;
             return true;
         }
     }
@@ -576,12 +902,39 @@ void ALSABackend::output_event(MidiEvent const & ev)
     // was sent
     std::size_t count = 0;
 
+    boost::mutex::scoped_lock lock(_out_port_mutex);
+
+    // the port may have been removed
+    int port_id = -1;
+    if (ev.port >= 0 && ev.port < static_cast<int>(_num_out_ports)) {
+        port_id = _out_ports[ev.port];
+    }
+    if (port_id < 0) {
+        return;
+    }
+
+    uint64_t now = _input_frame;
+
+    // events with a frame in the future are scheduled on our queue.
+    // the time of the last input is never ahead of the queue's actual time,
+    // and events that turn out to be due already are sent right away
+    uint64_t frame = ev.frame;
+    bool scheduled = frame > now;
+
     do {
         midi_event_to_alsa(alsa_ev, ev, count);
 
         snd_seq_ev_set_subs(&alsa_ev);
-        snd_seq_ev_set_direct(&alsa_ev);
-        snd_seq_ev_set_source(&alsa_ev, _out_ports[ev.port]);
+        snd_seq_ev_set_source(&alsa_ev, port_id);
+
+        if (scheduled) {
+            snd_seq_real_time_t t;
+            t.tv_sec = frame / 1000000;
+            t.tv_nsec = (frame % 1000000) * 1000;
+            snd_seq_ev_schedule_real(&alsa_ev, _queue, 0, &t);
+        } else {
+            snd_seq_ev_set_direct(&alsa_ev);
+        }
 
         if (snd_seq_event_output_direct(_seq, &alsa_ev) < 0) {
             DEBUG_PRINT("couldn't output event to ALSA sequencer buffer");
@@ -591,7 +944,11 @@ void ALSABackend::output_event(MidiEvent const & ev)
             // wait as long as it takes for one chunk to be transmitted at
             // MIDI baud rate.
             // constant copied from Simple Sysexxer by Christoph Eckert.
-            ::usleep(config::ALSA_SYSEX_CHUNK_SIZE * 352);
+            if (scheduled) {
+                frame += config::ALSA_SYSEX_CHUNK_SIZE * 352;
+            } else {
+                ::usleep(config::ALSA_SYSEX_CHUNK_SIZE * 352);
+            }
         }
     } while (count);
 }
@@ -21,6 +21,11 @@
 #include <map>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "backend/port_watcher.hh"
+#include "util/string.hh"
+#include "util/ringbuffer.hh"
 
 
 namespace mididings {
@@ -42,17 +47,37 @@ class ALSABackend
     virtual bool input_event(MidiEvent & ev);
     virtual void output_event(MidiEvent const & ev);
 
+    virtual bool can_wake() const {
+        return true;
+    }
+
+    virtual void wake();
+
     virtual void finish() {
         // nothing to do
     }
 
     virtual std::size_t num_out_ports() const {
-        return _out_ports.size();
+        return _num_out_ports;
+    }
+
+    virtual int add_port(bool out, std::string const & name);
+    virtual void remove_port(bool out, int port);
+
+    // event frames are in microseconds since the sequencer queue was started
+    virtual unsigned int samplerate() const {
+        return 1000000;
+    }
+
+    virtual bool set_tick_interval(uint64_t frames) {
+        _tick_interval = frames;
+        return true;
     }
 
     /**
      * Connect our own input and output ports according to the regular
-     * expressions specified.
+     * expressions specified. Ports that appear later and match any of the
+     * expressions are connected as well.
      */
     virtual void connect_ports(PortConnectionMap const & in_port_connections,
                                PortConnectionMap const & out_port_connections);
@@ -80,19 +105,39 @@ class ALSABackend
 
     typedef std::vector<ClientPortInfo> ClientPortInfoVector;
 
-    typedef std::vector<int> PortIdVector;
-    typedef std::map<int, int> RevPortIdMap;
+    /**
+     * Connection pattern for one of our own ports, compiled once and
+     * re-applied to every port that appears later.
+     */
+    struct ConnectionPattern {
+        ConnectionPattern(ClientPortInfo const & own_port,
+                          std::string const & pattern,
+                          bool out)
+          : own_port(own_port),
+            pattern(pattern),
+            out(out)
+        { }
+
+        ClientPortInfo own_port;
+        std::string pattern;
+        das::regex regex;
+        bool out;
+    };
+
+    typedef std::vector<ConnectionPattern> ConnectionPatternVector;
+
+    // port IDs are read by the processing thread while ports are being
+    // added and removed from other threads
+    typedef std::vector<das::atomic_int> PortIdVector;
 
     void connect_ports_impl(
             PortConnectionMap const & port_connections,
             PortIdVector const & port_ids,
-            bool out);
+            bool out, bool watching);
 
     int connect_matching_ports(
-            ClientPortInfo const & own_port,
-            ClientPortInfoVector const & ext_ports,
-            std::string const & pattern,
-            bool out);
+            ConnectionPattern & pattern,
+            ClientPortInfoVector const & ext_ports);
 
     bool connect_single_port(
             ClientPortInfo const & own_port,
@@ -101,8 +146,35 @@ class ALSABackend
 
     ClientPortInfoVector get_external_ports(bool out);
 
+    // create a new port, and append it to the port table
+    int create_port(bool out, std::string const & name);
+
+    // subscribe to the system announce port, so we get notified of new
+    // ports. returns false if that's not possible
+    bool watch_ports();
+
+    // called from the port watcher thread for each newly started port
+    void port_started(snd_seq_addr_t const & addr);
+
     void process_thread(InitFunction init, CycleFunction cycle);
 
+    // get the current real time of our sequencer queue, in microseconds.
+    // this takes a round trip to the kernel, so it's only called once for
+    // each batch of events read
+    uint64_t current_frame();
+
+    // schedule an echo event to our control port, to be received as a tick
+    void schedule_tick(uint64_t frame);
+
+    // send an event of the given type directly to our own control port
+    void send_control_event(snd_seq_event_type_t type);
+
+    // handle an event sent to our control port, other than the one to stop
+    // processing. returns true if input_event() should return, with ev set
+    // to the tick received, or to MIDI_EVENT_NONE when woken up
+    bool handle_control_event(MidiEvent & ev,
+                              snd_seq_event_t const & alsa_ev);
+
     void alsa_to_midi_event(MidiEvent & ev,
                             snd_seq_event_t const & alsa_ev);
     void alsa_to_midi_event_sysex(MidiEvent & ev,
@@ -119,9 +191,36 @@ class ALSABackend
 
     snd_seq_t *_seq;
 
+    // sequencer queue used to schedule events for future output
+    int _queue;
+
+    // interval in microseconds at which tick events are generated, or zero
+    uint64_t _tick_interval;
+
+    // queue time at which the most recent batch of input events was read.
+    // written by the processing thread, read by any thread sending output
+    das::atomic_uint64_t _input_frame;
+
+    // port tables of fixed capacity, so that ports can be added without
+    // reallocating while other threads are using them. removed ports are -1
     PortIdVector _in_ports;     // alsa input port IDs
-    RevPortIdMap _in_ports_rev; // reverse mapping (input port ID -> port #)
+    PortIdVector _in_ports_rev; // reverse mapping (input port ID -> port #)
     PortIdVector _out_ports;    // alsa output port IDs
+    das::atomic_size_t _num_in_ports;
+    das::atomic_size_t _num_out_ports;
+
+    // held while sending an event, so that its port isn't deleted while
+    // still in use
+    boost::mutex _out_port_mutex;
+
+    // private port receiving our own stop, wake and tick events, and
+    // announcements from the system client. it exists even if there are no
+    // input ports
+    int _control_port;
+
+    // true while a wake event sent to the control port hasn't been
+    // received yet
+    das::atomic_size_t _wake_pending;
 
     snd_midi_event_t *_parser;
 
@@ -129,6 +228,20 @@ class ALSABackend
     std::map<int, SysExDataPtr> _sysex_buffer;
 
     boost::scoped_ptr<boost::thread> _thread;
+
+    // true once processing has been started for the first time
+    bool _started;
+
+    // patterns of all connections made so far
+    ConnectionPatternVector _connection_patterns;
+    boost::mutex _connection_mutex;
+
+    // true once we're subscribed to the system announce port
+    bool _watching_ports;
+
+    // connects ports as they appear, only exists if there are any patterns
+    boost::scoped_ptr<PortWatcher<snd_seq_addr_t> > _port_watcher;
+    boost::mutex _port_watcher_mutex;
 };
 
 
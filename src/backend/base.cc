@@ -11,6 +11,9 @@
 
 #include "config.hh"
 #include "backend/base.hh"
+#include "backend/raw.hh"
+#include "backend/udp.hh"
+#include "backend/shm.hh"
 #ifdef ENABLE_ALSA_SEQ
   #include "backend/alsa.hh"
 #endif
@@ -37,6 +40,9 @@ namespace {
         AVAILABLE.push_back("jack");
         AVAILABLE.push_back("jack-rt");
 #endif
+        AVAILABLE.push_back("raw");
+        AVAILABLE.push_back("udp");
+        AVAILABLE.push_back("shm");
         return false;
     }
 
@@ -76,6 +82,15 @@ BackendPtr create(
                     new JACKRealtimeBackend(client_name, in_ports, out_ports));
     }
 #endif
+    else if (backend_name == "raw") {
+        return BackendPtr(new RawBackend(in_ports, out_ports));
+    }
+    else if (backend_name == "udp") {
+        return BackendPtr(new UDPBackend(in_ports, out_ports));
+    }
+    else if (backend_name == "shm") {
+        return BackendPtr(new ShmBackend(client_name, in_ports, out_ports));
+    }
     else {
         throw Error("invalid backend selected: " + backend_name);
     }
@@ -42,6 +42,9 @@ typedef boost::shared_ptr<class BackendBase> BackendPtr;
 typedef std::vector<std::string> PortNameVector;
 typedef std::map<std::string, std::vector<std::string> > PortConnectionMap;
 
+// backend-specific counters, by name
+typedef std::map<std::string, uint64_t> BackendStats;
+
 
 std::vector<std::string> const & available();
 
@@ -82,7 +85,9 @@ class BackendBase
     // cycle may be called once (and not return) or periodically.
     virtual void start(InitFunction init, CycleFunction cycle) = 0;
 
-    // stop MIDI processing.
+    // stop MIDI processing. processing may be started again later on, with
+    // all ports and connections kept alive. events received while processing
+    // is stopped are delivered once it's restarted.
     virtual void stop() = 0;
 
     // get one event from input, return true if an event was read.
@@ -92,6 +97,17 @@ class BackendBase
     // send one event to the output.
     virtual void output_event(MidiEvent const & ev) = 0;
 
+    // return true if the processing thread will soon get to run commands
+    // queued by other threads after wake() is called, so that those threads
+    // don't have to compete with it for running them.
+    virtual bool can_wake() const {
+        return false;
+    }
+
+    // make input_event() return soon, with an event of type MIDI_EVENT_NONE
+    // if there's no input. may be called from any thread.
+    virtual void wake() { }
+
     // send multiple events to the output.
     template <typename IterT>
     void output_events(IterT begin, IterT end) {
@@ -103,8 +119,47 @@ class BackendBase
     // wait for all pending event output to be completed.
     virtual void finish() = 0;
 
-    // return the number of output ports
+    // return true if processing ended because there won't be any more
+    // input, e.g. once all input files have been read to the end.
+    // called from the processing thread after cycle has returned.
+    virtual bool finished() const {
+        return false;
+    }
+
+    // return the number of output ports, including those that were removed
     virtual std::size_t num_out_ports() const = 0;
+
+    // add an input or output port while the backend is running, and return
+    // its port number. throws Error if the port can't be created.
+    virtual int add_port(bool /*out*/, std::string const & /*name*/) {
+        throw Error("backend doesn't support adding ports");
+    }
+
+    // remove a port. the numbers of all other ports remain unchanged, and
+    // events sent to the removed port are discarded.
+    virtual void remove_port(bool /*out*/, int /*port*/) {
+        throw Error("backend doesn't support removing ports");
+    }
+
+    // generate a tick event at every frame that is a multiple of the given
+    // interval, or stop generating ticks if the interval is zero.
+    // returns false if the backend doesn't support ticks.
+    virtual bool set_tick_interval(uint64_t /*frames*/) {
+        return false;
+    }
+
+    // return the number of frames per second used for event timestamps,
+    // or zero if the backend doesn't support timestamps.
+    // events whose frame lies in the future are scheduled for later output.
+    virtual unsigned int samplerate() const {
+        return 0;
+    }
+
+    // return backend-specific statistics, such as network packet loss.
+    // may be called from any thread.
+    virtual BackendStats stats() const {
+        return BackendStats();
+    }
 };
 
 
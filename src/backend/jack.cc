@@ -17,8 +17,12 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
 
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 
 #include "util/string.hh"
 #include "util/debug.hh"
@@ -31,10 +35,22 @@ namespace backend {
 JACKBackend::JACKBackend(std::string const & client_name,
                          PortNameVector const & in_port_names,
                          PortNameVector const & out_port_names)
-  : _current_frame(0)
+  : _in_ports(config::MAX_PORTS)
+  , _out_ports(config::MAX_PORTS)
+  , _current_frame(0)
   , _input_queue(config::JACK_MAX_EVENTS)
-  , _last_written_frame(out_port_names.size())
+  , _last_written_frame(config::MAX_PORTS)
+  , _scheduled(config::SCHEDULER_MAX_EVENTS, config::SCHEDULER_SLOTS,
+               config::SCHEDULER_SLOT_SHIFT)
+  , _due_index(0)
 {
+    _due_events.reserve(config::SCHEDULER_MAX_EVENTS);
+    _tick_interval = 0;
+    _cycle = 0;
+    _in_cycle = 0;
+    _num_in_ports = 0;
+    _num_out_ports = 0;
+
     ASSERT(!client_name.empty());
 
     // create JACK client
@@ -44,27 +60,17 @@ JACKBackend::JACKBackend(std::string const & client_name,
     }
 
     jack_set_process_callback(_client, &process_, static_cast<void*>(this));
+    jack_set_port_registration_callback(_client, &port_registration_,
+                                        static_cast<void*>(this));
 
     // create input ports
     BOOST_FOREACH (std::string const & port_name, in_port_names) {
-        jack_port_t *p = jack_port_register(_client, port_name.c_str(),
-                                            JACK_DEFAULT_MIDI_TYPE,
-                                            JackPortIsInput, 0);
-        if (p == NULL) {
-            throw Error("error creating input port");
-        }
-        _in_ports.push_back(p);
+        register_port(false, port_name);
     }
 
     // create output ports
     BOOST_FOREACH (std::string const & port_name, out_port_names) {
-        jack_port_t *p = jack_port_register(_client, port_name.c_str(),
-                                            JACK_DEFAULT_MIDI_TYPE,
-                                            JackPortIsOutput, 0);
-        if (p == NULL) {
-            throw Error("error creating output port");
-        }
-        _out_ports.push_back(p);
+        register_port(true, port_name);
     }
 
     if (jack_activate(_client)) {
@@ -76,14 +82,125 @@ JACKBackend::JACKBackend(std::string const & client_name,
 JACKBackend::~JACKBackend()
 {
     jack_deactivate(_client);
+
+    // no more registration callbacks after this point, but the watcher
+    // thread may still be connecting ports
+    _port_watcher.reset();
+
     jack_client_close(_client);
 }
 
 
+unsigned int JACKBackend::samplerate() const
+{
+    return jack_get_sample_rate(_client);
+}
+
+
+int JACKBackend::register_port(bool out, std::string const & name)
+{
+    PortVector & ports = out ? _out_ports : _in_ports;
+    das::atomic_size_t & num_ports = out ? _num_out_ports : _num_in_ports;
+
+    std::size_t n = num_ports;
+
+    if (n == ports.size()) {
+        throw Error("too many ports");
+    }
+
+    jack_port_t *p = jack_port_register(_client, name.c_str(),
+                                        JACK_DEFAULT_MIDI_TYPE,
+                                        out ? JackPortIsOutput
+                                            : JackPortIsInput, 0);
+    if (p == NULL) {
+        throw Error(out ? "error creating output port"
+                        : "error creating input port");
+    }
+
+    // the process thread won't look at the new entry before the number of
+    // ports is increased
+    ports[n] = p;
+    num_ports = n + 1;
+
+    return n;
+}
+
+
+int JACKBackend::add_port(bool out, std::string const & name)
+{
+    return register_port(out, name);
+}
+
+
+void JACKBackend::remove_port(bool out, int port)
+{
+    PortVector & ports = out ? _out_ports : _in_ports;
+    das::atomic_size_t & num_ports = out ? _num_out_ports : _num_in_ports;
+
+    if (port < 0 || port >= static_cast<int>(num_ports) || !ports[port]) {
+        throw Error("invalid port");
+    }
+
+    jack_port_t *p = ports[port];
+
+    ports[port] = NULL;
+
+    // once the current cycle has completed, the process thread can no
+    // longer be using the port
+    if (!wait_for_cycle(config::JACK_REMOVE_PORT_TIMEOUT)) {
+        ports[port] = p;
+        throw Error("timeout waiting for the process thread");
+    }
+
+    {
+        // forget the port's connection patterns
+        boost::mutex::scoped_lock lock(_connection_mutex);
+
+        ConnectionPatternVector::iterator it = _connection_patterns.begin();
+        while (it != _connection_patterns.end()) {
+            if (it->port == p) {
+                it = _connection_patterns.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    jack_port_unregister(_client, p);
+}
+
+
+bool JACKBackend::wait_for_cycle(int timeout)
+{
+    // either the process thread is outside of a cycle, or the cycle counter
+    // changes once the current one has completed
+    std::size_t cycle = _cycle;
+    for (int t = 0; _in_cycle && _cycle == cycle; ++t) {
+        if (t == timeout) {
+            return false;
+        }
+        ::usleep(1000);
+    }
+    return true;
+}
+
+
 void JACKBackend::connect_ports(
         PortConnectionMap const & in_port_connections,
         PortConnectionMap const & out_port_connections)
 {
+    if (in_port_connections.empty() && out_port_connections.empty()) return;
+
+    {
+        // start watching for new ports before connecting to the existing
+        // ones, so that none can slip through in between
+        boost::mutex::scoped_lock lock(_port_watcher_mutex);
+        if (!_port_watcher) {
+            _port_watcher.reset(new PortWatcher<jack_port_id_t>(
+                    boost::bind(&JACKBackend::port_registered, this, _1)));
+        }
+    }
+
     connect_ports_impl(in_port_connections, _in_ports, false);
     connect_ports_impl(out_port_connections, _out_ports, true);
 }
@@ -91,30 +208,33 @@ void JACKBackend::connect_ports(
 
 void JACKBackend::connect_ports_impl(
         PortConnectionMap const & port_connections,
-        std::vector<jack_port_t *> const & ports,
+        PortVector const & ports,
         bool out)
 {
     if (port_connections.empty()) return;
 
     // get all JACK MIDI ports we could connect to
+    PortNameVector external_ports;
+
     char const **external_ports_array = jack_get_ports(
                                 _client, NULL, JACK_DEFAULT_MIDI_TYPE,
                                 out ? JackPortIsInput : JackPortIsOutput);
-    if (!external_ports_array) return;
-
-    // find end of array
-    char const **end = external_ports_array;
-    while (*end != NULL) ++end;
+    if (external_ports_array) {
+        // find end of array
+        char const **end = external_ports_array;
+        while (*end != NULL) ++end;
 
-    // convert char* array to vector of strings
-    PortNameVector external_ports(external_ports_array, end);
+        // convert char* array to vector of strings
+        external_ports.assign(external_ports_array, end);
 
-    jack_free(external_ports_array);
+        jack_free(external_ports_array);
+    }
 
     // for each of our ports...
     BOOST_FOREACH (jack_port_t * port, ports) {
+        if (!port) continue;
+
         std::string short_name = jack_port_short_name(port);
-        std::string port_name = jack_port_name(port);
 
         PortConnectionMap::const_iterator element =
                 port_connections.find(short_name);
@@ -124,11 +244,31 @@ void JACKBackend::connect_ports_impl(
 
         // for each regex pattern defined for this port...
         BOOST_FOREACH (std::string const & pattern, element->second) {
+            ConnectionPattern p;
+            p.port = port;
+            p.pattern = pattern;
+            p.out = out;
+
+            try {
+                // compile pattern into regex object
+                p.regex = das::regex(pattern, true);
+            }
+            catch (das::regex::compile_error & ex) {
+                throw std::runtime_error(das::make_string()
+                        << "failed to parse regular expression '"
+                        << pattern << "': " << ex.what());
+            }
+
+            boost::mutex::scoped_lock lock(_connection_mutex);
+            _connection_patterns.push_back(p);
+
             // connect to all ports that match the pattern
-            if (connect_matching_ports(port_name, pattern,
-                                       external_ports, out) == 0) {
-                std::cerr << "warning: regular expression '" << pattern
-                          << "' didn't match any JACK MIDI ports" << std::endl;
+            if (connect_matching_ports(_connection_patterns.back(),
+                                       external_ports) == 0) {
+                // new ports are always watched for, so this isn't final
+                std::cerr << "regular expression '" << pattern
+                          << "' doesn't match any JACK MIDI ports yet, "
+                             "waiting for one to appear" << std::endl;
             }
         }
     }
@@ -136,43 +276,72 @@ void JACKBackend::connect_ports_impl(
 
 
 int JACKBackend::connect_matching_ports(
-        std::string const & port_name,
-        std::string const & pattern,
-        PortNameVector const & external_ports,
-        bool out)
+        ConnectionPattern & pattern,
+        PortNameVector const & external_ports)
 {
-    try {
-        // compile pattern into regex object
-        das::regex regex(pattern, true);
-        int count = 0;
-
-        // for each external JACK MIDI port we might connect to...
-        BOOST_FOREACH (std::string const & external_port, external_ports) {
-            // check if port name matches regex
-            if (regex.match(external_port)) {
-                // connect output to input port
-                std::string const & output_port =
-                        out ? port_name : external_port;
-                std::string const & input_port =
-                        out ? external_port : port_name;
-
-                int error = jack_connect(_client, output_port.c_str(),
-                                                  input_port.c_str());
-
-                if (error && error != EEXIST) {
-                    std::cerr << "could not connect " << output_port
-                              << " to " << input_port << std::endl;
-                }
-
-                ++count;
+    std::string port_name = jack_port_name(pattern.port);
+    int count = 0;
+
+    // for each external JACK MIDI port we might connect to...
+    BOOST_FOREACH (std::string const & external_port, external_ports) {
+        // check if port name matches regex
+        if (pattern.regex.match(external_port)) {
+            // connect output to input port
+            std::string const & output_port =
+                    pattern.out ? port_name : external_port;
+            std::string const & input_port =
+                    pattern.out ? external_port : port_name;
+
+            int error = jack_connect(_client, output_port.c_str(),
+                                              input_port.c_str());
+
+            if (error && error != EEXIST) {
+                std::cerr << "could not connect " << output_port
+                          << " to " << input_port << std::endl;
             }
+
+            ++count;
         }
-        return count;
     }
-    catch (das::regex::compile_error & ex) {
-        throw std::runtime_error(das::make_string()
-                << "failed to parse regular expression '"
-                << pattern << "': " << ex.what());
+    return count;
+}
+
+
+void JACKBackend::port_registration_(jack_port_id_t id, int reg, void *arg)
+{
+    JACKBackend *that = static_cast<JACKBackend*>(arg);
+
+    // this runs in JACK's notification thread, which must not make any
+    // connections itself
+    if (reg) {
+        boost::mutex::scoped_lock lock(that->_port_watcher_mutex);
+        if (that->_port_watcher) {
+            that->_port_watcher->port_added(id);
+        }
+    }
+}
+
+
+void JACKBackend::port_registered(jack_port_id_t const & id)
+{
+    jack_port_t *port = jack_port_by_id(_client, id);
+
+    // the port may already be gone again
+    if (!port || jack_port_is_mine(_client, port) ||
+            std::strcmp(jack_port_type(port), JACK_DEFAULT_MIDI_TYPE) != 0) {
+        return;
+    }
+
+    int flags = jack_port_flags(port);
+    PortNameVector external_ports(1, jack_port_name(port));
+
+    boost::mutex::scoped_lock lock(_connection_mutex);
+
+    // re-apply only those patterns whose direction fits the new port
+    BOOST_FOREACH (ConnectionPattern & p, _connection_patterns) {
+        if (flags & (p.out ? JackPortIsInput : JackPortIsOutput)) {
+            connect_matching_ports(p, external_ports);
+        }
     }
 }
 
@@ -181,15 +350,25 @@ int JACKBackend::process_(jack_nframes_t nframes, void *arg)
 {
     JACKBackend *that = static_cast<JACKBackend*>(arg);
 
+    that->_in_cycle = 1;
+
     // read events from all input ports, and order them by frame
     that->fill_input_queue(nframes);
 
     std::fill(that->_last_written_frame.begin(),
-              that->_last_written_frame.end(), 0);
+              that->_last_written_frame.begin() + that->_num_out_ports, 0);
+
+    // collect scheduled events that are due within this period
+    that->expire_scheduled_events(nframes);
 
     int r = that->process(nframes);
 
+    // write all scheduled events that haven't been written yet
+    that->write_due_events(nframes, nframes);
+
     that->_current_frame += nframes;
+    that->_cycle = that->_cycle + 1;
+    that->_in_cycle = 0;
     return r;
 }
 
@@ -198,8 +377,13 @@ void JACKBackend::fill_input_queue(jack_nframes_t nframes)
 {
     ASSERT(_input_queue.empty());
 
-    for (unsigned int port = 0; port != _in_ports.size(); ++port) {
-        void *port_buffer = jack_port_get_buffer(_in_ports[port], nframes);
+    std::size_t num_ports = _num_in_ports;
+
+    for (unsigned int port = 0; port != num_ports; ++port) {
+        jack_port_t *p = _in_ports[port];
+        if (!p) continue;
+
+        void *port_buffer = jack_port_get_buffer(p, nframes);
 
         for (unsigned int n = 0;
                 n != jack_midi_get_event_count(port_buffer); ++n) {
@@ -212,13 +396,34 @@ void JACKBackend::fill_input_queue(jack_nframes_t nframes)
             _input_queue.push(ev);
         }
     }
+
+    std::size_t interval = _tick_interval;
+
+    if (interval) {
+        // insert ticks at all frames within this period that are multiples
+        // of the tick interval
+        uint64_t frame = (_current_frame + interval - 1) / interval * interval;
+
+        for ( ; frame < _current_frame + nframes; frame += interval) {
+            MidiEvent ev;
+            ev.type = MIDI_EVENT_TICK;
+            ev.data1 = frame / interval;
+            ev.frame = frame;
+            _input_queue.push(ev);
+        }
+    }
 }
 
 
 void JACKBackend::clear_buffers(jack_nframes_t nframes)
 {
-    for (unsigned int n = 0; n < _out_ports.size(); ++n) {
-        void *port_buffer = jack_port_get_buffer(_out_ports[n], nframes);
+    std::size_t num_ports = _num_out_ports;
+
+    for (unsigned int n = 0; n < num_ports; ++n) {
+        jack_port_t *p = _out_ports[n];
+        if (!p) continue;
+
+        void *port_buffer = jack_port_get_buffer(p, nframes);
         jack_midi_clear_buffer(port_buffer);
     }
 }
@@ -237,6 +442,69 @@ bool JACKBackend::read_event(MidiEvent & ev, jack_nframes_t /*nframes*/)
 
 
 bool JACKBackend::write_event(MidiEvent const & ev, jack_nframes_t nframes)
+{
+    // the frame at which the event should be sent, taking into account the
+    // latency of the backend: with zero latency, events are sent within the
+    // same period, otherwise they are delayed by exactly one period
+    // (minimize jitter)
+    uint64_t frame = ev.frame + output_latency(nframes);
+
+    if (frame >= _current_frame + nframes) {
+        // event lies beyond the current period, schedule it for later
+        if (!_scheduled.schedule(ev, frame)) {
+            DEBUG_PRINT("couldn't schedule event, too many pending events");
+            return false;
+        }
+        return true;
+    }
+
+    // the frame within the current period at which the event will be written.
+    // if the event is older, send as soon as possible (minimize latency)
+    jack_nframes_t write_at_frame =
+            frame > _current_frame ? frame - _current_frame : 0;
+
+    // scheduled events that are due no later than this one go first
+    write_due_events(write_at_frame + 1, nframes);
+
+    return write_event_at(ev, write_at_frame, nframes);
+}
+
+
+void JACKBackend::expire_scheduled_events(jack_nframes_t nframes)
+{
+    ASSERT(_due_events.empty());
+
+    _scheduled.expire(_current_frame + nframes,
+                      append_due_event(_due_events));
+    _due_index = 0;
+}
+
+
+void JACKBackend::write_due_events(jack_nframes_t limit,
+                                   jack_nframes_t nframes)
+{
+    while (_due_index != _due_events.size() &&
+           _due_events[_due_index].frame < _current_frame + limit) {
+        MidiEvent const & ev = _due_events[_due_index++];
+
+        jack_nframes_t write_at_frame =
+                ev.frame > _current_frame ? ev.frame - _current_frame : 0;
+
+        if (!write_event_at(ev, write_at_frame, nframes)) {
+            DEBUG_PRINT("couldn't write scheduled event to output buffer");
+        }
+    }
+
+    if (_due_index == _due_events.size()) {
+        _due_events.clear();
+        _due_index = 0;
+    }
+}
+
+
+bool JACKBackend::write_event_at(MidiEvent const & ev,
+                                 jack_nframes_t write_at_frame,
+                                 jack_nframes_t nframes)
 {
     unsigned char data[config::JACK_MAX_EVENT_SIZE];
     std::size_t len = sizeof(data);
@@ -245,25 +513,17 @@ bool JACKBackend::write_event(MidiEvent const & ev, jack_nframes_t nframes)
 
     VERIFY(midi_event_to_buffer(ev, data, len, port, frame));
 
-    void *port_buffer = jack_port_get_buffer(_out_ports[port], nframes);
-
-    if (!len || len > jack_midi_max_event_size(port_buffer)) {
+    // the port may have been removed
+    jack_port_t *p = port < static_cast<int>(_num_out_ports)
+                        ? static_cast<jack_port_t *>(_out_ports[port]) : NULL;
+    if (!p) {
         return false;
     }
 
-    // the frame within the current period at which the event will be written
-    jack_nframes_t write_at_frame;
+    void *port_buffer = jack_port_get_buffer(p, nframes);
 
-    if (frame >= _current_frame) {
-        // event received within current period, zero delay
-        write_at_frame = frame - _current_frame;
-    } else if (frame >= _current_frame - nframes) {
-        // event received during last period, exactly one period delay
-        // (minimize jitter)
-        write_at_frame = frame - _current_frame + nframes;
-    } else {
-        // event is older, send as soon as possible (minimize latency)
-        write_at_frame = 0;
+    if (!len || len > jack_midi_max_event_size(port_buffer)) {
+        return false;
     }
 
     // if events would be out of order, simply increase this event's frame
@@ -21,6 +21,14 @@
 
 #include <jack/types.h>
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "backend/port_watcher.hh"
+#include "util/timing_wheel.hh"
+#include "util/ringbuffer.hh"
+#include "util/string.hh"
+
 
 namespace mididings {
 namespace backend {
@@ -39,7 +47,17 @@ class JACKBackend
     virtual ~JACKBackend();
 
     virtual std::size_t num_out_ports() const {
-        return _out_ports.size();
+        return _num_out_ports;
+    }
+
+    virtual int add_port(bool out, std::string const & name);
+    virtual void remove_port(bool out, int port);
+
+    virtual unsigned int samplerate() const;
+
+    virtual bool set_tick_interval(uint64_t frames) {
+        _tick_interval = frames;
+        return true;
     }
 
     virtual void connect_ports(PortConnectionMap const & in_port_connections,
@@ -52,28 +70,79 @@ class JACKBackend
         return 0;
     }
 
+    // the number of frames by which events written during the current period
+    // are delayed relative to the frame at which they were received
+    virtual jack_nframes_t output_latency(jack_nframes_t /*nframes*/) const {
+        return 0;
+    }
+
     void clear_buffers(jack_nframes_t nframes);
     bool read_event(MidiEvent & ev, jack_nframes_t nframes);
     bool write_event(MidiEvent const & ev, jack_nframes_t nframes);
 
+    // wait until the process thread has finished the cycle it's currently
+    // running, if any. returns false if it's still running after timeout
+    // milliseconds
+    bool wait_for_cycle(int timeout);
+
     jack_client_t *_client;
-    std::vector<jack_port_t *> _in_ports;
-    std::vector<jack_port_t *> _out_ports;
 
-    jack_nframes_t _current_frame;
+    // port tables of fixed capacity, so that ports can be added without
+    // reallocating while the process thread is using them. removed ports
+    // are null
+    typedef std::vector<das::atomic_pointer<jack_port_t> > PortVector;
+    PortVector _in_ports;
+    PortVector _out_ports;
+    das::atomic_size_t _num_in_ports;
+    das::atomic_size_t _num_out_ports;
+
+    // frames processed since the client was activated. jack_nframes_t
+    // would wrap after a day or so, and the scheduler's clock must not
+    uint64_t _current_frame;
 
   private:
+    /*
+     * connection pattern for one of our own ports, compiled once and
+     * re-applied to every MIDI port that appears later.
+     */
+    struct ConnectionPattern {
+        jack_port_t *port;
+        std::string pattern;
+        das::regex regex;
+        bool out;
+    };
+
+    typedef std::vector<ConnectionPattern> ConnectionPatternVector;
+
     static int process_(jack_nframes_t nframes, void *arg);
+    static void port_registration_(jack_port_id_t id, int reg, void *arg);
+
+    // called from the port watcher thread for each newly registered port
+    void port_registered(jack_port_id_t const & id);
+
+    // register a new port, and append it to the port table
+    int register_port(bool out, std::string const & name);
 
     void fill_input_queue(jack_nframes_t nframes);
 
+    void expire_scheduled_events(jack_nframes_t nframes);
+    void write_due_events(jack_nframes_t limit, jack_nframes_t nframes);
+    bool write_event_at(MidiEvent const & ev, jack_nframes_t write_at_frame,
+                        jack_nframes_t nframes);
+
     void connect_ports_impl(PortConnectionMap const & port_connections,
-                            std::vector<jack_port_t *> const & ports,
-                            bool out);
-    int connect_matching_ports(std::string const & port_name,
-                            std::string const & pattern,
-                            PortNameVector const & external_ports,
+                            PortVector const & ports,
                             bool out);
+    int connect_matching_ports(ConnectionPattern & pattern,
+                            PortNameVector const & external_ports);
+
+    // patterns of all connections made so far
+    ConnectionPatternVector _connection_patterns;
+    boost::mutex _connection_mutex;
+
+    // connects ports as they appear, only exists if there are any patterns
+    boost::scoped_ptr<PortWatcher<jack_port_id_t> > _port_watcher;
+    boost::mutex _port_watcher_mutex;
 
 
     template <typename T, typename Container, typename Compare>
@@ -109,6 +178,31 @@ class JACKBackend
 
     // the frame at which the last event during each period was written
     std::vector<jack_nframes_t> _last_written_frame;
+
+    // interval in frames at which tick events are generated, or zero
+    das::atomic_size_t _tick_interval;
+
+    // number of process cycles completed so far, and whether the process
+    // thread is currently inside a cycle
+    das::atomic_size_t _cycle;
+    das::atomic_size_t _in_cycle;
+
+    // events scheduled for output in a future period, keyed by frame
+    das::timing_wheel<MidiEvent> _scheduled;
+
+    // scheduled events that are due in the current period, ordered by frame.
+    // the frame of each event is the absolute frame at which it's to be sent
+    std::vector<MidiEvent> _due_events;
+    std::size_t _due_index;
+
+    struct append_due_event {
+        append_due_event(std::vector<MidiEvent> & v) : due(v) { }
+        void operator()(MidiEvent const & ev, uint64_t frame) {
+            due.push_back(ev);
+            due.back().frame = frame;
+        }
+        std::vector<MidiEvent> & due;
+    };
 };
 
 
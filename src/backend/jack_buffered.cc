@@ -33,16 +33,22 @@ JACKBufferedBackend::JACKBufferedBackend(
   : JACKBackend(client_name, in_port_names, out_port_names)
   , _in_rb(config::JACK_MAX_EVENTS)
   , _out_rb(config::JACK_MAX_EVENTS)
+  , _started(false)
   , _quit(false)
+  , _wake(false)
 {
 }
 
 
 void JACKBufferedBackend::start(InitFunction init, CycleFunction cycle)
 {
-    // clear event buffers
-    _in_rb.reset();
-    _out_rb.reset();
+    // clear event buffers. when restarting, keep events that were received
+    // in the meantime
+    if (!_started) {
+        _in_rb.reset();
+        _out_rb.reset();
+        _started = true;
+    }
 
     _quit = false;
 
@@ -77,6 +83,7 @@ void JACKBufferedBackend::stop()
         _cond.notify_one();
 
         _thread->join();
+        _thread.reset();
     }
 }
 
@@ -89,6 +96,16 @@ void JACKBufferedBackend::process_thread(InitFunction init,
 }
 
 
+void JACKBufferedBackend::wake()
+{
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _wake = true;
+    }
+    _cond.notify_one();
+}
+
+
 int JACKBufferedBackend::process(jack_nframes_t nframes)
 {
     MidiEvent ev;
@@ -121,6 +138,14 @@ bool JACKBufferedBackend::input_event(MidiEvent & ev)
     // wait until there are events to be read from the ringbuffer
     while (!_in_rb.read_space()) {
         boost::mutex::scoped_lock lock(_mutex);
+
+        if (_wake) {
+            _wake = false;
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_NONE;
+            return true;
+        }
+
         _cond.wait(lock);
 
         // check for program termination
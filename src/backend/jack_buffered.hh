@@ -45,12 +45,24 @@ class JACKBufferedBackend
     virtual bool input_event(MidiEvent & ev);
     virtual void output_event(MidiEvent const & ev);
 
+    virtual bool can_wake() const {
+        return true;
+    }
+
+    virtual void wake();
+
     // not implemented
     virtual void finish() { }
 
   private:
     virtual int process(jack_nframes_t frames);
 
+    // events are processed outside the JACK callback, and sent during the
+    // following period
+    virtual jack_nframes_t output_latency(jack_nframes_t nframes) const {
+        return nframes;
+    }
+
     void process_thread(InitFunction init, CycleFunction cycle);
 
     das::ringbuffer<MidiEvent> _in_rb;
@@ -58,10 +70,15 @@ class JACKBufferedBackend
 
     boost::scoped_ptr<boost::thread> _thread;
 
+    // true once processing has been started for the first time
+    bool _started;
+
     boost::condition _cond;
     boost::mutex _mutex;
 
     volatile bool _quit;
+    // protected by _mutex
+    bool _wake;
 };
 
 
@@ -29,8 +29,12 @@ JACKRealtimeBackend::JACKRealtimeBackend(
         PortNameVector const & in_port_names,
         PortNameVector const & out_port_names)
   : JACKBackend(client_name, in_port_names, out_port_names)
+  , _init_pending(false)
   , _out_rb(config::JACK_MAX_EVENTS)
+  , _pending_rb(config::JACK_MAX_EVENTS)
+  , _started(false)
 {
+    _running = 0;
 }
 
 
@@ -38,11 +42,29 @@ void JACKRealtimeBackend::start(InitFunction init, CycleFunction cycle)
 {
     _run_init = init;
     _run_cycle = cycle;
+    _init_pending = true;
+    _started = true;
+
+    // hand the functions over to the process thread
+    _running = 1;
 }
 
 
 void JACKRealtimeBackend::stop()
 {
+    if (!_running) {
+        return;
+    }
+
+    _running = 0;
+
+    // a cycle that's already running may still be using the functions, and
+    // the engine they belong to. the caller has released the GIL, so the
+    // cycle will complete eventually
+    while (!wait_for_cycle(config::JACK_REALTIME_FINISH_TIMEOUT)) {
+        DEBUG_PRINT("waiting for JACK process cycle to complete");
+    }
+
     _run_init.clear();
     _run_cycle.clear();
 }
@@ -54,9 +76,13 @@ int JACKRealtimeBackend::process(jack_nframes_t nframes)
 
     clear_buffers(nframes);
 
-    if (_run_init) {
+    // stop() waits for this cycle to complete before the functions may
+    // change again
+    bool running = _running;
+
+    if (running && _init_pending) {
         _run_init();
-        _run_init.clear();  // RT-safe?
+        _init_pending = false;
     }
 
     // write events from ringbuffer to JACK output buffers
@@ -69,8 +95,17 @@ int JACKRealtimeBackend::process(jack_nframes_t nframes)
         }
     }
 
-    if (_run_cycle) {
+    if (running) {
         _run_cycle();
+    } else {
+        // processing is stopped. drop all input if it hasn't been started
+        // yet, otherwise keep it until processing is restarted
+        MidiEvent ev;
+        while (read_event(ev, nframes)) {
+            if (_started && !_pending_rb.write(ev)) {
+                DEBUG_PRINT("couldn't write event to pending ringbuffer");
+            }
+        }
     }
 
     _cond.notify_one();
@@ -81,6 +116,10 @@ int JACKRealtimeBackend::process(jack_nframes_t nframes)
 
 bool JACKRealtimeBackend::input_event(MidiEvent & ev)
 {
+    // events received while processing was stopped come first
+    if (_pending_rb.read(ev)) {
+        return true;
+    }
     return read_event(ev, _nframes);
 }
 
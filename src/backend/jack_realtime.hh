@@ -41,18 +41,33 @@ class JACKRealtimeBackend
     virtual bool input_event(MidiEvent & ev);
     virtual void output_event(MidiEvent const & ev);
 
+    // the engine's cycle runs every period, and carries out queued commands
+    // first. there's no need to wake it
+    virtual bool can_wake() const {
+        return true;
+    }
+
     virtual void finish();
 
   private:
     virtual int process(jack_nframes_t nframes);
 
+    // the functions are only assigned while processing is stopped. once
+    // _running is set, the process thread may call them
     InitFunction _run_init;
     CycleFunction _run_cycle;
+    das::atomic_size_t _running;
+    // true until _run_init has been called
+    bool _init_pending;
 
     jack_nframes_t _nframes;
 
     das::ringbuffer<MidiEvent> _out_rb;
 
+    // events received while processing is stopped
+    das::ringbuffer<MidiEvent> _pending_rb;
+    volatile bool _started;
+
     boost::condition _cond;
 };
 
@@ -0,0 +1,215 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "backend/midi_parser.hh"
+#include "backend/base.hh"
+
+#include <algorithm>
+
+
+namespace mididings {
+namespace backend {
+
+
+namespace {
+    // number of data bytes following a status byte
+    std::size_t data_length(unsigned char status)
+    {
+        switch (status & 0xf0) {
+          case 0xc0:
+          case 0xd0:
+            return 1;
+          case 0xf0:
+            switch (status) {
+              case 0xf1:
+              case 0xf3:
+                return 1;
+              case 0xf2:
+                return 2;
+              default:
+                return 0;
+            }
+          default:
+            return 2;
+        }
+    }
+}
+
+
+MidiParser::MidiParser(int port)
+  : _port(port)
+{
+    reset();
+}
+
+
+void MidiParser::reset()
+{
+    _status = 0;
+    _count = 0;
+    _expected = 0;
+    _sysex.clear();
+    _in_sysex = false;
+}
+
+
+bool MidiParser::feed(unsigned char byte, MidiEvent & ev)
+{
+    if (byte >= 0xf8) {
+        // realtime messages may appear anywhere, and don't affect any
+        // other message
+        ev = buffer_to_midi_event(&byte, 1, _port, 0);
+        return ev.type != MIDI_EVENT_NONE;
+    }
+
+    if (_in_sysex) {
+        if (byte < 0x80) {
+            _sysex.push_back(byte);
+            return false;
+        }
+
+        _in_sysex = false;
+
+        if (byte == 0xf7) {
+            _sysex.push_back(byte);
+
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_SYSEX;
+            ev.port = _port;
+            ev.channel = 0;
+            ev.sysex.reset(new SysExData(_sysex.begin(), _sysex.end()));
+            _sysex.clear();
+            return true;
+        }
+
+        // any other status byte ends sysex prematurely, drop it
+        _sysex.clear();
+    }
+
+    if (byte == 0xf0) {
+        _sysex.push_back(byte);
+        _in_sysex = true;
+        _status = 0;
+        return false;
+    }
+
+    if (byte >= 0x80) {
+        _status = byte;
+        _count = 0;
+        _expected = data_length(byte);
+
+        if (byte >= 0xf0 && _expected == 0) {
+            // tune request, or some undefined or stray status byte.
+            // system common messages cancel running status
+            _status = 0;
+            ev = buffer_to_midi_event(&byte, 1, _port, 0);
+            return ev.type != MIDI_EVENT_NONE;
+        }
+        return false;
+    }
+
+    if (!_status) {
+        // data byte without status, ignore it
+        return false;
+    }
+
+    _data[_count++] = byte;
+
+    if (_count < _expected) {
+        return false;
+    }
+
+    unsigned char buf[3] = { _status, _data[0], _data[1] };
+    ev = buffer_to_midi_event(buf, _expected + 1, _port, 0);
+
+    _count = 0;
+    if (_status >= 0xf0) {
+        _status = 0;
+    }
+
+    return ev.type != MIDI_EVENT_NONE;
+}
+
+
+std::size_t MidiParser::decode(unsigned char const *data, std::size_t len,
+                               std::vector<MidiEvent> & events,
+                               uint64_t frame)
+{
+    std::size_t count = 0;
+    MidiEvent ev;
+
+    for (unsigned char const *p = data; p != data + len; ++p) {
+        if (feed(*p, ev)) {
+            ev.frame = frame;
+            events.push_back(ev);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+
+
+std::size_t MidiEncoder::encode(MidiEvent const & ev,
+                                unsigned char *data, std::size_t len)
+{
+    if (ev.type == MIDI_EVENT_SYSEX) {
+        int port;
+        uint64_t frame;
+        if (!midi_event_to_buffer(ev, data, len, port, frame)) {
+            return 0;
+        }
+        _status = 0;
+        return len;
+    }
+
+    unsigned char buf[3];
+    std::size_t n = sizeof(buf);
+    int port;
+    uint64_t frame;
+
+    if (!midi_event_to_buffer(ev, buf, n, port, frame)) {
+        return 0;
+    }
+
+    unsigned char const *begin = buf;
+    unsigned char status = _status;
+
+    if (buf[0] < 0xf0) {
+        // channel message, omit the status byte if it's unchanged
+        if (buf[0] == _status) {
+            ++begin;
+            --n;
+        } else {
+            status = buf[0];
+        }
+    }
+    else if (buf[0] < 0xf8) {
+        // system common messages cancel running status
+        status = 0;
+    }
+
+    if (n > len) {
+        // nothing is written, so the receiver's running status stays the
+        // same
+        return 0;
+    }
+
+    std::copy(begin, begin + n, data);
+    _status = status;
+    return n;
+}
+
+
+} // backend
+} // mididings
@@ -0,0 +1,113 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_BACKEND_MIDI_PARSER_HH
+#define MIDIDINGS_BACKEND_MIDI_PARSER_HH
+
+#include "midi_event.hh"
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+
+namespace mididings {
+namespace backend {
+
+
+/*
+ * incremental parser for a raw MIDI byte stream, as read from a rawmidi
+ * device, a pipe or a network socket. handles running status, realtime
+ * messages in the middle of other messages, and sysex split across any
+ * number of reads.
+ */
+class MidiParser
+{
+  public:
+    MidiParser(int port = 0);
+
+    // feed one byte. returns true and assigns ev if a message is complete
+    bool feed(unsigned char byte, MidiEvent & ev);
+
+    // feed a whole buffer, and append all messages completed by it to
+    // events, with the given frame. returns the number of events appended
+    std::size_t decode(unsigned char const *data, std::size_t len,
+                       std::vector<MidiEvent> & events, uint64_t frame = 0);
+
+    // discard any incomplete message and the running status
+    void reset();
+
+  private:
+    int _port;
+
+    // current status byte (for running status), or zero
+    unsigned char _status;
+    unsigned char _data[2];
+    std::size_t _count;
+    std::size_t _expected;
+
+    // sysex data received so far. the buffer is reused, so each complete
+    // sysex message costs only a single allocation
+    std::vector<unsigned char> _sysex;
+    bool _in_sysex;
+};
+
+
+/*
+ * encoder producing a raw MIDI byte stream, omitting status bytes where
+ * running status allows.
+ */
+class MidiEncoder
+{
+  public:
+    MidiEncoder()
+      : _status(0)
+    { }
+
+    // encode one event into data, which is len bytes large.
+    // returns the number of bytes written, or zero if the event can't be
+    // encoded or doesn't fit
+    std::size_t encode(MidiEvent const & ev,
+                       unsigned char *data, std::size_t len);
+
+    // encode a sequence of events, and append them to buffer
+    template <typename IterT>
+    void encode(IterT begin, IterT end, std::vector<unsigned char> & buffer)
+    {
+        for (IterT it = begin; it != end; ++it) {
+            if (it->type == MIDI_EVENT_SYSEX) {
+                buffer.insert(buffer.end(),
+                              it->sysex->begin(), it->sysex->end());
+                _status = 0;
+            } else {
+                unsigned char data[3];
+                std::size_t len = encode(*it, data, sizeof(data));
+                buffer.insert(buffer.end(), data, data + len);
+            }
+        }
+    }
+
+    // forget the running status, so that the next event is sent in full
+    void reset() {
+        _status = 0;
+    }
+
+  private:
+    unsigned char _status;
+};
+
+
+} // backend
+} // mididings
+
+
+#endif // MIDIDINGS_BACKEND_MIDI_PARSER_HH
@@ -0,0 +1,107 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_BACKEND_PORT_WATCHER_HH
+#define MIDIDINGS_BACKEND_PORT_WATCHER_HH
+
+#include <deque>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+namespace mididings {
+namespace backend {
+
+
+/*
+ * thread that handles ports appearing on the system.
+ * backends report new ports from whatever thread they are notified in,
+ * and the handler is called for each of them from a separate thread, where
+ * it's safe to make new connections.
+ */
+template <typename T>
+class PortWatcher
+  : boost::noncopyable
+{
+  public:
+    typedef boost::function<void (T const &)> Handler;
+
+    PortWatcher(Handler handler)
+      : _handler(handler)
+      , _quit(false)
+    {
+        _thread.reset(new boost::thread(
+                    boost::bind(&PortWatcher::watcher_thread, this)));
+    }
+
+    ~PortWatcher()
+    {
+        {
+            boost::mutex::scoped_lock lock(_mutex);
+            _quit = true;
+            _cond.notify_one();
+        }
+        _thread->join();
+    }
+
+    // queue a port for the handler. doesn't block for longer than it takes
+    // to append to the queue
+    void port_added(T const & port)
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _ports.push_back(port);
+        _cond.notify_one();
+    }
+
+  private:
+    void watcher_thread()
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        for (;;) {
+            while (_ports.empty() && !_quit) {
+                _cond.wait(lock);
+            }
+            if (_quit) {
+                return;
+            }
+
+            T port = _ports.front();
+            _ports.pop_front();
+
+            lock.unlock();
+            _handler(port);
+            lock.lock();
+        }
+    }
+
+    Handler _handler;
+    std::deque<T> _ports;
+    bool _quit;
+
+    boost::mutex _mutex;
+    boost::condition _cond;
+    boost::scoped_ptr<boost::thread> _thread;
+};
+
+
+} // backend
+} // mididings
+
+
+#endif // MIDIDINGS_BACKEND_PORT_WATCHER_HH
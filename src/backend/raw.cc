@@ -0,0 +1,320 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "backend/raw.hh"
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "util/debug.hh"
+
+
+namespace mididings {
+namespace backend {
+
+
+namespace {
+    // epoll data identifying the stop event, rather than an input port
+    uint32_t const STOP_EVENT = ~uint32_t(0);
+    // epoll data identifying the wake event
+    uint32_t const WAKE_EVENT = ~uint32_t(1);
+}
+
+
+RawBackend::RawBackend(PortNameVector const & in_port_names,
+                       PortNameVector const & out_port_names)
+  : _num_open(0)
+  , _epoll_fd(-1)
+  , _stop_fd(-1)
+  , _wake_fd(-1)
+  , _pending_index(0)
+  , _eof(false)
+{
+    // every byte read may complete an event, but no more than one
+    _pending.reserve(config::RAW_READ_BUFFER_SIZE);
+
+    try {
+        _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        _stop_fd = ::eventfd(0, EFD_CLOEXEC);
+        _wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_epoll_fd == -1 || _stop_fd == -1 || _wake_fd == -1) {
+            throw Error("can't create epoll instance");
+        }
+
+        epoll_event e;
+        std::memset(&e, 0, sizeof(e));
+        e.events = EPOLLIN;
+        e.data.u32 = STOP_EVENT;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _stop_fd, &e);
+        e.data.u32 = WAKE_EVENT;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &e);
+
+        // open input ports
+        BOOST_FOREACH (std::string const & port_name, in_port_names) {
+            int fd = open_port(port_name, false);
+            _in_fds.push_back(fd);
+            _parsers.push_back(MidiParser(_in_fds.size() - 1));
+
+            e.data.u32 = _in_fds.size() - 1;
+            if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &e)) {
+                throw Error("can't poll input port '" + port_name + "': " +
+                            std::strerror(errno));
+            }
+            ++_num_open;
+        }
+
+        // open output ports
+        BOOST_FOREACH (std::string const & port_name, out_port_names) {
+            _out_fds.push_back(open_port(port_name, true));
+            _encoders.push_back(MidiEncoder());
+        }
+    }
+    catch (...) {
+        close_all();
+        throw;
+    }
+}
+
+
+RawBackend::~RawBackend()
+{
+    close_all();
+}
+
+
+void RawBackend::close_all()
+{
+    BOOST_FOREACH (int fd, _in_fds) {
+        ::close(fd);
+    }
+    BOOST_FOREACH (int fd, _out_fds) {
+        ::close(fd);
+    }
+    if (_stop_fd != -1) {
+        ::close(_stop_fd);
+    }
+    if (_wake_fd != -1) {
+        ::close(_wake_fd);
+    }
+    if (_epoll_fd != -1) {
+        ::close(_epoll_fd);
+    }
+}
+
+
+int RawBackend::open_port(std::string const & name, bool out)
+{
+    int fd;
+
+    // always duplicate existing file descriptors, so that we can close all
+    // of them alike. don't make any of them non-blocking either, the flag
+    // would be shared with whoever else is using them
+    if (name == "-") {
+        fd = ::dup(out ? STDOUT_FILENO : STDIN_FILENO);
+    }
+    else if (name.compare(0, 3, "fd:") == 0) {
+        try {
+            fd = ::dup(boost::lexical_cast<int>(name.substr(3)));
+        }
+        catch (boost::bad_lexical_cast &) {
+            throw Error("invalid file descriptor '" + name + "'");
+        }
+    }
+    else {
+        fd = ::open(name.c_str(), (out ? O_WRONLY : O_RDONLY) | O_NOCTTY);
+    }
+
+    if (fd == -1) {
+        throw Error("can't open port '" + name + "': " +
+                    std::strerror(errno));
+    }
+
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+
+void RawBackend::start(InitFunction init, CycleFunction cycle)
+{
+    // start processing thread.
+    // cycle doesn't return until the program is shut down
+    _thread.reset(new boost::thread(
+                boost::bind(&RawBackend::process_thread, this, init, cycle)));
+}
+
+
+void RawBackend::stop()
+{
+    if (_thread) {
+        // make input_event() return
+        uint64_t n = 1;
+        if (::write(_stop_fd, &n, sizeof(n)) != sizeof(n)) {
+            DEBUG_PRINT("couldn't signal raw MIDI processing thread");
+        }
+
+        // wait for event processing thread to terminate
+        _thread->join();
+        _thread.reset();
+
+        // reset the eventfd, in case processing is started again
+        if (::read(_stop_fd, &n, sizeof(n)) != sizeof(n)) {
+            DEBUG_PRINT("couldn't reset raw MIDI stop event");
+        }
+    }
+}
+
+
+void RawBackend::process_thread(InitFunction init, CycleFunction cycle)
+{
+    init();
+    // returns when stopped, or once all inputs are closed
+    cycle();
+}
+
+
+void RawBackend::wake()
+{
+    uint64_t n = 1;
+    // fails only if the counter would overflow, which is just as good
+    if (::write(_wake_fd, &n, sizeof(n)) != sizeof(n)) {
+        DEBUG_PRINT("couldn't wake processing thread");
+    }
+}
+
+
+bool RawBackend::input_event(MidiEvent & ev)
+{
+    for (;;) {
+        if (_pending_index != _pending.size()) {
+            ev = _pending[_pending_index++];
+            return true;
+        }
+
+        _pending.clear();
+        _pending_index = 0;
+
+        if (_eof) {
+            return false;
+        }
+
+        epoll_event e;
+        int n = ::epoll_wait(_epoll_fd, &e, 1, -1);
+
+        if (n <= 0) {
+            if (n < 0 && errno != EINTR) {
+                DEBUG_PRINT("couldn't wait for raw MIDI input");
+            }
+            continue;
+        }
+
+        if (e.data.u32 == STOP_EVENT) {
+            return false;
+        }
+
+        if (e.data.u32 == WAKE_EVENT) {
+            // reset the eventfd, however often wake() was called
+            uint64_t count;
+            if (::read(_wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                continue;
+            }
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_NONE;
+            return true;
+        }
+
+        read_port(e.data.u32);
+
+        if (!_num_open) {
+            // return the remaining events first
+            _eof = true;
+        }
+    }
+}
+
+
+void RawBackend::read_port(int port)
+{
+    unsigned char buf[config::RAW_READ_BUFFER_SIZE];
+
+    ssize_t len = ::read(_in_fds[port], buf, sizeof(buf));
+
+    if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+
+    if (len <= 0) {
+        // end of file, or the device is gone
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _in_fds[port], NULL);
+        --_num_open;
+        return;
+    }
+
+    _parsers[port].decode(buf, len, _pending);
+}
+
+
+void RawBackend::output_event(MidiEvent const & ev)
+{
+    if (ev.port < 0 || ev.port >= static_cast<int>(_out_fds.size())) {
+        return;
+    }
+
+    int fd = _out_fds[ev.port];
+    MidiEncoder & encoder = _encoders[ev.port];
+
+    if (ev.type == MIDI_EVENT_SYSEX) {
+        encoder.reset();
+        write_all(fd, &ev.sysex->front(), ev.sysex->size());
+        return;
+    }
+
+    unsigned char data[3];
+    std::size_t len = encoder.encode(ev, data, sizeof(data));
+
+    if (len) {
+        write_all(fd, data, len);
+    }
+}
+
+
+void RawBackend::write_all(int fd, unsigned char const *data,
+                           std::size_t len)
+{
+    while (len) {
+        ssize_t n = ::write(fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            DEBUG_PRINT("couldn't write raw MIDI data");
+            return;
+        }
+
+        data += n;
+        len -= n;
+    }
+}
+
+
+} // backend
+} // mididings
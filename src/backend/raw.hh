@@ -0,0 +1,109 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_BACKEND_RAW_HH
+#define MIDIDINGS_BACKEND_RAW_HH
+
+#include "backend/base.hh"
+#include "backend/midi_parser.hh"
+
+#include <string>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+
+namespace mididings {
+namespace backend {
+
+
+/*
+ * backend reading and writing raw MIDI bytes on file descriptors, such as
+ * rawmidi devices, FIFOs, or stdin/stdout.
+ * port names are file names, "-" for stdin/stdout, or "fd:N" for an already
+ * open file descriptor.
+ */
+class RawBackend
+  : public BackendBase
+{
+  public:
+    RawBackend(PortNameVector const & in_port_names,
+               PortNameVector const & out_port_names);
+    virtual ~RawBackend();
+
+    virtual void start(InitFunction init, CycleFunction cycle);
+    virtual void stop();
+
+    virtual bool input_event(MidiEvent & ev);
+    virtual void output_event(MidiEvent const & ev);
+
+    virtual bool can_wake() const {
+        return true;
+    }
+
+    virtual void wake();
+
+    virtual void finish() {
+        // nothing to do, writes are synchronous
+    }
+
+    virtual bool finished() const {
+        return _eof;
+    }
+
+    virtual std::size_t num_out_ports() const {
+        return _out_fds.size();
+    }
+
+  private:
+    // open the file descriptor described by a port name
+    static int open_port(std::string const & name, bool out);
+
+    void close_all();
+
+    void process_thread(InitFunction init, CycleFunction cycle);
+
+    // read from one input port, and parse everything that's available
+    void read_port(int port);
+
+    void write_all(int fd, unsigned char const *data, std::size_t len);
+
+    std::vector<int> _in_fds;
+    std::vector<int> _out_fds;
+    std::vector<MidiParser> _parsers;
+    std::vector<MidiEncoder> _encoders;
+
+    // number of input ports that haven't reached end of file yet
+    std::size_t _num_open;
+
+    int _epoll_fd;
+    // signalled to make input_event() return
+    int _stop_fd;
+    // signalled to make input_event() return an empty event
+    int _wake_fd;
+
+    // events parsed but not yet returned by input_event()
+    std::vector<MidiEvent> _pending;
+    std::size_t _pending_index;
+
+    // true once all input ports have reached end of file
+    bool _eof;
+
+    boost::scoped_ptr<boost::thread> _thread;
+};
+
+
+} // backend
+} // mididings
+
+
+#endif // MIDIDINGS_BACKEND_RAW_HH
@@ -0,0 +1,553 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "backend/shm.hh"
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+
+
+namespace mididings {
+namespace backend {
+
+
+namespace {
+    uint32_t const SEGMENT_MAGIC = 0x6d647368;
+
+    // keep each part of a segment on its own cache line
+    std::size_t const ALIGNMENT = 64;
+
+    // maximum number of bytes read at once from each input port
+    std::size_t const READ_CHUNK_SIZE = 1024;
+
+    std::size_t align(std::size_t n)
+    {
+        return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    // the futexes are in shared memory, so they can't be process-private
+    void futex_wait(int *addr, int val)
+    {
+        ::syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+    }
+
+    void futex_wake(int *addr)
+    {
+        ::syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+
+    int volatile_read(int const & i)
+    {
+        return *const_cast<int const volatile *>(&i);
+    }
+}
+
+
+ShmBackend::PortHeader *ShmBackend::Segment::port(std::size_t n) const
+{
+    unsigned char *p = static_cast<unsigned char *>(mem);
+    return reinterpret_cast<PortHeader *>(p + align(sizeof(SegmentHeader)))
+            + n;
+}
+
+
+void *ShmBackend::Segment::ring(std::size_t n) const
+{
+    unsigned char *p = static_cast<unsigned char *>(mem);
+    return p + align(sizeof(SegmentHeader))
+             + align(header()->num_ports * sizeof(PortHeader))
+             + n * align(Ring::memory_size(config::SHM_RING_SIZE));
+}
+
+
+ShmBackend::ShmBackend(std::string const & client_name,
+                       PortNameVector const & in_port_names,
+                       PortNameVector const & out_port_names)
+  : _name(segment_name(client_name))
+  , _pending_index(0)
+  , _connection_quit(false)
+{
+    _stopping = 0;
+    _wake = 0;
+    _events_sent = 0;
+    _events_dropped = 0;
+    _events_received = 0;
+
+    // every byte read may complete an event, but no more than one
+    _pending.reserve(READ_CHUNK_SIZE * std::max<std::size_t>(
+                                            in_port_names.size(), 1));
+    _out_buffer.resize(config::SHM_RING_SIZE);
+
+    BOOST_FOREACH (std::string const & port_name, out_port_names) {
+        std::string::size_type colon = port_name.rfind(':');
+        if (colon == std::string::npos || colon == 0) {
+            throw Error("invalid port name '" + port_name +
+                        "', expected 'client:port'");
+        }
+        _out_ports.push_back(OutPort(port_name.substr(0, colon),
+                                     port_name.substr(colon + 1)));
+    }
+
+    create_segment(in_port_names);
+
+    // connect to all clients that are already running
+    update_connections();
+
+    if (!_out_ports.empty()) {
+        _connection_thread.reset(new boost::thread(
+                boost::bind(&ShmBackend::connection_thread, this)));
+    }
+}
+
+
+ShmBackend::~ShmBackend()
+{
+    if (_connection_thread) {
+        {
+            boost::mutex::scoped_lock lock(_connection_mutex);
+            _connection_quit = true;
+            _connection_cond.notify_one();
+        }
+        _connection_thread->join();
+    }
+
+    BOOST_FOREACH (OutPort & port, _out_ports) {
+        detach(port);
+    }
+
+    // tell everyone writing to us to let go
+    _segment.header()->alive = 0;
+    __sync_synchronize();
+
+    _in_ports.clear();
+    unmap_segment(_segment);
+    ::shm_unlink(_name.c_str());
+}
+
+
+std::string ShmBackend::segment_name(std::string const & client_name)
+{
+    std::string name = "/mididings-" + client_name;
+    std::replace(name.begin() + 1, name.end(), '/', '_');
+    return name;
+}
+
+
+std::size_t ShmBackend::segment_size(std::size_t num_ports)
+{
+    return align(sizeof(SegmentHeader))
+         + align(num_ports * sizeof(PortHeader))
+         + num_ports * align(Ring::memory_size(config::SHM_RING_SIZE));
+}
+
+
+bool ShmBackend::process_alive(pid_t pid)
+{
+    return ::kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+
+bool ShmBackend::map_segment(std::string const & name, Segment & segment)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+
+    // the segment may still be being created
+    if (::fstat(fd, &st) == 0 &&
+            static_cast<std::size_t>(st.st_size) >= sizeof(SegmentHeader)) {
+        mem = ::mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    segment.mem = mem;
+    segment.length = st.st_size;
+
+    SegmentHeader *header = segment.header();
+    if (header->magic != SEGMENT_MAGIC ||
+            segment.length < segment_size(header->num_ports)) {
+        unmap_segment(segment);
+        return false;
+    }
+    __sync_synchronize();
+
+    return true;
+}
+
+
+void ShmBackend::unmap_segment(Segment & segment)
+{
+    if (segment.mem) {
+        ::munmap(segment.mem, segment.length);
+        segment = Segment();
+    }
+}
+
+
+void ShmBackend::create_segment(PortNameVector const & in_port_names)
+{
+    BOOST_FOREACH (std::string const & port_name, in_port_names) {
+        if (port_name.size() >= config::SHM_PORT_NAME_SIZE) {
+            throw Error("port name '" + port_name + "' is too long");
+        }
+    }
+
+    int fd = ::shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    // the existing segment may be left over from a client that crashed, or
+    // belong to one that's still starting up or shutting down
+    for (int t = 0; fd == -1 && errno == EEXIST; ++t) {
+        Segment s;
+        bool in_use = false, stale = false;
+
+        if (map_segment(_name, s)) {
+            bool owner_alive = process_alive(s.header()->owner);
+            in_use = s.header()->alive && owner_alive;
+            stale = !owner_alive;
+            if (stale) {
+                // make anyone still writing to it let go
+                s.header()->alive = 0;
+                __sync_synchronize();
+            }
+            unmap_segment(s);
+        }
+
+        if (in_use) {
+            throw Error("client name '" + _name.substr(11) +
+                        "' is already in use");
+        }
+
+        if (stale) {
+            ::shm_unlink(_name.c_str());
+        } else if (t == config::SHM_CREATE_TIMEOUT) {
+            // never unlink a segment we can't be sure is unused
+            throw Error("shared memory segment '" + _name +
+                        "' exists, but can't be used");
+        } else {
+            ::usleep(1000);
+        }
+
+        fd = ::shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+
+    if (fd == -1) {
+        throw Error("can't create shared memory segment: " +
+                    std::string(std::strerror(errno)));
+    }
+
+    std::size_t length = segment_size(in_port_names.size());
+    void *mem = MAP_FAILED;
+
+    if (::ftruncate(fd, length) == 0) {
+        mem = ::mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (mem == MAP_FAILED) {
+        ::shm_unlink(_name.c_str());
+        throw Error("can't map shared memory segment: " +
+                    std::string(std::strerror(errno)));
+    }
+
+    _segment.mem = mem;
+    _segment.length = length;
+
+    // the new segment is all zeros
+    SegmentHeader *header = _segment.header();
+    header->num_ports = in_port_names.size();
+    header->owner = ::getpid();
+    header->alive = 1;
+
+    for (std::size_t n = 0; n != in_port_names.size(); ++n) {
+        std::strcpy(_segment.port(n)->name, in_port_names[n].c_str());
+        RingPtr ring(new Ring(_segment.ring(n), config::SHM_RING_SIZE, true));
+        _in_ports.push_back(InPort(ring, n));
+    }
+
+    // make the segment visible to others only once it's complete
+    __sync_synchronize();
+    header->magic = SEGMENT_MAGIC;
+}
+
+
+bool ShmBackend::attach(OutPort & port)
+{
+    Segment s;
+    if (!map_segment(segment_name(port.client), s)) {
+        return false;
+    }
+
+    if (s.header()->alive) {
+        for (std::size_t n = 0; n != s.header()->num_ports; ++n) {
+            PortHeader *p = s.port(n);
+            if (port.port != p->name) {
+                continue;
+            }
+
+            // only one process may write to each input port, but take over
+            // from one that crashed
+            pid_t producer = p->producer;
+            if ((producer == 0 || !process_alive(producer)) &&
+                    __sync_bool_compare_and_swap(&p->producer, producer,
+                                                 ::getpid())) {
+                boost::mutex::scoped_lock lock(_out_mutex);
+                port.segment = s;
+                port.index = n;
+                port.ring->assign(s.ring(n), false);
+                port.encoder.reset();
+                return true;
+            }
+            break;
+        }
+    }
+
+    unmap_segment(s);
+    return false;
+}
+
+
+void ShmBackend::detach(OutPort & port)
+{
+    if (!port.segment.mem) {
+        return;
+    }
+
+    Segment s = port.segment;
+    {
+        // stop output to the port before unmapping it
+        boost::mutex::scoped_lock lock(_out_mutex);
+        port.segment = Segment();
+    }
+
+    __sync_bool_compare_and_swap(&s.port(port.index)->producer,
+                                 ::getpid(), 0);
+    unmap_segment(s);
+}
+
+
+void ShmBackend::update_connections()
+{
+    BOOST_FOREACH (OutPort & port, _out_ports) {
+        if (port.segment.mem) {
+            SegmentHeader *header = port.segment.header();
+            if (volatile_read(header->alive) &&
+                    process_alive(header->owner)) {
+                continue;
+            }
+            // the receiving client has shut down or crashed, and may be
+            // running again by now
+            detach(port);
+        }
+        attach(port);
+    }
+}
+
+
+void ShmBackend::connection_thread()
+{
+    boost::mutex::scoped_lock lock(_connection_mutex);
+
+    while (!_connection_quit) {
+        _connection_cond.timed_wait(lock, boost::posix_time::milliseconds(
+                                            config::SHM_ATTACH_INTERVAL));
+        if (!_connection_quit) {
+            update_connections();
+        }
+    }
+}
+
+
+void ShmBackend::ring_doorbell(SegmentHeader *header)
+{
+    // full barrier, the waiting flag must be read after the ring was written
+    __sync_fetch_and_add(&header->doorbell, 1);
+
+    if (volatile_read(header->waiting)) {
+        futex_wake(&header->doorbell);
+    }
+}
+
+
+void ShmBackend::start(InitFunction init, CycleFunction cycle)
+{
+    // start processing thread.
+    // cycle doesn't return until the program is shut down
+    _thread.reset(new boost::thread(
+                boost::bind(&ShmBackend::process_thread, this, init, cycle)));
+}
+
+
+void ShmBackend::stop()
+{
+    if (_thread) {
+        // make input_event() return
+        _stopping = 1;
+        ring_doorbell(_segment.header());
+
+        // wait for event processing thread to terminate
+        _thread->join();
+        _thread.reset();
+
+        _stopping = 0;
+    }
+}
+
+
+void ShmBackend::wake()
+{
+    _wake = 1;
+    ring_doorbell(_segment.header());
+}
+
+
+void ShmBackend::process_thread(InitFunction init, CycleFunction cycle)
+{
+    init();
+    cycle();
+}
+
+
+bool ShmBackend::input_event(MidiEvent & ev)
+{
+    SegmentHeader *header = _segment.header();
+
+    for (;;) {
+        if (_pending_index != _pending.size()) {
+            ev = _pending[_pending_index++];
+            return true;
+        }
+
+        _pending.clear();
+        _pending_index = 0;
+
+        if (_stopping) {
+            return false;
+        }
+
+        if (_wake) {
+            _wake = 0;
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_NONE;
+            return true;
+        }
+
+        if (read_ports()) {
+            continue;
+        }
+
+        int doorbell = volatile_read(header->doorbell);
+        __sync_fetch_and_add(&header->waiting, 1);
+
+        // check again, in case something was written before the writer
+        // could see that we're waiting
+        if (!_stopping && !_wake && !read_ports()) {
+            futex_wait(&header->doorbell, doorbell);
+        }
+
+        __sync_fetch_and_sub(&header->waiting, 1);
+    }
+}
+
+
+bool ShmBackend::read_ports()
+{
+    bool found = false;
+    unsigned char buf[READ_CHUNK_SIZE];
+
+    BOOST_FOREACH (InPort & port, _in_ports) {
+        std::size_t len = port.ring->read(buf, sizeof(buf));
+        if (len) {
+            std::size_t n = port.parser.decode(buf, len, _pending);
+            _events_received = _events_received + n;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+
+void ShmBackend::output_event(MidiEvent const & ev)
+{
+    if (ev.port < 0 || ev.port >= static_cast<int>(_out_ports.size())) {
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(_out_mutex);
+
+    OutPort & port = _out_ports[ev.port];
+
+    // ports are attached and detached by the connection thread. until it
+    // notices that the receiving client has shut down, don't write to a
+    // ring that nobody reads anymore
+    bool sent = port.segment.mem &&
+                volatile_read(port.segment.header()->alive) &&
+                write_event(port, ev);
+
+    if (sent) {
+        _events_sent = _events_sent + 1;
+    } else {
+        _events_dropped = _events_dropped + 1;
+    }
+}
+
+
+bool ShmBackend::write_event(OutPort & port, MidiEvent const & ev)
+{
+    std::size_t len = port.encoder.encode(ev, &_out_buffer.front(),
+                                          _out_buffer.size());
+
+    if (!len || !port.ring->write(&_out_buffer.front(), len)) {
+        // the reader must not rely on the status of a lost message
+        port.encoder.reset();
+        return false;
+    }
+
+    ring_doorbell(port.segment.header());
+    return true;
+}
+
+
+BackendStats ShmBackend::stats() const
+{
+    BackendStats s;
+    s["events_sent"] = _events_sent;
+    s["events_dropped"] = _events_dropped;
+    s["events_received"] = _events_received;
+    return s;
+}
+
+
+} // backend
+} // mididings
@@ -0,0 +1,215 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_BACKEND_SHM_HH
+#define MIDIDINGS_BACKEND_SHM_HH
+
+#include "config.hh"
+#include "backend/base.hh"
+#include "backend/midi_parser.hh"
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util/shm_ringbuffer.hh"
+
+
+namespace mididings {
+namespace backend {
+
+
+/*
+ * backend exchanging MIDI with other mididings processes on the same host
+ * through shared memory, without any kernel involvement except for waking
+ * up a waiting reader.
+ *
+ * each client owns a shared memory segment named after it, containing one
+ * single-producer/single-consumer ring buffer of raw MIDI bytes per input
+ * port, and a futex the client waits on while all of them are empty.
+ * output port names are "client:port", referring to another client's input
+ * port. an output port attaches to its input port whenever it's available,
+ * so clients can be started and restarted in any order. that's checked
+ * for periodically by a separate thread, so sending an event never needs
+ * more than writing to the ring and possibly waking up the reader.
+ */
+class ShmBackend
+  : public BackendBase
+{
+  public:
+    ShmBackend(std::string const & client_name,
+               PortNameVector const & in_port_names,
+               PortNameVector const & out_port_names);
+    virtual ~ShmBackend();
+
+    virtual void start(InitFunction init, CycleFunction cycle);
+    virtual void stop();
+
+    virtual bool input_event(MidiEvent & ev);
+    virtual void output_event(MidiEvent const & ev);
+
+    virtual bool can_wake() const {
+        return true;
+    }
+
+    virtual void wake();
+
+    virtual void finish() {
+        // nothing to do, writes are synchronous
+    }
+
+    virtual std::size_t num_out_ports() const {
+        return _out_ports.size();
+    }
+
+    virtual BackendStats stats() const;
+
+  private:
+    // start of each shared memory segment
+    struct SegmentHeader {
+        // set once the segment is fully initialized
+        uint32_t magic;
+        uint32_t num_ports;
+        pid_t owner;
+        // cleared when the owner shuts down
+        int alive;
+        // incremented for every write, the owner waits on this futex
+        int doorbell;
+        // nonzero while the owner is waiting
+        int waiting;
+    };
+
+    // one per input port, following the segment header
+    struct PortHeader {
+        char name[config::SHM_PORT_NAME_SIZE];
+        // process currently writing to this port, or zero
+        pid_t producer;
+    };
+
+    typedef das::shm_ringbuffer<unsigned char> Ring;
+    typedef boost::shared_ptr<Ring> RingPtr;
+
+    // a mapped shared memory segment
+    struct Segment {
+        Segment() : mem(NULL), length(0) { }
+
+        void *mem;
+        std::size_t length;
+
+        SegmentHeader *header() const {
+            return static_cast<SegmentHeader *>(mem);
+        }
+        PortHeader *port(std::size_t n) const;
+        void *ring(std::size_t n) const;
+    };
+
+    struct InPort {
+        InPort(RingPtr ring, int port)
+          : ring(ring), parser(port)
+        { }
+
+        RingPtr ring;
+        MidiParser parser;
+    };
+
+    struct OutPort {
+        OutPort(std::string const & client, std::string const & port)
+          : client(client), port(port)
+          , ring(new Ring(NULL, config::SHM_RING_SIZE, false))
+          , index(0)
+        { }
+
+        std::string client;
+        std::string port;
+
+        // the input port's segment while attached, mem is NULL otherwise.
+        // only changed by the connection thread, with _out_mutex held
+        Segment segment;
+        // points into the segment while attached
+        RingPtr ring;
+        std::size_t index;
+
+        MidiEncoder encoder;
+    };
+
+    static std::string segment_name(std::string const & client_name);
+    static std::size_t segment_size(std::size_t num_ports);
+    static bool process_alive(pid_t pid);
+
+    // map an existing segment, return false if it doesn't exist (yet)
+    static bool map_segment(std::string const & name, Segment & segment);
+    static void unmap_segment(Segment & segment);
+
+    void create_segment(PortNameVector const & in_port_names);
+
+    // attach an output port to the input port it refers to, if possible
+    bool attach(OutPort & port);
+    void detach(OutPort & port);
+
+    // attach all output ports whose input port is available, and detach
+    // those whose receiving client has gone
+    void update_connections();
+    void connection_thread();
+
+    // encode an event and write it to an attached output port
+    bool write_event(OutPort & port, MidiEvent const & ev);
+
+    // read from all input ports, return false if all of them are empty
+    bool read_ports();
+
+    // make the owner of a segment return from waiting
+    static void ring_doorbell(SegmentHeader *header);
+
+    void process_thread(InitFunction init, CycleFunction cycle);
+
+    std::string _name;
+    Segment _segment;
+
+    std::vector<InPort> _in_ports;
+    std::vector<OutPort> _out_ports;
+
+    // events parsed but not yet returned by input_event()
+    std::vector<MidiEvent> _pending;
+    std::size_t _pending_index;
+
+    das::atomic_size_t _stopping;
+    // set to make input_event() return an empty event
+    das::atomic_size_t _wake;
+
+    // protects the output ports, which may be written from any thread
+    boost::mutex _out_mutex;
+    std::vector<unsigned char> _out_buffer;
+
+    boost::scoped_ptr<boost::thread> _connection_thread;
+    boost::mutex _connection_mutex;
+    boost::condition _connection_cond;
+    bool _connection_quit;
+
+    boost::scoped_ptr<boost::thread> _thread;
+
+    das::atomic_size_t _events_sent;
+    das::atomic_size_t _events_dropped;
+    das::atomic_size_t _events_received;
+};
+
+
+} // backend
+} // mididings
+
+
+#endif // MIDIDINGS_BACKEND_SHM_HH
@@ -0,0 +1,555 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "backend/udp.hh"
+
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "util/debug.hh"
+
+
+namespace mididings {
+namespace backend {
+
+
+namespace {
+    unsigned char const MAGIC[2] = { 'M', 'D' };
+    unsigned char const PROTOCOL_VERSION = 1;
+    std::size_t const HEADER_SIZE = 16;
+
+    // epoll data identifying the stop event, rather than an input port
+    uint32_t const STOP_EVENT = ~uint32_t(0);
+    // epoll data identifying the wake event
+    uint32_t const WAKE_EVENT = ~uint32_t(1);
+    // epoll data identifying the jitter buffer's timer
+    uint32_t const TIMER_EVENT = ~uint32_t(2);
+
+    // the shortest transit time is allowed to grow by this fraction of the
+    // time elapsed, so that the playout delay follows the clocks of sender
+    // and receiver drifting apart
+    double const CLOCK_DRIFT = 1.0 / 1024;
+
+    int64_t monotonic_us()
+    {
+        timespec t;
+        ::clock_gettime(CLOCK_MONOTONIC, &t);
+        return static_cast<int64_t>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+    }
+
+    void write_uint32(unsigned char *p, uint32_t n)
+    {
+        n = htonl(n);
+        std::memcpy(p, &n, 4);
+    }
+
+    uint32_t read_uint32(unsigned char const *p)
+    {
+        uint32_t n;
+        std::memcpy(&n, p, 4);
+        return ntohl(n);
+    }
+}
+
+
+UDPBackend::UDPBackend(PortNameVector const & in_port_names,
+                       PortNameVector const & out_port_names)
+  : _epoll_fd(-1)
+  , _stop_fd(-1)
+  , _wake_fd(-1)
+  , _timer_fd(-1)
+  , _pending_index(0)
+{
+    _packets_sent = 0;
+    _events_sent = 0;
+    _events_dropped = 0;
+    _packets_received = 0;
+    _events_received = 0;
+    _packets_lost = 0;
+    _packets_late = 0;
+    _packets_invalid = 0;
+    _packets_overdue = 0;
+    _jitter_us = 0;
+
+    // every byte received may complete an event, but no more than one
+    _pending.reserve(config::UDP_MAX_PACKET_SIZE);
+    _decoded.reserve(config::UDP_MAX_PACKET_SIZE);
+
+    try {
+        _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        _stop_fd = ::eventfd(0, EFD_CLOEXEC);
+        _wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        _timer_fd = ::timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_CLOEXEC | TFD_NONBLOCK);
+        if (_epoll_fd == -1 || _stop_fd == -1 || _wake_fd == -1 ||
+                _timer_fd == -1) {
+            throw Error("can't create epoll instance");
+        }
+
+        epoll_event e;
+        std::memset(&e, 0, sizeof(e));
+        e.events = EPOLLIN;
+        e.data.u32 = STOP_EVENT;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _stop_fd, &e);
+        e.data.u32 = WAKE_EVENT;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &e);
+        e.data.u32 = TIMER_EVENT;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &e);
+
+        // create input ports, listening on the given addresses
+        BOOST_FOREACH (std::string const & port_name, in_port_names) {
+            sockaddr_in addr = parse_address(port_name, "0.0.0.0");
+
+            int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd == -1) {
+                throw Error("can't create UDP socket");
+            }
+            _in_ports.push_back(InPort(fd, _in_ports.size()));
+
+            if (::bind(fd, reinterpret_cast<sockaddr *>(&addr),
+                       sizeof(addr))) {
+                throw Error("can't bind input port to '" + port_name +
+                            "': " + std::strerror(errno));
+            }
+
+            e.data.u32 = _in_ports.size() - 1;
+            ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &e);
+        }
+
+        // create output ports, each sending to a single address
+        BOOST_FOREACH (std::string const & port_name, out_port_names) {
+            sockaddr_in addr = parse_address(port_name, "127.0.0.1");
+
+            int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd == -1) {
+                throw Error("can't create UDP socket");
+            }
+            _out_ports.push_back(OutPort(fd));
+            _out_ports.back().buffer.resize(config::UDP_MAX_PACKET_SIZE);
+            _out_ports.back().size = HEADER_SIZE;
+
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                          sizeof(addr))) {
+                throw Error("can't connect output port to '" + port_name +
+                            "': " + std::strerror(errno));
+            }
+        }
+    }
+    catch (...) {
+        close_all();
+        throw;
+    }
+}
+
+
+UDPBackend::~UDPBackend()
+{
+    close_all();
+}
+
+
+void UDPBackend::close_all()
+{
+    BOOST_FOREACH (InPort const & p, _in_ports) {
+        ::close(p.fd);
+    }
+    BOOST_FOREACH (OutPort const & p, _out_ports) {
+        ::close(p.fd);
+    }
+    if (_stop_fd != -1) {
+        ::close(_stop_fd);
+    }
+    if (_wake_fd != -1) {
+        ::close(_wake_fd);
+    }
+    if (_timer_fd != -1) {
+        ::close(_timer_fd);
+    }
+    if (_epoll_fd != -1) {
+        ::close(_epoll_fd);
+    }
+}
+
+
+sockaddr_in UDPBackend::parse_address(std::string const & name,
+                                      char const *default_host)
+{
+    std::string::size_type colon = name.rfind(':');
+    std::string host = colon != std::string::npos ? name.substr(0, colon)
+                                                  : std::string();
+    std::string port = colon != std::string::npos ? name.substr(colon + 1)
+                                                  : name;
+    if (host.empty()) {
+        host = default_host;
+    }
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo *res;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        throw Error("invalid UDP address '" + name + "'");
+    }
+
+    sockaddr_in addr = *reinterpret_cast<sockaddr_in *>(res->ai_addr);
+    ::freeaddrinfo(res);
+    return addr;
+}
+
+
+void UDPBackend::start(InitFunction init, CycleFunction cycle)
+{
+    // start processing thread.
+    // cycle doesn't return until the program is shut down
+    _thread.reset(new boost::thread(
+                boost::bind(&UDPBackend::process_thread, this, init, cycle)));
+}
+
+
+void UDPBackend::stop()
+{
+    if (_thread) {
+        // make input_event() return
+        uint64_t n = 1;
+        if (::write(_stop_fd, &n, sizeof(n)) != sizeof(n)) {
+            DEBUG_PRINT("couldn't signal UDP processing thread");
+        }
+
+        // wait for event processing thread to terminate
+        _thread->join();
+        _thread.reset();
+
+        // reset the eventfd, in case processing is started again
+        if (::read(_stop_fd, &n, sizeof(n)) != sizeof(n)) {
+            DEBUG_PRINT("couldn't reset UDP stop event");
+        }
+    }
+
+    finish();
+}
+
+
+void UDPBackend::finish()
+{
+    flush_all();
+}
+
+
+void UDPBackend::process_thread(InitFunction init, CycleFunction cycle)
+{
+    {
+        boost::mutex::scoped_lock lock(_out_mutex);
+        _process_thread_id = boost::this_thread::get_id();
+    }
+
+    init();
+    cycle();
+
+    boost::mutex::scoped_lock lock(_out_mutex);
+    _process_thread_id = boost::thread::id();
+}
+
+
+void UDPBackend::wake()
+{
+    uint64_t n = 1;
+    // fails only if the counter would overflow, which is just as good
+    if (::write(_wake_fd, &n, sizeof(n)) != sizeof(n)) {
+        DEBUG_PRINT("couldn't wake processing thread");
+    }
+}
+
+
+bool UDPBackend::input_event(MidiEvent & ev)
+{
+    for (;;) {
+        if (_pending_index != _pending.size()) {
+            ev = _pending[_pending_index++];
+            return true;
+        }
+
+        _pending.clear();
+        _pending_index = 0;
+
+        // return all events from the jitter buffer that are due
+        int64_t now = monotonic_us();
+        while (!_delayed.empty() && _delayed.front().time <= now) {
+            _pending.push_back(_delayed.front().ev);
+            _delayed.pop_front();
+        }
+        if (!_pending.empty()) {
+            continue;
+        }
+
+        // everything sent in response to the last events goes out in as
+        // few packets as possible
+        flush_all();
+
+        if (!_delayed.empty()) {
+            // wake up when the next event is due. an earlier timer that's
+            // still armed just causes another pass through this loop
+            itimerspec t;
+            std::memset(&t, 0, sizeof(t));
+            t.it_value.tv_sec = _delayed.front().time / 1000000;
+            t.it_value.tv_nsec = (_delayed.front().time % 1000000) * 1000;
+            ::timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &t, NULL);
+        }
+
+        epoll_event e;
+        int n = ::epoll_wait(_epoll_fd, &e, 1, -1);
+
+        if (n <= 0) {
+            if (n < 0 && errno != EINTR) {
+                DEBUG_PRINT("couldn't wait for UDP input");
+            }
+            continue;
+        }
+
+        if (e.data.u32 == STOP_EVENT) {
+            return false;
+        }
+
+        if (e.data.u32 == WAKE_EVENT) {
+            // reset the eventfd, however often wake() was called
+            uint64_t count;
+            if (::read(_wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                continue;
+            }
+            ev = MidiEvent();
+            ev.type = MIDI_EVENT_NONE;
+            return true;
+        }
+
+        if (e.data.u32 == TIMER_EVENT) {
+            // reset the timer. this fails if it has been re-armed in the
+            // meantime, which resets it as well
+            uint64_t count;
+            if (::read(_timer_fd, &count, sizeof(count)) != sizeof(count)) {
+                DEBUG_PRINT("jitter buffer timer was re-armed");
+            }
+            continue;
+        }
+
+        receive(_in_ports[e.data.u32]);
+    }
+}
+
+
+void UDPBackend::receive(InPort & port)
+{
+    unsigned char buf[config::UDP_MAX_PACKET_SIZE];
+    sockaddr_in sender;
+    socklen_t sender_len = sizeof(sender);
+
+    ssize_t len = ::recvfrom(port.fd, buf, sizeof(buf), 0,
+                             reinterpret_cast<sockaddr *>(&sender),
+                             &sender_len);
+    if (len < 0) {
+        return;
+    }
+
+    if (static_cast<std::size_t>(len) < HEADER_SIZE ||
+            std::memcmp(buf, MAGIC, sizeof(MAGIC)) != 0 ||
+            buf[2] != PROTOCOL_VERSION) {
+        _packets_invalid = _packets_invalid + 1;
+        return;
+    }
+
+    uint32_t seq = read_uint32(buf + 4);
+    int64_t sent = static_cast<int64_t>(
+                        static_cast<uint64_t>(read_uint32(buf + 8)) << 32 |
+                        read_uint32(buf + 12));
+    int64_t now = monotonic_us();
+    int64_t transit = now - sent;
+
+    bool same_sender = port.synced &&
+                       sender.sin_addr.s_addr == port.sender.sin_addr.s_addr &&
+                       sender.sin_port == port.sender.sin_port;
+
+    if (same_sender) {
+        int32_t gap = static_cast<int32_t>(seq - port.last_seq - 1);
+
+        if (gap >= 0) {
+            _packets_lost = _packets_lost + gap;
+            port.last_seq = seq;
+        } else {
+            // reordered or duplicated. still deliver the events, a late
+            // note-off is better than none
+            _packets_late = _packets_late + 1;
+            if (_packets_lost) {
+                _packets_lost = _packets_lost - 1;
+            }
+        }
+
+        // the clocks of sender and receiver needn't be in sync, only the
+        // variation in transit time matters
+        double d = std::fabs(static_cast<double>(transit - port.last_transit));
+        port.jitter += (d - port.jitter) / 16.0;
+        _jitter_us = static_cast<std::size_t>(port.jitter + 0.5);
+
+        port.base_transit = std::min(
+                port.base_transit + (now - port.last_arrival) * CLOCK_DRIFT,
+                static_cast<double>(transit));
+    } else {
+        // first packet, or a new sender
+        port.sender = sender;
+        port.synced = true;
+        port.last_seq = seq;
+        port.jitter = 0.0;
+        port.base_transit = transit;
+        port.last_playout = 0;
+    }
+
+    port.last_transit = transit;
+    port.last_arrival = now;
+
+    // play out the packet once the transit time has reached the shortest
+    // one seen plus the playout delay
+    int64_t playout = now + static_cast<int64_t>(port.base_transit) -
+                      transit + config::UDP_PLAYOUT_DELAY;
+    if (playout < now) {
+        _packets_overdue = _packets_overdue + 1;
+    }
+    playout = std::max(playout, port.last_playout);
+    port.last_playout = playout;
+
+    // packets never depend on each other
+    port.parser.reset();
+    _decoded.clear();
+    std::size_t n = port.parser.decode(buf + HEADER_SIZE, len - HEADER_SIZE,
+                                       _decoded);
+
+    // insert after all events due at the same time or earlier, which is
+    // usually at the end
+    std::size_t index = std::upper_bound(_delayed.begin(), _delayed.end(),
+                                         playout, &DelayedEvent::before)
+                            - _delayed.begin();
+    BOOST_FOREACH (MidiEvent const & ev, _decoded) {
+        _delayed.insert(_delayed.begin() + index++,
+                        DelayedEvent(playout, ev));
+    }
+
+    _packets_received = _packets_received + 1;
+    _events_received = _events_received + n;
+}
+
+
+void UDPBackend::output_event(MidiEvent const & ev)
+{
+    if (ev.port < 0 || ev.port >= static_cast<int>(_out_ports.size())) {
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(_out_mutex);
+
+    OutPort & port = _out_ports[ev.port];
+
+    std::size_t len = port.encoder.encode(ev, &port.buffer[port.size],
+                                          port.buffer.size() - port.size);
+    if (!len && port.size > HEADER_SIZE) {
+        // packet is full, start a new one
+        flush(port);
+        len = port.encoder.encode(ev, &port.buffer[port.size],
+                                  port.buffer.size() - port.size);
+    }
+
+    if (!len) {
+        // too large to fit into any packet
+        _events_dropped = _events_dropped + 1;
+        return;
+    }
+
+    port.size += len;
+    ++port.num_events;
+
+    if (boost::this_thread::get_id() != _process_thread_id) {
+        flush(port);
+    }
+}
+
+
+void UDPBackend::flush(OutPort & port)
+{
+    if (port.size == HEADER_SIZE) {
+        return;
+    }
+
+    uint64_t now = monotonic_us();
+
+    unsigned char *p = &port.buffer.front();
+    std::memcpy(p, MAGIC, sizeof(MAGIC));
+    p[2] = PROTOCOL_VERSION;
+    p[3] = 0;
+    write_uint32(p + 4, port.seq++);
+    write_uint32(p + 8, static_cast<uint32_t>(now >> 32));
+    write_uint32(p + 12, static_cast<uint32_t>(now));
+
+    if (::send(port.fd, p, port.size, 0) == static_cast<ssize_t>(port.size)) {
+        _packets_sent = _packets_sent + 1;
+        _events_sent = _events_sent + port.num_events;
+    } else {
+        // nobody listening (yet), or the network is down
+        _events_dropped = _events_dropped + port.num_events;
+    }
+
+    port.size = HEADER_SIZE;
+    port.num_events = 0;
+    port.encoder.reset();
+}
+
+
+void UDPBackend::flush_all()
+{
+    boost::mutex::scoped_lock lock(_out_mutex);
+
+    BOOST_FOREACH (OutPort & port, _out_ports) {
+        flush(port);
+    }
+}
+
+
+BackendStats UDPBackend::stats() const
+{
+    BackendStats s;
+    s["packets_sent"] = _packets_sent;
+    s["events_sent"] = _events_sent;
+    s["events_dropped"] = _events_dropped;
+    s["packets_received"] = _packets_received;
+    s["events_received"] = _events_received;
+    s["packets_lost"] = _packets_lost;
+    s["packets_late"] = _packets_late;
+    s["packets_invalid"] = _packets_invalid;
+    s["packets_overdue"] = _packets_overdue;
+    s["jitter_us"] = _jitter_us;
+    return s;
+}
+
+
+} // backend
+} // mididings
@@ -0,0 +1,199 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_BACKEND_UDP_HH
+#define MIDIDINGS_BACKEND_UDP_HH
+
+#include "backend/base.hh"
+#include "backend/midi_parser.hh"
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <netinet/in.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "util/ringbuffer.hh"
+
+
+namespace mididings {
+namespace backend {
+
+
+/*
+ * backend sending and receiving MIDI over UDP, to connect mididings
+ * instances on different hosts.
+ *
+ * each packet consists of a 16 byte header (magic "MD", protocol version,
+ * flags, 32 bit sequence number, 64 bit sender time in microseconds, all
+ * in network byte order), followed by any number of MIDI messages using
+ * running status. every packet is self-contained, so losing one never
+ * affects the next.
+ *
+ * incoming events are held back in a jitter buffer, until the time the
+ * packet was sent plus the shortest transit time seen from its sender plus
+ * a fixed playout delay. this evens out variations in network latency,
+ * without requiring the clocks of both hosts to be in sync.
+ *
+ * input port names are "[host:]port" to listen on, output port names are
+ * "[host:]port" to send to.
+ */
+class UDPBackend
+  : public BackendBase
+{
+  public:
+    UDPBackend(PortNameVector const & in_port_names,
+               PortNameVector const & out_port_names);
+    virtual ~UDPBackend();
+
+    virtual void start(InitFunction init, CycleFunction cycle);
+    virtual void stop();
+
+    virtual bool input_event(MidiEvent & ev);
+    virtual void output_event(MidiEvent const & ev);
+
+    virtual bool can_wake() const {
+        return true;
+    }
+
+    virtual void wake();
+
+    virtual void finish();
+
+    virtual std::size_t num_out_ports() const {
+        return _out_ports.size();
+    }
+
+    virtual BackendStats stats() const;
+
+  private:
+    struct InPort {
+        InPort(int fd, int port)
+          : fd(fd), parser(port), synced(false), last_seq(0),
+            last_transit(0), jitter(0.0), base_transit(0.0),
+            last_arrival(0), last_playout(0)
+        { }
+
+        int fd;
+        MidiParser parser;
+
+        // sender of the most recent packet
+        sockaddr_in sender;
+        bool synced;
+        uint32_t last_seq;
+
+        // interarrival jitter estimate, as in RFC 3550
+        int64_t last_transit;
+        double jitter;
+
+        // shortest transit time seen, which is where the playout delay is
+        // measured from
+        double base_transit;
+        int64_t last_arrival;
+        // playout time of the most recent packet, so that events are never
+        // delivered out of order
+        int64_t last_playout;
+    };
+
+    struct DelayedEvent {
+        DelayedEvent(int64_t time, MidiEvent const & ev)
+          : time(time), ev(ev)
+        { }
+
+        static bool before(int64_t time, DelayedEvent const & d) {
+            return time < d.time;
+        }
+
+        int64_t time;
+        MidiEvent ev;
+    };
+
+    struct OutPort {
+        OutPort(int fd)
+          : fd(fd), size(0), num_events(0), seq(0)
+        { }
+
+        int fd;
+        MidiEncoder encoder;
+
+        // packet currently being assembled, including header space
+        std::vector<unsigned char> buffer;
+        std::size_t size;
+        std::size_t num_events;
+        uint32_t seq;
+    };
+
+    static sockaddr_in parse_address(std::string const & name,
+                                     char const *default_host);
+
+    void close_all();
+
+    void process_thread(InitFunction init, CycleFunction cycle);
+
+    // receive one packet on an input port, and add its events to the
+    // jitter buffer
+    void receive(InPort & port);
+
+    // send the packet assembled for an output port, if it isn't empty
+    void flush(OutPort & port);
+    void flush_all();
+
+    std::vector<InPort> _in_ports;
+    std::vector<OutPort> _out_ports;
+
+    int _epoll_fd;
+    // signalled to make input_event() return
+    int _stop_fd;
+    // signalled to make input_event() return an empty event
+    int _wake_fd;
+    // expires when the next event in the jitter buffer is due
+    int _timer_fd;
+
+    // events decoded but not yet returned by input_event()
+    std::vector<MidiEvent> _pending;
+    std::size_t _pending_index;
+
+    // events decoded from the last packet received
+    std::vector<MidiEvent> _decoded;
+    // events waiting for their playout time, in the order they're due
+    std::deque<DelayedEvent> _delayed;
+
+    // protects the output packets, which may be written from any thread
+    boost::mutex _out_mutex;
+
+    // output from the processing thread is collected until it's about to
+    // wait for more input, everything else is sent right away
+    boost::thread::id _process_thread_id;
+
+    boost::scoped_ptr<boost::thread> _thread;
+
+    das::atomic_size_t _packets_sent;
+    das::atomic_size_t _events_sent;
+    das::atomic_size_t _events_dropped;
+    das::atomic_size_t _packets_received;
+    das::atomic_size_t _events_received;
+    das::atomic_size_t _packets_lost;
+    das::atomic_size_t _packets_late;
+    das::atomic_size_t _packets_invalid;
+    das::atomic_size_t _packets_overdue;
+    das::atomic_size_t _jitter_us;
+};
+
+
+} // backend
+} // mididings
+
+
+#endif // MIDIDINGS_BACKEND_UDP_HH
@@ -0,0 +1,123 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_CLOCK_TRACKER_HH
+#define MIDIDINGS_CLOCK_TRACKER_HH
+
+#include "config.hh"
+#include "midi_event.hh"
+
+#include <boost/noncopyable.hpp>
+
+#include "util/ringbuffer.hh"
+
+
+namespace mididings {
+
+
+/*
+ * keeps track of incoming MIDI clock, start/continue/stop and song position
+ * messages, and estimates the current tempo.
+ * process() must only be called from the processing thread, all other
+ * functions may be called from any thread without locking.
+ */
+class ClockTracker
+  : boost::noncopyable
+{
+  public:
+    ClockTracker(unsigned int samplerate)
+      : _samplerate(samplerate)
+      , _interval(0.0)
+      , _last_frame(0)
+      , _have_last_frame(false)
+      , _next_clock(0)
+    {
+        _tempo = 0;
+        _position = 0;
+    }
+
+    void process(MidiEvent const & ev)
+    {
+        switch (ev.type) {
+          case MIDI_EVENT_SYSRT_CLOCK:
+            process_clock(ev.frame);
+            break;
+          case MIDI_EVENT_SYSRT_START:
+            _next_clock = 0;
+            _position = _next_clock;
+            break;
+          case MIDI_EVENT_SYSCM_SONGPOS:
+            // song position is given in MIDI beats, six clocks each
+            _next_clock = (ev.data1 | ev.data2 << 7) * 6;
+            _position = _next_clock;
+            break;
+          default:
+            break;
+        }
+    }
+
+    // the current tempo in BPM, or zero if unknown
+    double tempo() const {
+        return _tempo / 1000.0;
+    }
+
+    // the number of clocks since the last start or song position message
+    std::size_t position() const {
+        return _position;
+    }
+
+  private:
+    void process_clock(uint64_t frame)
+    {
+        if (_have_last_frame && frame > _last_frame) {
+            double interval = frame - _last_frame;
+
+            if (interval > _samplerate * config::CLOCK_MAX_INTERVAL) {
+                // clock was interrupted, start measuring again
+                _interval = 0.0;
+            } else {
+                if (_interval == 0.0) {
+                    _interval = interval;
+                } else {
+                    // exponential moving average
+                    _interval += config::CLOCK_SMOOTHING *
+                                    (interval - _interval);
+                }
+                // 24 clocks per quarter note
+                _tempo = static_cast<std::size_t>(
+                            60000.0 * _samplerate / (24.0 * _interval) + 0.5);
+            }
+        }
+
+        _last_frame = frame;
+        _have_last_frame = true;
+
+        _position = ++_next_clock;
+    }
+
+    unsigned int const _samplerate;
+
+    // smoothed interval between clocks, in frames
+    double _interval;
+    uint64_t _last_frame;
+    bool _have_last_frame;
+    std::size_t _next_clock;
+
+    // tempo in thousandths of BPM
+    das::atomic_size_t _tempo;
+    das::atomic_size_t _position;
+};
+
+
+} // mididings
+
+
+#endif // MIDIDINGS_CLOCK_TRACKER_HH
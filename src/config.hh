@@ -48,10 +48,91 @@ namespace config
     int const ASYNC_JOIN_TIMEOUT = 3000;
     // Maximum time in milliseconds for which the async thread can be idle.
     int const ASYNC_CALLBACK_INTERVAL = 50;
+    // Maximum number of calls that can be queued for the worker process
+    std::size_t const MAX_PROCESS_CALLS = 256;
+    // Maximum size of sysex events passed to the worker process. calls with
+    // larger events are dropped
+    std::size_t const PROCESS_CALL_MAX_SYSEX = 256;
+
+    // Maximum number of scene switch notifications that can be queued for
+    // the async thread
+    std::size_t const MAX_SCENE_SWITCH_NOTIFICATIONS = 64;
+
+    // Maximum number of commands (output or injected events, scene switches)
+    // that can be queued from other threads, rounded up to a power of two
+    std::size_t const MAX_ENGINE_COMMANDS = 1024;
+
+    // Maximum number of input or output ports, including those added while
+    // the engine is running
+    std::size_t const MAX_PORTS = 256;
+
+    // Maximum number of state snapshots that can be queued for writing to
+    // the state file
+    std::size_t const MAX_STATE_SNAPSHOTS = 4;
+
+    // Maximum size of OSC packets sent or received
+    std::size_t const OSC_MAX_PACKET_SIZE = 1024;
+    // Maximum number of OSC packets that can be queued for sending
+    std::size_t const OSC_MAX_QUEUED_PACKETS = 128;
+    // Maximum time in milliseconds for which the OSC sender thread can be
+    // idle
+    int const OSC_SENDER_INTERVAL = 100;
+    // Time in milliseconds after which the OSC server thread checks whether
+    // it should exit
+    int const OSC_SERVER_POLL_INTERVAL = 100;
+
+    // Maximum number of events that can be scheduled for future output by
+    // the JACK backend
+    std::size_t const SCHEDULER_MAX_EVENTS = 1024;
+    // Number of slots in the JACK backend's timing wheel, must be a power of
+    // two
+    std::size_t const SCHEDULER_SLOTS = 1024;
+    // Time span covered by each timing wheel slot, as a power of two
+    // (1 << 6 = 64 frames)
+    unsigned int const SCHEDULER_SLOT_SHIFT = 6;
+
+    // Sample rate assumed when there's no backend providing one (e.g. when
+    // processing events offline)
+    unsigned int const OFFLINE_SAMPLERATE = 44100;
+
+    // Weight of each new MIDI clock interval in the tempo estimate
+    double const CLOCK_SMOOTHING = 0.1;
+    // Maximum time in seconds between two MIDI clocks before tempo
+    // measurement starts over
+    double const CLOCK_MAX_INTERVAL = 1.0;
+    // Tempo in BPM assumed by tempo-synced units as long as no MIDI clock has
+    // been received
+    double const CLOCK_DEFAULT_TEMPO = 120.0;
 
     // Maximum number of bytes that may be sent to ALSA at once
     std::size_t const ALSA_SYSEX_CHUNK_SIZE = 256;
 
+    // Maximum number of bytes read at once from each file descriptor by the
+    // raw MIDI backend
+    std::size_t const RAW_READ_BUFFER_SIZE = 1024;
+
+    // Maximum size of a packet sent or received by the UDP backend. The
+    // default fits into a single Ethernet frame
+    std::size_t const UDP_MAX_PACKET_SIZE = 1472;
+    // Time in microseconds by which the UDP backend holds back incoming
+    // events, to even out variations in network latency. Packets arriving
+    // later than that are delivered right away
+    int const UDP_PLAYOUT_DELAY = 2000;
+
+    // Size in bytes of the shared memory backend's ring buffer for each
+    // input port. Larger sysex messages are dropped
+    std::size_t const SHM_RING_SIZE = 65536;
+
+    // Maximum length of a shared memory backend port name, including the
+    // terminating null character
+    std::size_t const SHM_PORT_NAME_SIZE = 64;
+    // Time in milliseconds to wait for an existing shared memory segment
+    // with the same name to be completed or removed by its owner
+    int const SHM_CREATE_TIMEOUT = 200;
+    // Interval in milliseconds at which the shared memory backend checks
+    // whether the clients its output ports refer to have appeared or gone
+    int const SHM_ATTACH_INTERVAL = 100;
+
     // Size of the JACK backend's input and output queues
     std::size_t const JACK_MAX_EVENTS = 128;
     // Maximum size of JACK MIDI events. in reality this depends on the JACK
@@ -66,6 +147,9 @@ namespace config
 
     // Time in milliseconds to wait for the current JACK period to complete.
     int const JACK_REALTIME_FINISH_TIMEOUT = 200;
+    // Time in milliseconds to wait for the JACK process thread to stop using
+    // a port that's being removed
+    int const JACK_REMOVE_PORT_TIMEOUT = 200;
 }
 
 
@@ -16,40 +16,106 @@
 #include <memory>
 #include <functional>
 
+#include <boost/scoped_array.hpp>
+#include <boost/noncopyable.hpp>
+
 #include "util/debug.hh"
 
 
 namespace mididings {
 
 
-template <typename R>
-class curious_alloc_base
+/*
+ * Pool of a fixed number of elements used by curious_alloc, allowing
+ * constant-time allocation/deallocation.
+ * deleted elements are not reclaimed until all (!) elements are deallocated.
+ * the pool is not thread-safe, each thread (or engine) needs its own.
+ */
+class curious_pool
+  : boost::noncopyable
 {
   public:
-    static std::size_t max_utilization() {
-        return max_utilization_;
+    // a pool of n elements, each of at most element_size bytes
+    curious_pool(std::size_t n, std::size_t element_size)
+      : _size(n)
+      , _element_size(align(element_size))
+      , _data(new unsigned char[n * align(element_size)])
+      , _count(0)
+      , _index(0)
+      , _max_utilization(0)
+      , _fallback_count(0)
+    { }
+
+    // return an element of the given size, or NULL if the pool is
+    // exhausted or its elements are too small
+    void * allocate(std::size_t size) {
+        if (_index >= _size || size > _element_size) {
+            ++_fallback_count;
+            return NULL;
+        }
+        ++_count;
+
+        if (_index >= _max_utilization) {
+            _max_utilization = _index + 1;
+        }
+        return &_data[_element_size * (_index++)];
     }
-    static std::size_t fallback_count() {
-        return fallback_count_;
+
+    // return false if p was not allocated from this pool
+    bool deallocate(void *p) {
+        unsigned char *c = static_cast<unsigned char *>(p);
+
+        if (std::less<unsigned char *>()(c, &_data[0]) ||
+            std::greater_equal<unsigned char *>()(
+                                    c, &_data[0] + _size * _element_size)) {
+            return false;
+        }
+
+        if (_index && c == &_data[_element_size * (_index - 1)]) {
+            // removing last element, can be reused
+            --_index;
+        }
+        if (!(--_count)) {
+            // no allocations left, start over
+            _index = 0;
+        }
+        return true;
+    }
+
+    std::size_t max_utilization() const {
+        return _max_utilization;
+    }
+    std::size_t fallback_count() const {
+        return _fallback_count;
     }
 
-  protected:
-    static std::size_t max_utilization_;
-    static std::size_t fallback_count_;
+  private:
+    // keep every element suitably aligned for any type
+    static std::size_t align(std::size_t n) {
+        std::size_t const a = 2 * sizeof(void *);
+        return (n + a - 1) / a * a;
+    }
+
+    std::size_t _size;
+    std::size_t _element_size;
+    boost::scoped_array<unsigned char> _data;
+
+    std::size_t _count;
+    std::size_t _index;
+
+    std::size_t _max_utilization;
+    std::size_t _fallback_count;
 };
 
 
 /*
- * Constant-time allocation/deallocation from a fixed-size pool of N elements.
- * deleted elements are not reclaimed until all (!) elements are deallocated.
+ * Allocator using a curious_pool, falling back to std::allocator when the
+ * pool is exhausted, or if no pool was given at all.
  *
  * \tparam T    the type to be allocated
- * \tparam N    the size of the data pool
- * \tparam R    the original data type before rebind
  */
-template <typename T, std::size_t N, typename R=T>
+template <typename T>
 class curious_alloc
-  : public curious_alloc_base<R>
 {
   public:
     typedef std::size_t size_type;
@@ -62,62 +128,53 @@ class curious_alloc
 
     template <class U>
     struct rebind {
-        typedef curious_alloc<U, N, R> other;
+        typedef curious_alloc<U> other;
     };
 
-    curious_alloc() { }
-    curious_alloc(curious_alloc<T, N, R> const &) { }
+    curious_alloc()
+      : _pool(NULL) { }
+    explicit curious_alloc(curious_pool & pool)
+      : _pool(&pool) { }
+    curious_alloc(curious_alloc<T> const & other)
+      : _pool(other.pool()) { }
     template <class U>
-    curious_alloc(curious_alloc<U, N, R> const &) { }
+    curious_alloc(curious_alloc<U> const & other)
+      : _pool(other.pool()) { }
 
     ~curious_alloc() { }
 
-    bool operator==(curious_alloc<T, N, R> const &) {
-        return true;
+    bool operator==(curious_alloc<T> const & other) const {
+        return _pool == other._pool;
     }
-    bool operator!=(curious_alloc<T, N, R> const &) {
-        return false;
+    bool operator!=(curious_alloc<T> const & other) const {
+        return _pool != other._pool;
     }
 
+    curious_pool * pool() const { return _pool; }
+
     pointer address(reference x) const { return &x; }
     const_pointer address(const_reference x) const { return &x; }
 
     pointer allocate(size_type n, void const * hint = 0) {
         (void)n;
+        (void)hint;
         ASSERT(n == 1);
 
-        if (index_ >= N) {
+        void *p = _pool ? _pool->allocate(sizeof(T)) : NULL;
+        if (!p) {
             // can't allocate from pool, use fallback allocator
-            ++this->fallback_count_;
-            return fallback_.allocate(n, hint);
-        }
-        ++count_;
-
-        if (index_ >= this->max_utilization_) {
-            this->max_utilization_ = index_ + 1;
+            return std::allocator<T>().allocate(n);
         }
-        return pool_ + (index_++);
+        return static_cast<pointer>(p);
     }
 
     void deallocate(pointer p, size_type n) {
         (void)n;
         ASSERT(n == 1);
 
-        if (std::less<T*>()(p, pool_) ||
-            std::greater_equal<T*>()(p, pool_ + N)) {
-            // address is not within pool address range, must have been
-            // allocated using fallback allocator
-            fallback_.deallocate(p, n);
-            return;
-        }
-
-        if (p == pool_ + index_ - 1) {
-            // removing last element, can be reused
-            --index_;
-        }
-        if (!(--count_)) {
-            // no allocations left, start over
-            index_ = 0;
+        if (!_pool || !_pool->deallocate(p)) {
+            // must have been allocated using fallback allocator
+            std::allocator<T>().deallocate(p, n);
         }
     }
 
@@ -146,38 +203,43 @@ class curious_alloc
 #endif
 
   private:
-    static unsigned char pool_array_[N * sizeof(T)];
-    static T* pool_;
-    static std::size_t count_;
-    static std::size_t index_;
-
-    // fallback allocator in case this one runs out of space
-    static std::allocator<T> fallback_;
+    curious_pool *_pool;
 };
 
 
-template <typename R>
-std::size_t curious_alloc_base<R>::max_utilization_ = 0;
-
-template <typename R>
-std::size_t curious_alloc_base<R>::fallback_count_ = 0;
-
-
-template <typename T, std::size_t N, typename R>
-unsigned char curious_alloc<T, N, R>::pool_array_[N * sizeof(T)];
+/*
+ * Allocator that records the largest type it's rebound to and allocated,
+ * which for a container is the size of its internal node type.
+ */
+template <typename T>
+class node_size_probe
+  : public curious_alloc<T>
+{
+  public:
+    template <class U>
+    struct rebind {
+        typedef node_size_probe<U> other;
+    };
 
-template <typename T, std::size_t N, typename R>
-T* curious_alloc<T, N, R>::pool_ =
-    reinterpret_cast<T*>(&curious_alloc<T, N, R>::pool_array_);
+    explicit node_size_probe(std::size_t & size)
+      : _size(&size) { }
+    template <class U>
+    node_size_probe(node_size_probe<U> const & other)
+      : curious_alloc<T>(other)
+      , _size(other.size()) { }
 
-template <typename T, std::size_t N, typename R>
-std::size_t curious_alloc<T, N, R>::count_ = 0;
+    T * allocate(std::size_t n, void const * hint = 0) {
+        if (sizeof(T) > *_size) {
+            *_size = sizeof(T);
+        }
+        return curious_alloc<T>::allocate(n, hint);
+    }
 
-template <typename T, std::size_t N, typename R>
-std::size_t curious_alloc<T, N, R>::index_ = 0;
+    std::size_t * size() const { return _size; }
 
-template <typename T, std::size_t N, typename R>
-std::allocator<T> curious_alloc<T, N, R>::fallback_ = std::allocator<T>();
+  private:
+    std::size_t *_size;
+};
 
 
 } // mididings
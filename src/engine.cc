@@ -18,26 +18,26 @@
 
 #include <boost/thread/thread.hpp>
 #include <boost/bind.hpp>
+#include <boost/python/object.hpp>
 
 #include <iostream>
 #include <algorithm>
+#include <stdexcept>
+#include <cstring>
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
 
+#if defined(ENABLE_BENCHMARK) || defined(ENABLE_DEBUG_STATS)
+#include <iomanip>
+#endif
+
 #include "util/debug.hh"
 
 
 namespace mididings {
 
 
-#ifdef ENABLE_BENCHMARK
-Engine::hrclock::duration Engine::cycles_duration_total_(0);
-Engine::hrclock::duration Engine::cycles_duration_max_(0);
-int Engine::num_cycles_(0);
-#endif
-
-
 Engine::Engine(backend::BackendPtr backend, bool verbose)
   : _verbose(verbose)
   , _backend(backend)
@@ -46,15 +46,38 @@ Engine::Engine(backend::BackendPtr backend, bool verbose)
   , _current_subscene(-1)
   , _new_scene(-1)
   , _new_subscene(-1)
+  , _lazy_scenes(false)
+  , _tick_interval(0)
+  , _next_tick_frame(0)
+  , _clock_tracker(samplerate())
+  , _bypass_types(MIDI_EVENT_NONE)
   , _noteon_patches(config::MAX_SIMULTANEOUS_NOTES)
   , _sustain_patches(config::MAX_SUSTAIN_PEDALS)
-  , _buffer(*this)
+  , _event_pool(config::MAX_EVENTS, Patch::event_node_size())
+  , _buffer(*this, Patch::EventBufferRT::allocator_type(_event_pool))
+  , _switch_notifications(new SwitchNotificationBuffer(
+                                config::MAX_SCENE_SWITCH_NOTIFICATIONS))
+  , _commands(new das::mpsc_queue<Command>(config::MAX_ENGINE_COMMANDS))
+  , _state_changed(false)
   , _python_caller(new PythonCaller(boost::bind(&Engine::run_async, this)))
 {
     // construct a patch with a single sanitize unit
     Patch::UnitExPtr sani(new units::Sanitize);
     Patch::ModulePtr mod(new Patch::Extended(sani));
     _sanitize_patch.reset(new Patch(mod));
+
+    _requested_scene = -1;
+    _finished = 0;
+
+    std::fill(_bypass_ports, _bypass_ports + 32, -1);
+
+    std::memset(&_state_snapshot, 0, sizeof(_state_snapshot));
+
+#ifdef ENABLE_BENCHMARK
+    cycles_duration_total_ = hrclock::duration::zero();
+    cycles_duration_max_ = hrclock::duration::zero();
+    num_cycles_ = 0;
+#endif
 }
 
 
@@ -64,6 +87,24 @@ Engine::~Engine()
         _backend->stop();
     }
 
+#ifdef ENABLE_BENCHMARK
+    std::cerr << '\n'
+              << std::left << std::setw(20) << "number of cycles:"
+              << num_cycles() << '\n'
+              << std::left << std::setw(20) << "mean duration:"
+              << cycle_duration_mean() << " µs" << '\n'
+              << std::left << std::setw(20) << "max duration:"
+              << cycle_duration_max() << " µs" << std::endl;
+#endif
+
+#ifdef ENABLE_DEBUG_STATS
+    std::cerr << std::left << std::setw(20) << "MidiEvent alloc: "
+              << std::setw(8) << _event_pool.max_utilization() << " "
+              << _event_pool.fallback_count() << std::endl;
+#endif
+
+    _osc_server.reset();
+
     // this needs to be gone before the engine can safely be destroyed
     _python_caller.reset();
 }
@@ -76,7 +117,97 @@ void Engine::add_scene(int i, PatchPtr patch,
         _scenes[i] = std::vector<ScenePtr>();
     }
 
-    _scenes[i].push_back(ScenePtr(new Scene(patch, init_patch, exit_patch)));
+    ScenePtr scene(new Scene(patch, init_patch, exit_patch));
+    cache_scene_events(*scene);
+    _scenes[i].push_back(scene);
+
+    if (!patch) {
+        _lazy_scenes = true;
+    }
+}
+
+
+void Engine::set_scene(int i, int subscene, PatchPtr patch,
+                       PatchPtr init_patch, PatchPtr exit_patch)
+{
+    ASSERT(has_scene(i));
+
+    ScenePtr scene(new Scene(patch, init_patch, exit_patch));
+    cache_scene_events(*scene);
+
+    // the previous patches may only be released while holding the GIL
+    ScenePtr prev;
+
+    {
+        // don't block the realtime thread, which may need the GIL while
+        // holding the process mutex
+        das::python::scoped_gil_release gil;
+        boost::mutex::scoped_lock lock(_process_mutex);
+
+        prev = _scenes[i][subscene];
+        _scenes[i][subscene] = scene;
+    }
+}
+
+
+bool Engine::unload_scene(int i)
+{
+    ASSERT(has_scene(i));
+
+    std::vector<ScenePtr> prev;
+
+    {
+        das::python::scoped_gil_release gil;
+        boost::mutex::scoped_lock lock(_process_mutex);
+
+        std::vector<ScenePtr> & scenes = _scenes[i];
+
+        for (std::vector<ScenePtr>::iterator it = scenes.begin();
+                it != scenes.end(); ++it) {
+            if (scene_in_use(**it)) {
+                return false;
+            }
+        }
+
+        prev = scenes;
+
+        for (std::vector<ScenePtr>::iterator it = scenes.begin();
+                it != scenes.end(); ++it) {
+            it->reset(new Scene(PatchPtr(), PatchPtr(), PatchPtr()));
+        }
+    }
+
+    return true;
+}
+
+
+bool Engine::scene_in_use(Scene const & scene) const
+{
+    Patch const *patch = scene.patch.get();
+
+    if (!patch) {
+        return false;
+    }
+    if (patch == _current_patch) {
+        return true;
+    }
+
+    // notes or sustain pedals still held in this scene need its patch when
+    // released
+    for (NotePatchMap::const_iterator it = _noteon_patches.begin();
+            it != _noteon_patches.end(); ++it) {
+        if (it->second.patch == patch) {
+            return true;
+        }
+    }
+    for (SustainPatchMap::const_iterator it = _sustain_patches.begin();
+            it != _sustain_patches.end(); ++it) {
+        if (it->second.patch == patch) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 
@@ -89,11 +220,61 @@ void Engine::set_processing(PatchPtr ctrl_patch,
     _ctrl_patch = ctrl_patch;
     _pre_patch = pre_patch;
     _post_patch = post_patch;
+
+    // the precomputed output of init and exit patches depends on the post
+    // patch
+    for (SceneMap::iterator it = _scenes.begin(); it != _scenes.end(); ++it) {
+        for (std::vector<ScenePtr>::iterator scene = it->second.begin();
+                scene != it->second.end(); ++scene) {
+            cache_scene_events(**scene);
+        }
+    }
+}
+
+
+void Engine::set_tick_interval(double seconds)
+{
+    _tick_interval = static_cast<uint64_t>(seconds * samplerate() + 0.5);
+    _next_tick_frame = 0;
+}
+
+
+void Engine::set_bypass(MidiEventType types, int port)
+{
+    for (int n = 0; n != 32; ++n) {
+        if (types & (1u << n)) {
+            _bypass_ports[n] = port;
+        }
+    }
+    _bypass_types |= types;
+}
+
+
+void Engine::stop_process_worker()
+{
+    if (!_python_caller->process_worker()) {
+        return;
+    }
+
+    // calls are only ever queued while processing events, so holding the
+    // lock ensures none is in progress while the pipe is being closed.
+    // the processing thread may be waiting for the GIL
+    das::python::scoped_gil_release gil;
+    boost::mutex::scoped_lock lock(_process_mutex);
+
+    _python_caller->process_worker()->stop();
 }
 
 
 void Engine::start(int initial_scene, int initial_subscene)
 {
+    if (_tick_interval && !_backend->set_tick_interval(_tick_interval)) {
+        if (_verbose) {
+            std::cout << "backend doesn't support ticks, "
+                         "tick interval ignored" << std::endl;
+        }
+    }
+
     _backend->start(
         boost::bind(&Engine::run_init, this, initial_scene, initial_subscene),
         boost::bind(&Engine::run_cycle, this)
@@ -101,6 +282,28 @@ void Engine::start(int initial_scene, int initial_subscene)
 }
 
 
+void Engine::stop()
+{
+    _osc_server.reset();
+
+    if (_backend) {
+        // the backend's processing thread may be waiting for the GIL
+        das::python::scoped_gil_release gil;
+        _backend->stop();
+    }
+}
+
+
+void Engine::shutdown()
+{
+    stop();
+
+    // the async thread may still be delivering scene switch notifications,
+    // which call back into the derived class
+    _python_caller.reset();
+}
+
+
 void Engine::run_init(int initial_scene, int initial_subscene)
 {
     boost::mutex::scoped_lock lock(_process_mutex);
@@ -117,7 +320,12 @@ void Engine::run_init(int initial_scene, int initial_subscene)
     _new_subscene = initial_subscene;
     process_scene_switch(_buffer);
 
-    _backend->output_events(_buffer.begin(), _buffer.end());
+    if (_restored_state) {
+        restore_state();
+    }
+    snapshot_state();
+
+    send_events(*_backend, _buffer.begin(), _buffer.end());
 }
 
 
@@ -125,14 +333,43 @@ void Engine::run_cycle()
 {
     MidiEvent ev;
 
+    {
+        boost::mutex::scoped_lock lock(_process_mutex);
+        process_commands(_buffer, *_backend);
+    }
+
     while (_backend->input_event(ev))
     {
+        if (ev.type == MIDI_EVENT_NONE) {
+            // woken up to run queued commands
+            boost::mutex::scoped_lock lock(_process_mutex);
+            process_commands(_buffer, *_backend);
+            continue;
+        }
+
+        // the clock tracker is only ever updated from this thread, so it
+        // doesn't need the process mutex
+        _clock_tracker.process(ev);
+
+        // events in the bypass table are sent right away, without waiting
+        // for any other processing to complete
+        if (process_bypass(ev)) {
+            if (ev.type != MIDI_EVENT_NONE) {
+                send_events(*_backend, &ev, &ev + 1);
+            }
+            continue;
+        }
+
 #ifdef ENABLE_BENCHMARK
         hrclock::time_point t1 = hrclock::now();
 #endif
 
         boost::mutex::scoped_lock lock(_process_mutex);
 
+        // with backends that only return from input_event() when there's
+        // input, this is the earliest chance to run commands
+        process_commands(_buffer, *_backend);
+
         _buffer.clear();
 
         // process the event
@@ -151,18 +388,60 @@ void Engine::run_cycle()
         ++num_cycles_;
 #endif
 
-        _backend->output_events(_buffer.begin(), _buffer.end());
+        send_events(*_backend, _buffer.begin(), _buffer.end());
+
+        // run commands queued while processing the event (e.g. scene
+        // switches from Process()) before waiting for more input
+        process_commands(_buffer, *_backend);
+    }
+
+    if (_backend->finished()) {
+        _finished = 1;
+        _python_caller->notify();
     }
 }
 
 
 void Engine::run_async()
 {
+    if (_state_file) {
+        if (_state_changed) {
+            // the last snapshot couldn't be queued, try again
+            boost::mutex::scoped_lock lock(_process_mutex);
+            snapshot_state();
+        }
+        write_state();
+    }
+
     if (!_backend) {
         // backend already destroyed
         return;
     }
 
+    notify_scene_switches();
+
+    if (_finished) {
+        _finished = 0;
+        finished_callback();
+    }
+
+    if (!_backend->can_wake()) {
+        // whoever holds the lock is the queue's consumer, so even checking
+        // whether there's anything to do requires it
+        boost::mutex::scoped_lock lock(_process_mutex);
+        if (!_commands->empty()) {
+            process_commands(_buffer, *_backend);
+        }
+    }
+
+    if (_requested_scene != -1) {
+        boost::mutex::scoped_lock lock(_process_mutex);
+
+        // this will also complete any scene switch that was waiting for
+        // its scene to be built
+        build_requested_scene(lock);
+    }
+
     if (_new_scene != -1 || _new_subscene != -1) {
         boost::mutex::scoped_lock lock(_process_mutex);
 
@@ -170,13 +449,18 @@ void Engine::run_async()
 
         process_scene_switch(_buffer);
 
-        _backend->output_events(_buffer.begin(), _buffer.end());
+        send_events(*_backend, _buffer.begin(), _buffer.end());
     }
 }
 
 
-std::vector<MidiEvent> Engine::process_event(MidiEvent const & ev)
+std::vector<MidiEvent> Engine::process_event(MidiEvent const & event)
 {
+    // the event belongs to python, so copy it before releasing the GIL.
+    // other threads, and other engines, can run while this one is busy
+    MidiEvent const ev(event);
+    das::python::scoped_gil_release gil;
+
     boost::mutex::scoped_lock lock(_process_mutex);
 
     std::vector<MidiEvent> v;
@@ -184,17 +468,98 @@ std::vector<MidiEvent> Engine::process_event(MidiEvent const & ev)
 
     if (!_current_patch) {
         _current_patch = &*_scenes.find(0)->second[0]->patch;
+
+        if (_restored_state) {
+            restore_state();
+        }
     }
 
-    process(buffer, ev);
+    process_commands(buffer, v);
 
-    process_scene_switch(buffer);
+    // there's no backend to generate ticks, so run them on virtual time,
+    // up to the frame of the event being processed
+    process_ticks(v, ev.frame);
+
+    _clock_tracker.process(ev);
+
+    MidiEvent bypass_ev(ev);
+    if (process_bypass(bypass_ev)) {
+        if (bypass_ev.type != MIDI_EVENT_NONE) {
+            v.push_back(bypass_ev);
+        }
+    } else {
+        buffer.clear();
+
+        process(buffer, ev);
+
+        process_scene_switch(buffer);
+
+        // nothing runs in realtime when processing events offline, so any
+        // scene needed can be built right away
+        while (build_requested_scene(lock)) {
+            process_scene_switch(buffer);
+        }
+
+        v.insert(v.end(), buffer.begin(), buffer.end());
+    }
+
+    process_commands(buffer, v);
+
+    lock.unlock();
+
+    // deliver notifications right away, so they happen in order with the
+    // events being processed
+    notify_scene_switches();
 
-    v.insert(v.end(), buffer.begin(), buffer.end());
     return v;
 }
 
 
+bool Engine::process_bypass(MidiEvent & ev)
+{
+    if (!(ev.type & _bypass_types)) {
+        return false;
+    }
+
+    int n = 0;
+    while (!(ev.type & (1u << n))) {
+        ++n;
+    }
+
+    ev.port = _bypass_ports[n];
+
+    if (ev.port == -1 || !sanitize_event(ev)) {
+        ev.type = MIDI_EVENT_NONE;
+    }
+    return true;
+}
+
+
+void Engine::process_ticks(std::vector<MidiEvent> & v, uint64_t frame)
+{
+    if (!_tick_interval) {
+        return;
+    }
+
+    while (_next_tick_frame <= frame) {
+        Patch::EventBuffer buffer(*this);
+
+        MidiEvent tick_ev;
+        tick_ev.type = MIDI_EVENT_TICK;
+        tick_ev.data1 = _next_tick_frame / _tick_interval;
+        tick_ev.frame = _next_tick_frame;
+
+        process(buffer, tick_ev);
+
+        process_scene_switch(buffer);
+
+        v.insert(v.end(), buffer.begin(), buffer.end());
+
+        _next_tick_frame += _tick_interval;
+    }
+}
+
+
 template <typename B>
 void Engine::process(B & buffer, MidiEvent const & ev)
 {
@@ -229,7 +594,8 @@ Patch * Engine::get_matching_patch(MidiEvent const & ev)
     // note on: store current patch
     if (ev.type == MIDI_EVENT_NOTEON) {
         _noteon_patches.insert(std::make_pair(make_notekey(ev),
-                                              _current_patch));
+                PatchRef(_current_patch, _current_scene, _current_subscene)));
+        _state_changed = true;
         return _current_patch;
     }
     // note off: retrieve and remove stored patch
@@ -237,8 +603,9 @@ Patch * Engine::get_matching_patch(MidiEvent const & ev)
         NotePatchMap::const_iterator i =
                             _noteon_patches.find(make_notekey(ev));
         if (i != _noteon_patches.end()) {
-            Patch *p = i->second;
+            Patch *p = i->second.patch;
             _noteon_patches.erase(i);
+            _state_changed = true;
             return p;
         }
     }
@@ -247,7 +614,8 @@ Patch * Engine::get_matching_patch(MidiEvent const & ev)
     else if (ev.type == MIDI_EVENT_CTRL &&
              ev.ctrl.param == 64 && ev.ctrl.value == 127) {
         _sustain_patches.insert(std::make_pair(make_sustainkey(ev),
-                                               _current_patch));
+                PatchRef(_current_patch, _current_scene, _current_subscene)));
+        _state_changed = true;
         return _current_patch;
     }
     // sustain released
@@ -256,8 +624,9 @@ Patch * Engine::get_matching_patch(MidiEvent const & ev)
         SustainPatchMap::const_iterator i =
                                 _sustain_patches.find(make_sustainkey(ev));
         if (i != _sustain_patches.end()) {
-            Patch *p = i->second;
+            Patch *p = i->second.patch;
             _sustain_patches.erase(i);
+            _state_changed = true;
             return p;
         }
     }
@@ -286,21 +655,26 @@ void Engine::process_scene_switch(B & buffer)
         return;
     }
 
-    // call python scene switch handler if we have more than one scene
-    if (_scenes.size() > 1) {
-        scene_switch_callback(_new_scene, _new_subscene);
-    }
-
-    // create dummy event to trigger init and exit patches
-    MidiEvent dummy_ev;
-    dummy_ev.type = MIDI_EVENT_DUMMY;
-
     // determine the actual scene and subscene number we're switching to
     int scene_num = _new_scene != -1 ? _new_scene : _current_scene;
     int subscene_num = _new_subscene != -1 ? _new_subscene : 0;
 
+    if (!scene_built(scene_num, subscene_num)) {
+        // the scene hasn't been built yet, and that can't be done here.
+        // keep the switch pending until it's available
+        request_scene_build(scene_num);
+        return;
+    }
+
     SceneMap::const_iterator scene_it = _scenes.find(scene_num);
 
+    // notify python if we have more than one scene. the callback can't be
+    // called from here, as it would need to acquire the GIL
+    if (_scenes.size() > 1) {
+        _switch_notifications->write(std::make_pair(scene_num, subscene_num));
+        _python_caller->notify();
+    }
+
     // check if scene and subscene exist
     if (scene_it != _scenes.end() &&
         static_cast<int>(scene_it->second.size()) > subscene_num)
@@ -314,34 +688,25 @@ void Engine::process_scene_switch(B & buffer)
             ScenePtr prev_scene = _scenes.find(_current_scene)
                                                 ->second[_current_subscene];
 
-            if (prev_scene->exit_patch) {
-                typename B::Iterator it = buffer.insert(buffer.end(),
-                                                        dummy_ev);
-                typename B::Range r(it, buffer.end());
-
+            if (prev_scene->exit_cached) {
+                // use the exit patch's precomputed output
+                buffer.insert(buffer.end(), prev_scene->exit_events.begin(),
+                                            prev_scene->exit_events.end());
+            }
+            else if (prev_scene->exit_patch) {
                 // run event through exit patch
-                prev_scene->exit_patch->process(buffer, r);
-
-                if (_post_patch) {
-                    _post_patch->process(buffer, r);
-                }
-                _sanitize_patch->process(buffer, r);
+                process_switch_patch(buffer, *prev_scene->exit_patch);
             }
         }
 
         // check if the scene has an init patch
-        if (scene->init_patch) {
-            typename B::Iterator it = buffer.insert(buffer.end(),
-                                                    dummy_ev);
-            typename B::Range r(it, buffer.end());
-
+        if (scene->init_cached) {
+            buffer.insert(buffer.end(), scene->init_events.begin(),
+                                        scene->init_events.end());
+        }
+        else if (scene->init_patch) {
             // run event through init patch
-            scene->init_patch->process(buffer, r);
-
-            if (_post_patch) {
-                _post_patch->process(buffer, r);
-            }
-            _sanitize_patch->process(buffer, r);
+            process_switch_patch(buffer, *scene->init_patch);
         }
 
         // store pointer to patch
@@ -350,6 +715,12 @@ void Engine::process_scene_switch(B & buffer)
         // store scene and subscene numbers
         _current_scene = scene_num;
         _current_subscene = subscene_num;
+        _state_changed = true;
+
+        if (_lazy_scenes) {
+            // give the python side a chance to prefetch other scenes
+            request_scene_build(scene_num);
+        }
     }
 
     // mark as done
@@ -358,6 +729,127 @@ void Engine::process_scene_switch(B & buffer)
 }
 
 
+template <typename B>
+void Engine::process_switch_patch(B & buffer, Patch const & patch)
+{
+    // create dummy event to trigger init or exit patch
+    MidiEvent dummy_ev;
+    dummy_ev.type = MIDI_EVENT_DUMMY;
+
+    typename B::Iterator it = buffer.insert(buffer.end(), dummy_ev);
+    typename B::Range r(it, buffer.end());
+
+    patch.process(buffer, r);
+
+    if (_post_patch) {
+        _post_patch->process(buffer, r);
+    }
+    _sanitize_patch->process(buffer, r);
+}
+
+
+void Engine::cache_scene_events(Scene & scene)
+{
+    scene.init_cached = cache_switch_patch(scene.init_patch,
+                                           scene.init_events);
+    scene.exit_cached = cache_switch_patch(scene.exit_patch,
+                                           scene.exit_events);
+}
+
+
+bool Engine::cache_switch_patch(PatchPtr const & patch,
+                                std::vector<MidiEvent> & events)
+{
+    events.clear();
+
+    // the output can only be computed in advance if it's going to be the
+    // same every time
+    if (!patch || !patch->deterministic() ||
+            (_post_patch && !_post_patch->deterministic())) {
+        return false;
+    }
+
+    Patch::EventBuffer buffer(*this);
+    process_switch_patch(buffer, *patch);
+
+    events.assign(buffer.begin(), buffer.end());
+    return true;
+}
+
+
+void Engine::notify_scene_switches()
+{
+    // the async thread and process_event() may both get here. hold the
+    // mutex until all callbacks have returned, so that switches are
+    // reported in order, and never after process_event() has returned.
+    // the callbacks need the GIL, so never wait for the mutex while
+    // holding it
+    boost::recursive_mutex::scoped_lock lock(_notify_mutex, boost::defer_lock);
+
+    if (das::python::gil_held()) {
+        das::python::scoped_gil_release gil;
+        lock.lock();
+    } else {
+        lock.lock();
+    }
+
+    std::pair<int, int> n;
+    while (_switch_notifications->read(n)) {
+        scene_switch_callback(n.first, n.second);
+    }
+}
+
+
+void Engine::request_scene_build(int scene)
+{
+    _requested_scene = scene;
+    _python_caller->notify();
+}
+
+
+bool Engine::build_requested_scene(boost::mutex::scoped_lock & lock)
+{
+    int scene = _requested_scene;
+    if (scene == -1) {
+        return false;
+    }
+    _requested_scene = -1;
+
+    // hide any pending scene switch while the lock is released, so it won't
+    // be attempted (and deferred again) by another thread in the meantime
+    int new_scene = _new_scene;
+    int new_subscene = _new_subscene;
+    _new_scene = -1;
+    _new_subscene = -1;
+
+    lock.unlock();
+    scene_build_callback(scene);
+    lock.lock();
+
+    // restore the pending switch, unless a new one was requested in the
+    // meantime. if the scene still couldn't be built, give up
+    if (_new_scene == -1 && _new_subscene == -1 &&
+            scene_built(new_scene != -1 ? new_scene : _current_scene,
+                        new_subscene != -1 ? new_subscene : 0)) {
+        _new_scene = new_scene;
+        _new_subscene = new_subscene;
+    }
+
+    return true;
+}
+
+
+bool Engine::scene_built(int scene, int subscene) const
+{
+    SceneMap::const_iterator it = _scenes.find(scene);
+
+    // scenes that don't exist don't need to be built
+    return it == _scenes.end() ||
+           static_cast<int>(it->second.size()) <= subscene ||
+           it->second[subscene]->patch;
+}
+
+
 bool Engine::sanitize_event(MidiEvent & ev) const
 {
     // FIXME: std::cout is not RT-safe!
@@ -443,6 +935,7 @@ bool Engine::sanitize_event(MidiEvent & ev) const
         case MIDI_EVENT_SYSRT_SENSING:
         case MIDI_EVENT_SYSRT_RESET:
             return true;
+        case MIDI_EVENT_TICK:
         case MIDI_EVENT_DUMMY:
             return false;
         default:
@@ -455,11 +948,287 @@ bool Engine::sanitize_event(MidiEvent & ev) const
 }
 
 
+template <typename IterT>
+void Engine::send_events(backend::BackendBase & backend,
+                         IterT begin, IterT end)
+{
+    boost::mutex::scoped_lock lock(_output_mutex);
+    backend.output_events(begin, end);
+}
+
+
+template <typename IterT>
+void Engine::send_events(std::vector<MidiEvent> & v, IterT begin, IterT end)
+{
+    v.insert(v.end(), begin, end);
+}
+
+
+template <typename B, typename S>
+void Engine::process_commands(B & buffer, S & sink)
+{
+    Command c;
+
+    while (_commands->pop(c))
+    {
+        buffer.clear();
+
+        switch (c.type) {
+          case COMMAND_OUTPUT:
+            buffer.insert(buffer.end(), c.ev);
+            break;
+          case COMMAND_INJECT:
+            process(buffer, c.ev);
+            break;
+          case COMMAND_SWITCH_SCENE:
+            switch_scene(c.scene, c.subscene);
+            break;
+          case COMMAND_STEP_SCENE:
+            step_scene(c.scene, c.subscene, c.wrap);
+            break;
+          case COMMAND_PANIC:
+            panic(buffer);
+            break;
+        }
+
+        process_scene_switch(buffer);
+
+        send_events(sink, buffer.begin(), buffer.end());
+    }
+
+    // this runs after every event processed, so it's a good place to
+    // keep the state snapshot up to date
+    snapshot_state();
+}
+
+
+void Engine::queue_command(Command const & c)
+{
+    if (!_commands->push(c)) {
+        throw std::runtime_error("engine command queue is full");
+    }
+
+    // make sure the command is carried out soon, even if there's no input.
+    // if possible that's left to the processing thread, rather than having
+    // another thread take the process mutex it needs
+    if (_backend && _backend->can_wake()) {
+        _backend->wake();
+    } else {
+        _python_caller->notify();
+    }
+}
+
+
 void Engine::output_event(MidiEvent const & ev)
 {
-    boost::mutex::scoped_lock lock(_process_mutex);
+    Command c = { COMMAND_OUTPUT, ev, -1, -1, false };
+    queue_command(c);
+}
+
+
+void Engine::inject_event(MidiEvent const & ev)
+{
+    Command c = { COMMAND_INJECT, ev, -1, -1, false };
+    queue_command(c);
+}
+
+
+void Engine::queue_switch_scene(int scene, int subscene)
+{
+    Command c = { COMMAND_SWITCH_SCENE, MidiEvent(), scene, subscene, false };
+    queue_command(c);
+}
+
+
+void Engine::queue_step_scene(int scene_offset, int subscene_offset,
+                              bool wrap)
+{
+    Command c = { COMMAND_STEP_SCENE, MidiEvent(),
+                  scene_offset, subscene_offset, wrap };
+    queue_command(c);
+}
+
+
+void Engine::queue_panic()
+{
+    Command c = { COMMAND_PANIC, MidiEvent(), -1, -1, false };
+    queue_command(c);
+}
+
+
+void Engine::step_scene(int scene_offset, int subscene_offset, bool wrap)
+{
+    if (scene_offset) {
+        SceneMap::const_iterator i = _scenes.find(_current_scene);
+        if (i == _scenes.end()) {
+            return;
+        }
+        if (scene_offset < 0 && i != _scenes.begin()) {
+            switch_scene((--i)->first);
+        }
+        else if (scene_offset > 0 && ++i != _scenes.end()) {
+            switch_scene(i->first);
+        }
+    }
+
+    if (subscene_offset) {
+        int num = num_subscenes();
+        int n = _current_subscene + subscene_offset;
+        if (wrap && num) {
+            n = (n % num + num) % num;
+        }
+        if (n >= 0 && n < num) {
+            switch_scene(-1, n);
+        }
+    }
+}
+
+
+template <typename B>
+void Engine::panic(B & buffer)
+{
+    int num_ports = _backend ? _backend->num_out_ports() : 1;
+
+    for (int port = 0; port != num_ports; ++port) {
+        for (int channel = 0; channel != 16; ++channel) {
+            MidiEvent ev;
+            ev.type = MIDI_EVENT_CTRL;
+            ev.port = port;
+            ev.channel = channel;
+            // all notes off
+            ev.ctrl.param = 123;
+            ev.ctrl.value = 0;
+            buffer.insert(buffer.end(), ev);
+            // sustain off
+            ev.ctrl.param = 64;
+            buffer.insert(buffer.end(), ev);
+        }
+    }
+}
+
+
+void Engine::open_state_file(std::string const & path)
+{
+    _state_file.reset(new StateFile(path));
+    _state_snapshots.reset(new StateSnapshotBuffer(
+                                config::MAX_STATE_SNAPSHOTS));
+
+    _restored_state.reset(new StateSnapshot);
+    if (!_state_file->read(*_restored_state)) {
+        _restored_state.reset();
+    }
+}
+
+
+void Engine::snapshot_state()
+{
+    if (!_state_changed || !_state_snapshots) {
+        return;
+    }
+
+    StateSnapshot & s = _state_snapshot;
+    s.scene = _current_scene;
+    s.subscene = _current_subscene;
+
+    // anything beyond the size of the snapshot is lost
+    s.num_notes = 0;
+    for (NotePatchMap::const_iterator it = _noteon_patches.begin();
+            it != _noteon_patches.end() &&
+            s.num_notes != config::MAX_SIMULTANEOUS_NOTES; ++it) {
+        StateEntry e = { it->first, it->second.scene, it->second.subscene };
+        s.notes[s.num_notes++] = e;
+    }
+
+    s.num_sustains = 0;
+    for (SustainPatchMap::const_iterator it = _sustain_patches.begin();
+            it != _sustain_patches.end() &&
+            s.num_sustains != config::MAX_SUSTAIN_PEDALS; ++it) {
+        StateEntry e = { it->first, it->second.scene, it->second.subscene };
+        s.sustains[s.num_sustains++] = e;
+    }
+
+    // if the buffer is full, try again later
+    if (_state_snapshots->write(s)) {
+        _state_changed = false;
+    }
+}
+
+
+void Engine::write_state()
+{
+    // only the most recent snapshot is of any interest
+    StateSnapshot s;
+    bool have_snapshot = false;
+
+    while (_state_snapshots->read(s)) {
+        have_snapshot = true;
+    }
+
+    if (have_snapshot) {
+        _state_file->write(s);
+    }
+}
+
+
+void Engine::restore_state()
+{
+    StateSnapshot const & s = *_restored_state;
+
+    for (uint32_t n = 0; n != s.num_notes; ++n) {
+        StateEntry const & e = s.notes[n];
+        if (Patch *p = scene_patch(e.scene, e.subscene)) {
+            _noteon_patches.insert(std::make_pair(e.key,
+                                        PatchRef(p, e.scene, e.subscene)));
+        }
+    }
+
+    for (uint32_t n = 0; n != s.num_sustains; ++n) {
+        StateEntry const & e = s.sustains[n];
+        if (Patch *p = scene_patch(e.scene, e.subscene)) {
+            _sustain_patches.insert(std::make_pair(e.key,
+                                        PatchRef(p, e.scene, e.subscene)));
+        }
+    }
+
+    // don't restore anything again
+    _restored_state.reset();
+    _state_changed = true;
+}
+
+
+Patch * Engine::scene_patch(int scene, int subscene) const
+{
+    SceneMap::const_iterator it = _scenes.find(scene);
+
+    if (it == _scenes.end() || subscene < 0 ||
+            static_cast<int>(it->second.size()) <= subscene) {
+        return NULL;
+    }
+    // NULL if the scene hasn't been built
+    return it->second[subscene]->patch.get();
+}
+
+
+void Engine::start_osc_server(int port, int data_offset,
+                              boost::python::object callback)
+{
+    _osc_server.reset();
+    _osc_server.reset(new osc::Server(*this, port, data_offset, callback));
+}
+
+
+void Engine::stop_osc_server()
+{
+    _osc_server.reset();
+}
+
+
+unsigned int Engine::samplerate() const
+{
+    unsigned int r = _backend ? _backend->samplerate() : 0;
 
-    _backend->output_event(ev);
+    // use a sensible default if the backend doesn't support timestamps
+    return r ? r : config::OFFLINE_SAMPLERATE;
 }
 
 
@@ -15,10 +15,14 @@
 #include "patch.hh"
 #include "backend/base.hh"
 #include "python_caller.hh"
+#include "clock_tracker.hh"
+#include "osc.hh"
+#include "state_file.hh"
 
 #include <string>
 #include <vector>
 #include <map>
+#include <utility>
 
 #ifdef ENABLE_BENCHMARK
 #include <chrono>
@@ -28,9 +32,12 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 #include <boost/unordered/unordered_map.hpp>
 
 #include "util/counted_objects.hh"
+#include "util/ringbuffer.hh"
+#include "util/mpsc_queue.hh"
 
 
 namespace mididings {
@@ -49,31 +56,84 @@ class Engine
           : patch(patch_)
           , init_patch(init_patch_)
           , exit_patch(exit_patch_)
+          , init_cached(false)
+          , exit_cached(false)
         { }
 
         PatchPtr patch;
         PatchPtr init_patch;
         PatchPtr exit_patch;
+
+        // the output of the init and exit patches (including the post
+        // patch), if it's always the same and could be computed in advance
+        bool init_cached;
+        bool exit_cached;
+        std::vector<MidiEvent> init_events;
+        std::vector<MidiEvent> exit_events;
     };
 
     typedef boost::shared_ptr<Scene> ScenePtr;
     typedef std::map<int, std::vector<ScenePtr> > SceneMap;
 
+    // the patch a note or sustain pedal was routed through, and the
+    // scene/subscene that patch belongs to
+    struct PatchRef {
+        PatchRef(Patch *patch_, int scene_, int subscene_)
+          : patch(patch_), scene(scene_), subscene(subscene_) { }
+        Patch *patch;
+        int scene;
+        int subscene;
+    };
+
     typedef unsigned int EventKey;
-    typedef boost::unordered_map<EventKey, Patch *> NotePatchMap;
-    typedef boost::unordered_map<EventKey, Patch *> SustainPatchMap;
+    typedef boost::unordered_map<EventKey, PatchRef> NotePatchMap;
+    typedef boost::unordered_map<EventKey, PatchRef> SustainPatchMap;
 
 
     Engine(backend::BackendPtr backend, bool verbose);
 
     virtual ~Engine();
 
+    // add a scene. if patch is NULL, the scene will only be built (by
+    // calling scene_build_callback()) when it's needed
     void add_scene(int i, PatchPtr patch,
                    PatchPtr init_patch, PatchPtr exit_patch);
+    // replace the patches of a scene that was previously added
+    void set_scene(int i, int subscene, PatchPtr patch,
+                   PatchPtr init_patch, PatchPtr exit_patch);
+    // release all patches of the given scene, so it needs to be built again
+    // before it can be used. returns false if the scene is still in use
+    bool unload_scene(int i);
     void set_processing(PatchPtr ctrl_patch,
                         PatchPtr pre_patch, PatchPtr post_patch);
 
+    // generate tick events at the given interval, or not at all if zero
+    void set_tick_interval(double seconds);
+
+    // route incoming events of the given types directly to the given output
+    // port, bypassing all patches. a port number of -1 drops these events
+    void set_bypass(MidiEventType types, int port);
+
+    // limit the time synchronous Python calls may wait for the GIL, or
+    // wait indefinitely if zero
+    void set_gil_timeout(double seconds, GilFallback fallback) {
+        _python_caller->set_gil_timeout(seconds, fallback);
+    }
+    std::size_t gil_timeouts() const {
+        return _python_caller->gil_timeouts();
+    }
+
+    // worker process for Call(process=...), see ProcessWorker. must be set
+    // before the engine is started
+    void set_process_worker(boost::shared_ptr<ProcessWorker> worker) {
+        _python_caller->set_process_worker(worker);
+    }
+    void stop_process_worker();
+
     void start(int initial_scene, int initial_subscene);
+    // stop processing, leaving the backend itself intact, so that another
+    // engine can be started on the same backend
+    void stop();
 
     void switch_scene(int scene, int subscene = -1);
 
@@ -98,14 +158,65 @@ class Engine
 
     std::vector<MidiEvent> process_event(MidiEvent const & ev);
 
+    // these can be called from any thread, without waiting for event
+    // processing. the command is carried out at the start of the next
+    // process cycle (or by the async thread)
     void output_event(MidiEvent const & ev);
+    void inject_event(MidiEvent const & ev);
+    void queue_switch_scene(int scene, int subscene);
+    // switch to the previous/next scene or subscene. subscene numbers wrap
+    // around if wrap is true
+    void queue_step_scene(int scene_offset, int subscene_offset, bool wrap);
+    // send all-notes-off and sustain-off on all channels and ports
+    void queue_panic();
+
+    // keep a snapshot of scene and note routing state in the given file,
+    // see StateFile. the state previously stored in the file is restored
+    // when processing starts
+    void open_state_file(std::string const & path);
+    // scene and subscene stored in the state file, or -1
+    int restored_scene() const {
+        return _restored_state ? _restored_state->scene : -1;
+    }
+    int restored_subscene() const {
+        return _restored_state ? _restored_state->subscene : -1;
+    }
+
+    // start or stop the OSC server, see osc::Server
+    void start_osc_server(int port, int data_offset,
+                          boost::python::object callback);
+    void stop_osc_server();
 
     double time();
 
+    // the number of frames per second of event timestamps
+    unsigned int samplerate() const;
+
+    ClockTracker const & clock_tracker() const { return _clock_tracker; }
+
+    double tempo() const {
+        return _clock_tracker.tempo();
+    }
+    double song_position() const {
+        // 24 clocks per quarter note
+        return _clock_tracker.position() / 24.0;
+    }
+
     PythonCaller & python_caller() const { return *_python_caller; }
 
   protected:
+    // stop processing, and all threads that may call the virtual functions
+    // below. must be called by the derived class's destructor, with the GIL
+    // held
+    void shutdown();
+
     virtual void scene_switch_callback(int scene, int subscene) = 0;
+    // build the given scene if it isn't already, and possibly other scenes
+    // that are likely to be needed soon. called from the async thread
+    virtual void scene_build_callback(int scene) = 0;
+    // the backend has run out of input, see BackendBase::finished(). called
+    // from the async thread
+    virtual void finished_callback() = 0;
 
   private:
 
@@ -116,9 +227,50 @@ class Engine
     template <typename B>
     void process(B & buffer, MidiEvent const & ev);
 
+    // returns true if the event was handled by the bypass table, in which
+    // case ev contains the event to be sent (or an event of type NONE)
+    bool process_bypass(MidiEvent & ev);
+
     template <typename B>
     void process_scene_switch(B & buffer);
 
+    // carry out all queued commands, sending the resulting events to sink
+    // (a backend or a vector). the lock must be held
+    template <typename B, typename S>
+    void process_commands(B & buffer, S & sink);
+
+    // send events to the backend, or append them to a vector when
+    // processing offline
+    template <typename IterT>
+    void send_events(backend::BackendBase & backend, IterT begin, IterT end);
+    template <typename IterT>
+    static void send_events(std::vector<MidiEvent> & v,
+                            IterT begin, IterT end);
+
+    // run a dummy event through an init or exit patch
+    template <typename B>
+    void process_switch_patch(B & buffer, Patch const & patch);
+
+    void cache_scene_events(Scene & scene);
+    bool cache_switch_patch(PatchPtr const & patch,
+                            std::vector<MidiEvent> & events);
+
+    // ask for the given scene to be built outside of the realtime thread
+    void request_scene_build(int scene);
+    // build the scene requested by request_scene_build(), temporarily
+    // releasing the lock. returns false if there was nothing to do
+    bool build_requested_scene(boost::mutex::scoped_lock & lock);
+
+    // returns true unless the scene exists but hasn't been built yet
+    bool scene_built(int scene, int subscene) const;
+    bool scene_in_use(Scene const & scene) const;
+
+    // call scene_switch_callback() for all scene switches that happened
+    // since the last call
+    void notify_scene_switches();
+
+    void process_ticks(std::vector<MidiEvent> & v, uint64_t frame);
+
 
     Patch * get_matching_patch(MidiEvent const & ev);
 
@@ -149,38 +301,120 @@ class Engine
     int _new_scene;
     int _new_subscene;
 
+    // true if scenes are built on demand, and the scene that needs to be
+    // built next (or -1). the latter is set from the realtime thread
+    bool _lazy_scenes;
+    das::atomic_int _requested_scene;
+
+    // tick interval in frames, and the frame of the next tick when running
+    // offline
+    uint64_t _tick_interval;
+    uint64_t _next_tick_frame;
+
+    ClockTracker _clock_tracker;
+
+    // event types that bypass all processing, and the output port for each
+    // event type bit
+    MidiEventType _bypass_types;
+    int _bypass_ports[32];
+
     NotePatchMap _noteon_patches;
     SustainPatchMap _sustain_patches;
 
+    // memory for the events in _buffer. every engine has its own, so that
+    // engines running in different threads never share it
+    curious_pool _event_pool;
     Patch::EventBufferRT _buffer;
 
     boost::mutex _process_mutex;
 
+    // serializes output to the backend, which happens from both the
+    // processing thread and the async thread. it's only ever held while
+    // sending events, so bypassed events never wait for other processing
+    boost::mutex _output_mutex;
+
+    // scene switches (scene and subscene number) that python hasn't been
+    // told about yet, and a mutex held while delivering them. it's
+    // recursive, in case a callback ends up processing events itself
+    typedef das::ringbuffer<std::pair<int, int> > SwitchNotificationBuffer;
+    boost::scoped_ptr<SwitchNotificationBuffer> _switch_notifications;
+    boost::recursive_mutex _notify_mutex;
+
+    enum CommandType {
+        COMMAND_OUTPUT,
+        COMMAND_INJECT,
+        COMMAND_SWITCH_SCENE,
+        COMMAND_STEP_SCENE,
+        COMMAND_PANIC
+    };
+
+    struct Command {
+        CommandType type;
+        MidiEvent ev;
+        // scene/subscene numbers, or offsets for COMMAND_STEP_SCENE
+        int scene;
+        int subscene;
+        bool wrap;
+    };
+
+    void step_scene(int scene_offset, int subscene_offset, bool wrap);
+
+    // queue a snapshot of the current state if anything has changed
+    void snapshot_state();
+    // write the most recent snapshot to the state file
+    void write_state();
+    // restore note routing from the snapshot read from the state file
+    void restore_state();
+    // patch of the given scene/subscene, or NULL if it doesn't exist
+    Patch * scene_patch(int scene, int subscene) const;
+
+    template <typename B>
+    void panic(B & buffer);
+
+    // commands queued from other threads. only popped, or checked for
+    // being empty, while holding _process_mutex
+    void queue_command(Command const & c);
+    boost::scoped_ptr<das::mpsc_queue<Command> > _commands;
+
+    boost::scoped_ptr<osc::Server> _osc_server;
+
+    // state file, snapshots queued by the processing thread, and the state
+    // read from the file (until it's restored)
+    boost::scoped_ptr<StateFile> _state_file;
+    typedef das::ringbuffer<StateSnapshot> StateSnapshotBuffer;
+    boost::scoped_ptr<StateSnapshotBuffer> _state_snapshots;
+    boost::scoped_ptr<StateSnapshot> _restored_state;
+    StateSnapshot _state_snapshot;
+    volatile bool _state_changed;
+
+    // set by the processing thread when the backend has finished
+    das::atomic_size_t _finished;
+
     boost::scoped_ptr<PythonCaller> _python_caller;
 
 #ifdef ENABLE_BENCHMARK
   public:
     typedef std::chrono::high_resolution_clock hrclock;
 
-    static int num_cycles() {
+    int num_cycles() const {
         return num_cycles_;
     }
 
-    static int cycle_duration_mean() {
+    int cycle_duration_mean() const {
         if (!num_cycles_) return 0;
         return std::chrono::duration_cast<std::chrono::microseconds>(
                                 cycles_duration_total_ / num_cycles_).count();
     }
 
-    static int cycle_duration_max() {
+    int cycle_duration_max() const {
         return std::chrono::duration_cast<std::chrono::microseconds>(
                                 cycles_duration_max_).count();
     }
 
   private:
-    static hrclock::duration cycles_duration_total_;
-    static hrclock::duration cycles_duration_max_;
-    static int num_cycles_;
+    hrclock::duration cycles_duration_total_;
+    hrclock::duration cycles_duration_max_;
+    int num_cycles_;
 #endif
 };
 
@@ -60,6 +60,7 @@ enum MidiEventTypeEnum
     MIDI_EVENT_SYSTEM           = MIDI_EVENT_SYSEX |
                                   MIDI_EVENT_SYSCM |
                                   MIDI_EVENT_SYSRT,
+    MIDI_EVENT_TICK             = 1 << 18,
     MIDI_EVENT_DUMMY            = 1 << 29,
     MIDI_EVENT_ANY              = (1 << 30) - 1,
 };
@@ -177,11 +178,13 @@ inline bool operator==(MidiEvent const & lhs, MidiEvent const & rhs)
     }
 
     // check which fields are relevant for the given event type
-    bool have_channel = !(lhs.type & (MIDI_EVENT_SYSTEM | MIDI_EVENT_DUMMY));
+    bool have_channel = !(lhs.type & (MIDI_EVENT_SYSTEM | MIDI_EVENT_TICK |
+                                      MIDI_EVENT_DUMMY));
     bool have_data1 = (lhs.type & (
             MIDI_EVENT_NOTE | MIDI_EVENT_CTRL |
             MIDI_EVENT_POLY_AFTERTOUCH | MIDI_EVENT_SYSCM_QFRAME |
-            MIDI_EVENT_SYSCM_SONGPOS | MIDI_EVENT_SYSCM_SONGSEL));
+            MIDI_EVENT_SYSCM_SONGPOS | MIDI_EVENT_SYSCM_SONGSEL |
+            MIDI_EVENT_TICK));
     bool have_data2 = (lhs.type & (
             MIDI_EVENT_NOTE | MIDI_EVENT_CTRL | MIDI_EVENT_PITCHBEND |
             MIDI_EVENT_AFTERTOUCH | MIDI_EVENT_POLY_AFTERTOUCH |
@@ -0,0 +1,486 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "osc.hh"
+#include "engine.hh"
+
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/python/extract.hpp>
+#include <boost/python/list.hpp>
+#include <boost/python/tuple.hpp>
+#include <boost/python/stl_iterator.hpp>
+
+#include "util/python.hh"
+
+namespace bp = boost::python;
+
+
+namespace mididings {
+namespace osc {
+
+
+ArgumentVector make_arguments(bp::object args)
+{
+    ArgumentVector v;
+
+    bp::stl_input_iterator<bp::object> it(args), end;
+    for ( ; it != end; ++it) {
+        bp::tuple t = bp::extract<bp::tuple>(*it);
+        std::string tag = bp::extract<std::string>(t[0]);
+
+        Argument a;
+        a.type = tag == "f" ? 'f' : tag == "s" ? 's' : 'i';
+        a.i = 0;
+        a.f = 0.0f;
+        a.attribute = (tag == "a" || tag == "o");
+        a.offset = (tag == "o");
+
+        if (tag == "f") {
+            a.f = static_cast<float>(bp::extract<double>(t[1])());
+        } else if (tag == "s") {
+            a.s = bp::extract<std::string>(t[1])();
+        } else if (tag == "i" || tag == "a" || tag == "o") {
+            a.i = bp::extract<int>(t[1]);
+        } else {
+            PyErr_SetString(PyExc_ValueError, "invalid OSC argument tag");
+            bp::throw_error_already_set();
+        }
+        v.push_back(a);
+    }
+
+    return v;
+}
+
+
+std::string type_tags(ArgumentVector const & args)
+{
+    std::string types(",");
+    for (ArgumentVector::const_iterator it = args.begin();
+            it != args.end(); ++it) {
+        types += it->type;
+    }
+    return types;
+}
+
+
+sockaddr_in resolve(std::string const & host, int port)
+{
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo *res;
+    std::string h = host.empty() ? "127.0.0.1" : host;
+    if (::getaddrinfo(h.c_str(), NULL, &hints, &res) != 0) {
+        throw std::runtime_error("can't resolve host name '" + h + "'");
+    }
+
+    sockaddr_in addr = *reinterpret_cast<sockaddr_in *>(res->ai_addr);
+    addr.sin_port = htons(port);
+    ::freeaddrinfo(res);
+    return addr;
+}
+
+
+
+bool Writer::reserve(std::size_t n)
+{
+    if (!_ok || _pos + n > _size) {
+        _ok = false;
+        return false;
+    }
+    return true;
+}
+
+
+void Writer::string(char const *s, std::size_t len)
+{
+    // null terminated, padded to a multiple of four bytes
+    std::size_t n = (len + 4) & ~std::size_t(3);
+    if (reserve(n)) {
+        std::memcpy(_data + _pos, s, len);
+        std::memset(_data + _pos + len, 0, n - len);
+        _pos += n;
+    }
+}
+
+
+void Writer::int32(int32_t i)
+{
+    if (reserve(4)) {
+        uint32_t n = htonl(static_cast<uint32_t>(i));
+        std::memcpy(_data + _pos, &n, 4);
+        _pos += 4;
+    }
+}
+
+
+void Writer::float32(float f)
+{
+    uint32_t i;
+    std::memcpy(&i, &f, 4);
+    int32(static_cast<int32_t>(i));
+}
+
+
+bool Reader::string(std::string & s)
+{
+    char const *begin = _data + _pos;
+    char const *end = static_cast<char const *>(
+                        std::memchr(begin, 0, _size - _pos));
+    if (!end) {
+        return false;
+    }
+    s.assign(begin, end);
+    _pos += (s.size() + 4) & ~std::size_t(3);
+    if (_pos > _size) {
+        _pos = _size;
+    }
+    return true;
+}
+
+
+bool Reader::int32(int32_t & i)
+{
+    if (_pos + 4 > _size) {
+        return false;
+    }
+    uint32_t n;
+    std::memcpy(&n, _data + _pos, 4);
+    i = static_cast<int32_t>(ntohl(n));
+    _pos += 4;
+    return true;
+}
+
+
+bool Reader::float32(float & f)
+{
+    int32_t i;
+    if (!int32(i)) {
+        return false;
+    }
+    std::memcpy(&f, &i, 4);
+    return true;
+}
+
+
+
+boost::shared_ptr<Sender> Sender::get()
+{
+    static boost::weak_ptr<Sender> instance;
+    static boost::mutex mutex;
+
+    boost::mutex::scoped_lock lock(mutex);
+
+    boost::shared_ptr<Sender> p = instance.lock();
+    if (!p) {
+        p.reset(new Sender());
+        instance = p;
+    }
+    return p;
+}
+
+
+Sender::Sender()
+  : _queue(new das::mpsc_queue<Packet>(config::OSC_MAX_QUEUED_PACKETS))
+  , _quit(false)
+{
+    _fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd == -1) {
+        throw std::runtime_error("can't create OSC socket");
+    }
+
+    _thread.reset(new boost::thread(
+                        boost::bind(&Sender::sender_thread, this)));
+}
+
+
+Sender::~Sender()
+{
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _quit = true;
+        _cond.notify_one();
+    }
+    _thread->join();
+
+    ::close(_fd);
+}
+
+
+bool Sender::queue(Packet const & p)
+{
+    if (!_queue->push(p)) {
+        return false;
+    }
+    _cond.notify_one();
+    return true;
+}
+
+
+void Sender::send(Packet const & p)
+{
+    ::sendto(_fd, p.data, p.size, 0,
+             reinterpret_cast<sockaddr const *>(&p.addr), sizeof(p.addr));
+}
+
+
+void Sender::sender_thread()
+{
+    for (;;)
+    {
+        Packet p;
+        while (_queue->pop(p)) {
+            send(p);
+        }
+
+        boost::mutex::scoped_lock lock(_mutex);
+
+        if (_quit) {
+            return;
+        }
+        if (_queue->empty()) {
+            // the realtime threads don't lock the mutex, so don't wait
+            // forever in case a notification was missed
+            _cond.timed_wait(lock, boost::posix_time::milliseconds(
+                                        config::OSC_SENDER_INTERVAL));
+        }
+    }
+}
+
+
+void send(std::string const & host, int port, std::string const & path,
+          bp::object args)
+{
+    ArgumentVector v = make_arguments(args);
+
+    Packet p;
+    p.addr = resolve(host, port);
+
+    Writer w(p.data, sizeof(p.data));
+    w.string(path);
+    w.string(type_tags(v));
+
+    for (ArgumentVector::const_iterator it = v.begin(); it != v.end(); ++it) {
+        switch (it->type) {
+          case 'i': w.int32(it->i); break;
+          case 'f': w.float32(it->f); break;
+          case 's': w.string(it->s); break;
+        }
+    }
+
+    if (!w.ok()) {
+        throw std::runtime_error("OSC message too long");
+    }
+    p.size = w.size();
+
+    das::python::scoped_gil_release release;
+    Sender::get()->send(p);
+}
+
+
+
+Server::Server(Engine & engine, int port, int data_offset,
+               bp::object callback)
+  : _engine(engine)
+  , _data_offset(data_offset)
+  , _callback(callback)
+  , _quit(false)
+{
+    _fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd == -1) {
+        throw std::runtime_error("can't create OSC socket");
+    }
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (::bind(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        ::close(_fd);
+        std::ostringstream os;
+        os << "can't bind OSC server to port " << port;
+        throw std::runtime_error(os.str());
+    }
+
+    _thread.reset(new boost::thread(
+                        boost::bind(&Server::server_thread, this)));
+}
+
+
+Server::~Server()
+{
+    _quit = true;
+
+    {
+        // the server thread may be waiting for the GIL
+        das::python::scoped_gil_release release;
+        _thread->join();
+    }
+
+    ::close(_fd);
+}
+
+
+void Server::server_thread()
+{
+    char buf[config::OSC_MAX_PACKET_SIZE];
+
+    while (!_quit)
+    {
+        pollfd pfd = { _fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, config::OSC_SERVER_POLL_INTERVAL) <= 0) {
+            continue;
+        }
+
+        ssize_t size = ::recv(_fd, buf, sizeof(buf), 0);
+        if (size > 0) {
+            handle_message(buf, size);
+        }
+    }
+}
+
+
+void Server::handle_message(char const *data, std::size_t size)
+{
+    static char const bundle[] = "#bundle";
+
+    if (size >= 16 && std::memcmp(data, bundle, sizeof(bundle)) == 0) {
+        // skip bundle header and time tag, handle each element
+        std::size_t pos = 16;
+        while (pos + 4 <= size) {
+            int32_t n;
+            Reader(data + pos, 4).int32(n);
+            pos += 4;
+            if (n < 0 || pos + n > size) {
+                return;
+            }
+            handle_message(data + pos, n);
+            pos += n;
+        }
+        return;
+    }
+
+    Reader r(data, size);
+    std::string path, types;
+
+    if (!r.string(path) || !r.string(types) || types.empty() ||
+            types[0] != ',') {
+        return;
+    }
+    types.erase(0, 1);
+
+    std::vector<int32_t> ints;
+    if (types.find_first_not_of('i') == std::string::npos) {
+        int32_t i;
+        while (ints.size() != types.size() && r.int32(i)) {
+            ints.push_back(i);
+        }
+        if (ints.size() == types.size() && handle_native(path, types, ints)) {
+            return;
+        }
+    }
+
+    // pass everything else to python
+    Reader r2(data, size);
+    r2.string(path);
+    r2.string(types);
+    types.erase(0, 1);
+
+    das::python::scoped_gil_lock gil;
+
+    try {
+        bp::list args;
+        for (std::string::const_iterator it = types.begin();
+                it != types.end(); ++it) {
+            int32_t i;
+            float f;
+            std::string s;
+            if (*it == 'i' && r2.int32(i)) {
+                args.append(i);
+            } else if (*it == 'f' && r2.float32(f)) {
+                args.append(f);
+            } else if (*it == 's' && r2.string(s)) {
+                args.append(s);
+            } else {
+                // unsupported or malformed argument
+                return;
+            }
+        }
+
+        _callback(path, types, args);
+    }
+    catch (bp::error_already_set &) {
+        PyErr_Print();
+    }
+}
+
+
+bool Server::handle_native(std::string const & path, std::string const & types,
+                           std::vector<int32_t> const & ints)
+try
+{
+    if (path == "/mididings/switch_scene" && types == "i") {
+        _engine.queue_switch_scene(ints[0] - _data_offset, -1);
+    }
+    else if (path == "/mididings/switch_scene" && types == "ii") {
+        _engine.queue_switch_scene(ints[0] - _data_offset,
+                                   ints[1] - _data_offset);
+    }
+    else if (path == "/mididings/switch_subscene" && types == "i") {
+        _engine.queue_switch_scene(-1, ints[0] - _data_offset);
+    }
+    else if (path == "/mididings/prev_scene" && types.empty()) {
+        _engine.queue_step_scene(-1, 0, false);
+    }
+    else if (path == "/mididings/next_scene" && types.empty()) {
+        _engine.queue_step_scene(1, 0, false);
+    }
+    else if (path == "/mididings/prev_subscene" && types.size() <= 1) {
+        _engine.queue_step_scene(0, -1, !ints.empty() && ints[0]);
+    }
+    else if (path == "/mididings/next_subscene" && types.size() <= 1) {
+        _engine.queue_step_scene(0, 1, !ints.empty() && ints[0]);
+    }
+    else if (path == "/mididings/panic" && types.empty()) {
+        _engine.queue_panic();
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+catch (std::runtime_error const &)
+{
+    // engine command queue is full, drop the message
+    return true;
+}
+
+
+} // osc
+} // mididings
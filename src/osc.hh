@@ -0,0 +1,202 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_OSC_HH
+#define MIDIDINGS_OSC_HH
+
+#include "config.hh"
+
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/python/object.hpp>
+
+#include "util/mpsc_queue.hh"
+
+
+namespace mididings {
+
+class Engine;
+
+namespace osc {
+
+
+/*
+ * a single OSC message argument. integer arguments may instead refer to an
+ * event attribute (see units::get_parameter()), optionally with the data
+ * offset added.
+ */
+struct Argument
+{
+    char type;          // 'i', 'f' or 's'
+    int32_t i;
+    float f;
+    std::string s;
+    bool attribute;     // i is an event attribute, not a literal value
+    bool offset;
+};
+
+typedef std::vector<Argument> ArgumentVector;
+
+// convert a python sequence of (tag, value) tuples to OSC arguments.
+// tags are 'i', 'f', 's', or 'a' for event attributes ('o' to add the data
+// offset)
+ArgumentVector make_arguments(boost::python::object args);
+
+// type tag string for the given arguments, including the leading comma
+std::string type_tags(ArgumentVector const & args);
+
+// look up the address of the given host (an empty string meaning
+// localhost). throws std::runtime_error on failure
+sockaddr_in resolve(std::string const & host, int port);
+
+
+/*
+ * builds an OSC message in a fixed-size buffer, without allocating any
+ * memory.
+ */
+class Writer
+{
+  public:
+    Writer(char *data, std::size_t size)
+      : _data(data), _size(size), _pos(0), _ok(true)
+    { }
+
+    void string(char const *s, std::size_t len);
+    void string(std::string const & s) { string(s.data(), s.size()); }
+    void int32(int32_t i);
+    void float32(float f);
+
+    // false if the message didn't fit into the buffer
+    bool ok() const { return _ok; }
+    std::size_t size() const { return _pos; }
+
+  private:
+    bool reserve(std::size_t n);
+
+    char *_data;
+    std::size_t _size;
+    std::size_t _pos;
+    bool _ok;
+};
+
+
+/*
+ * reads the contents of an OSC message.
+ */
+class Reader
+{
+  public:
+    Reader(char const *data, std::size_t size)
+      : _data(data), _size(size), _pos(0)
+    { }
+
+    bool string(std::string & s);
+    bool int32(int32_t & i);
+    bool float32(float & f);
+
+  private:
+    char const *_data;
+    std::size_t _size;
+    std::size_t _pos;
+};
+
+
+struct Packet
+{
+    sockaddr_in addr;
+    std::size_t size;
+    char data[config::OSC_MAX_PACKET_SIZE];
+};
+
+
+/*
+ * sends OSC packets from a separate thread, so that packets can be queued
+ * from the realtime thread. shared by all units sending OSC messages.
+ */
+class Sender
+  : boost::noncopyable
+{
+  public:
+    static boost::shared_ptr<Sender> get();
+
+    ~Sender();
+
+    // queue a packet to be sent. may be called from any thread, including
+    // the realtime threads of several engines at once
+    bool queue(Packet const & p);
+
+    // send a packet right away
+    void send(Packet const & p);
+
+  private:
+    Sender();
+
+    void sender_thread();
+
+    int _fd;
+    boost::scoped_ptr<das::mpsc_queue<Packet> > _queue;
+    boost::scoped_ptr<boost::thread> _thread;
+    boost::mutex _mutex;
+    boost::condition _cond;
+    volatile bool _quit;
+};
+
+
+// encode and send a single OSC message right away
+void send(std::string const & host, int port, std::string const & path,
+          boost::python::object args);
+
+
+/*
+ * receives OSC messages on a UDP port, in a thread of its own.
+ * scene switching and panic messages are passed directly to the engine.
+ * all other messages are passed to a python callback.
+ */
+class Server
+  : boost::noncopyable
+{
+  public:
+    // the callback is called as callback(path, types, args)
+    Server(Engine & engine, int port, int data_offset,
+           boost::python::object callback);
+    ~Server();
+
+  private:
+    void server_thread();
+    void handle_message(char const *data, std::size_t size);
+    // returns false if the message should be passed to python
+    bool handle_native(std::string const & path, std::string const & types,
+                       std::vector<int32_t> const & ints);
+
+    Engine & _engine;
+    int _fd;
+    int _data_offset;
+    boost::python::object _callback;
+
+    boost::scoped_ptr<boost::thread> _thread;
+    volatile bool _quit;
+};
+
+
+} // osc
+} // mididings
+
+
+#endif // MIDIDINGS_OSC_HH
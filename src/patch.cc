@@ -23,9 +23,90 @@
 namespace mididings {
 
 
+MidiEventType Patch::chain_types(ModuleVector const & modules)
+{
+    // events pass through the chain unchanged unless any of its modules
+    // acts on them
+    MidiEventType types = MIDI_EVENT_NONE;
+    for (ModuleVector::const_iterator module = modules.begin();
+            module != modules.end(); ++module) {
+        types |= (*module)->types();
+    }
+    return types;
+}
+
+
+MidiEventType Patch::fork_types(ModuleVector const & modules,
+                                bool remove_duplicates)
+{
+    // unless there's exactly one copy of each event in the output, the fork
+    // itself affects all events
+    if (modules.size() != 1 && !(remove_duplicates && !modules.empty())) {
+        return MIDI_EVENT_ANY;
+    }
+    return chain_types(modules);
+}
+
+
+template <typename IterT>
+MidiEventType Patch::range_types(IterT begin, IterT end)
+{
+    MidiEventType types = MIDI_EVENT_NONE;
+    for (IterT it = begin; it != end; ++it) {
+        types |= it->type;
+    }
+    return types;
+}
+
+
+bool Patch::all_deterministic(ModuleVector const & modules)
+{
+    for (ModuleVector::const_iterator module = modules.begin();
+            module != modules.end(); ++module) {
+        if (!(*module)->deterministic()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+std::size_t Patch::event_node_size()
+{
+    // the list node type is an implementation detail, but it's what the
+    // list rebinds its allocator to
+    std::size_t size = 0;
+    std::list<MidiEvent, node_size_probe<MidiEvent> > probe(
+                                        (node_size_probe<MidiEvent>(size)));
+    probe.push_back(MidiEvent());
+    ASSERT(size >= sizeof(MidiEvent));
+    return size;
+}
+
+
+Patch::Single::Single(UnitPtr const & unit)
+  // simple units only ever look at the event they're given
+  : ModuleImpl<Single>(unit->affected_types(), true)
+  , _unit(unit)
+{
+}
+
+
+Patch::Extended::Extended(UnitExPtr const & unit)
+  : ModuleImpl<Extended>(unit->affected_types(), unit->deterministic())
+  , _unit(unit)
+{
+}
+
+
 template <typename B>
 void Patch::Chain::process(B & buf, typename B::Range & range) const
 {
+    if (!(range_types(range.begin(), range.end()) & types())) {
+        // none of the modules in this chain would do anything
+        return;
+    }
+
     DEBUG_PRINT(Patch::debug_range("Chain in", buf, range));
 
     // iterate over all modules in this chain
@@ -48,6 +129,11 @@ void Patch::Chain::process(B & buf, typename B::Range & range) const
 template <typename B>
 void Patch::Fork::process(B & buffer, typename B::Range & range) const
 {
+    if (!(range_types(range.begin(), range.end()) & types())) {
+        // all events would come out unchanged
+        return;
+    }
+
     DEBUG_PRINT(Patch::debug_range("Fork in", buffer, range));
 
     // make a copy of all incoming events, allocated on the stack
@@ -127,8 +213,8 @@ void Patch::Single::process(B & buffer, typename B::Range & range) const
     // iterate over all events in the input range
     for (typename B::Iterator it = range.begin(); it != range.end(); )
     {
-        // process event
-        if (_unit->process(*it)) {
+        // process event, unless the unit leaves it unchanged anyway
+        if (!(it->type & types()) || _unit->process(*it)) {
             // keep this event, continue with next one
             ++it;
         } else {
@@ -159,8 +245,10 @@ void Patch::Extended::process(B & buffer, typename B::Range & range) const
     // iterate over all events in the input range
     for (typename B::Iterator it = in_range.begin(); it != in_range.end(); )
     {
-        // process event
-        typename B::Range ret_range = _unit->process(buffer, it);
+        // process event, unless the unit leaves it unchanged anyway
+        typename B::Range ret_range = (it->type & types())
+                                        ? _unit->process(buffer, it)
+                                        : Patch::keep_event(buffer, it);
 
         if (range.empty() && !ret_range.empty()) {
             // the first event returned marks the beginning of our output range
@@ -46,7 +46,7 @@ class Patch
 
     typedef std::list<
         MidiEvent,
-        curious_alloc<MidiEvent, config::MAX_EVENTS>
+        curious_alloc<MidiEvent>
     > EventListRT;
 
     typedef std::list<MidiEvent> EventList;
@@ -61,8 +61,11 @@ class Patch
         typedef typename T::iterator Iterator;
         typedef das::iterator_range<typename T::iterator> Range;
 
-        EventBufferType(Engine & engine)
-          : _engine(engine)
+        EventBufferType(Engine & engine,
+                        typename T::allocator_type const & alloc
+                            = typename T::allocator_type())
+          : T(alloc)
+          , _engine(engine)
         { }
 
         Engine & engine() const {
@@ -78,10 +81,16 @@ class Patch
 
     /**
      * The buffer type for RT-safe event processing, using a std::list with
-     * custom allocator.
+     * custom allocator. The memory pool is passed to the constructor.
      */
     typedef EventBufferType<EventListRT> EventBufferRT;
 
+    /**
+     * The size of a pool element needed for each event in an EventBufferRT,
+     * i.e. the size of a list node.
+     */
+    static std::size_t event_node_size();
+
     /**
      * Basically a regular std::list with some handy typedefs.
      */
@@ -100,13 +109,35 @@ class Patch
       , das::counted_objects<Module>
     {
       public:
-        Module() { }
+        Module(MidiEventType types, bool deterministic)
+          : _types(types)
+          , _deterministic(deterministic)
+        { }
         virtual ~Module() { }
 
         virtual void process(EventBufferRT & buffer,
                              EventBufferRT::Range & range) const = 0;
         virtual void process(EventBuffer & buffer,
                              EventBuffer::Range & range) const = 0;
+
+        /**
+         * The event types this module may modify, remove or replace.
+         * events of all other types are guaranteed to pass unchanged.
+         */
+        MidiEventType types() const {
+            return _types;
+        }
+
+        /**
+         * True if the module's output depends on nothing but its input.
+         */
+        bool deterministic() const {
+            return _deterministic;
+        }
+
+      private:
+        MidiEventType const _types;
+        bool const _deterministic;
     };
 
     typedef boost::shared_ptr<Module> ModulePtr;
@@ -124,6 +155,10 @@ class Patch
       : public Module
     {
       public:
+        ModuleImpl(MidiEventType types, bool deterministic)
+          : Module(types, deterministic)
+        { }
+
         virtual void process(EventBufferRT & buffer,
                              EventBufferRT::Range & range) const {
             Derived const & d = *static_cast<Derived const*>(this);
@@ -148,7 +183,9 @@ class Patch
     {
       public:
         Chain(ModuleVector const & modules)
-          : _modules(modules)
+          : ModuleImpl<Chain>(chain_types(modules),
+                              all_deterministic(modules))
+          , _modules(modules)
         { }
 
         template <typename B>
@@ -167,7 +204,9 @@ class Patch
     {
       public:
         Fork(ModuleVector const & modules, bool remove_duplicates)
-          : _modules(modules)
+          : ModuleImpl<Fork>(fork_types(modules, remove_duplicates),
+                             all_deterministic(modules))
+          , _modules(modules)
           , _remove_duplicates(remove_duplicates)
         { }
 
@@ -187,9 +226,7 @@ class Patch
       : public ModuleImpl<Single>
     {
       public:
-        Single(UnitPtr const & unit)
-          : _unit(unit)
-        { }
+        Single(UnitPtr const & unit);
 
         template <typename B>
         void process(B & buffer, typename B::Range & range) const;
@@ -206,9 +243,7 @@ class Patch
       : public ModuleImpl<Extended>
     {
       public:
-        Extended(UnitExPtr const & unit)
-          : _unit(unit)
-        { }
+        Extended(UnitExPtr const & unit);
 
         template <typename B>
         void process(B & buffer, typename B::Range & range) const;
@@ -229,6 +264,13 @@ class Patch
       : _module(module)
     { }
 
+    /**
+     * True if the patch always produces the same output for the same input.
+     */
+    bool deterministic() const {
+        return _module->deterministic();
+    }
+
     /**
      * Processes events.
      *
@@ -291,6 +333,14 @@ class Patch
 
   private:
 
+    static MidiEventType chain_types(ModuleVector const & modules);
+    static MidiEventType fork_types(ModuleVector const & modules,
+                                    bool remove_duplicates);
+    static bool all_deterministic(ModuleVector const & modules);
+
+    template <typename IterT>
+    static MidiEventType range_types(IterT begin, IterT end);
+
     template <typename B>
     static std::string debug_range(std::string const & str, B const & buffer,
                                    typename B::Range const & range);
@@ -0,0 +1,148 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "process_worker.hh"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <boost/python/object.hpp>
+#include <boost/python/ptr.hpp>
+
+#include "util/python.hh"
+
+namespace bp = boost::python;
+
+
+namespace mididings {
+
+
+ProcessWorker::ProcessWorker()
+  : _rb(config::MAX_PROCESS_CALLS)
+{
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        throw std::runtime_error("can't create pipe for worker process");
+    }
+    _read_fd = fds[0];
+    _write_fd = fds[1];
+
+    // never block the realtime thread
+    ::fcntl(_write_fd, F_SETFL, ::fcntl(_write_fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+ProcessWorker::~ProcessWorker()
+{
+    stop();
+    if (_read_fd != -1) {
+        ::close(_read_fd);
+    }
+}
+
+
+bool ProcessWorker::call(int function, MidiEvent const & ev)
+{
+    std::size_t sysex_size = ev.sysex ? ev.sysex->size() : 0;
+
+    if (_write_fd == -1 || sysex_size > config::PROCESS_CALL_MAX_SYSEX) {
+        return false;
+    }
+
+    CallInfo c;
+    c.function = function;
+    c.type = ev.type;
+    c.port = ev.port;
+    c.channel = ev.channel;
+    c.data1 = ev.data1;
+    c.data2 = ev.data2;
+    c.frame = ev.frame;
+    c.sysex_size = sysex_size;
+    if (sysex_size) {
+        std::copy(ev.sysex->begin(), ev.sysex->end(), c.sysex);
+    }
+
+    if (!_rb.write(c)) {
+        return false;
+    }
+
+    // if the pipe is full, the worker has plenty to do anyway
+    char b = 0;
+    ssize_t r = ::write(_write_fd, &b, 1);
+    (void)r;
+
+    return true;
+}
+
+
+void ProcessWorker::run(bp::object functions)
+{
+    // only the parent process writes to the pipe. closing our own copy
+    // ensures that read() returns once the parent is gone
+    if (_write_fd != -1) {
+        ::close(_write_fd);
+        _write_fd = -1;
+    }
+
+    for (;;)
+    {
+        char buf[64];
+        ssize_t r;
+        {
+            das::python::scoped_gil_release release;
+            r = ::read(_read_fd, buf, sizeof(buf));
+        }
+
+        if (r == 0 || (r < 0 && errno != EINTR)) {
+            // parent closed the pipe
+            return;
+        }
+
+        CallInfo c;
+        while (_rb.read(c)) {
+            MidiEvent ev;
+            ev.type = c.type;
+            ev.port = c.port;
+            ev.channel = c.channel;
+            ev.data1 = c.data1;
+            ev.data2 = c.data2;
+            ev.frame = c.frame;
+            if (c.type == MIDI_EVENT_SYSEX) {
+                ev.sysex.reset(new SysExData(c.sysex, c.sysex + c.sysex_size));
+            }
+
+            try {
+                // call python function
+                functions[c.function](bp::ptr(&ev));
+            }
+            catch (bp::error_already_set &) {
+                PyErr_Print();
+            }
+        }
+    }
+}
+
+
+void ProcessWorker::stop()
+{
+    if (_write_fd != -1) {
+        ::close(_write_fd);
+        _write_fd = -1;
+    }
+}
+
+
+} // mididings
@@ -0,0 +1,76 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_PROCESS_WORKER_HH
+#define MIDIDINGS_PROCESS_WORKER_HH
+
+#include "config.hh"
+#include "midi_event.hh"
+
+#include <boost/noncopyable.hpp>
+#include <boost/python/object_fwd.hpp>
+
+#include "util/shm_ringbuffer.hh"
+
+
+namespace mididings {
+
+
+/*
+ * passes python function calls to a separate worker process, so that they
+ * don't compete with the realtime thread for the GIL.
+ * the worker is created before forking, after which the parent process
+ * queues calls, and the child process runs them.
+ */
+class ProcessWorker
+  : boost::noncopyable
+{
+  public:
+    ProcessWorker();
+    ~ProcessWorker();
+
+    // queue a call of the function with the given index, and wake up the
+    // worker process. returns false if the call couldn't be queued
+    bool call(int function, MidiEvent const & ev);
+
+    // run in the child process: call functions[function](ev) for each
+    // queued call, until the parent process stops the worker or exits
+    void run(boost::python::object functions);
+
+    // make the child process return from run(). must not be called while
+    // call() may be running in another thread
+    void stop();
+
+  private:
+    struct CallInfo {
+        int function;
+        MidiEventType type;
+        int port;
+        int channel;
+        int data1;
+        int data2;
+        uint64_t frame;
+        std::size_t sysex_size;
+        unsigned char sysex[config::PROCESS_CALL_MAX_SYSEX];
+    };
+
+    das::shm_ringbuffer<CallInfo> _rb;
+
+    // pipe used to wake up the child process
+    int _read_fd;
+    int _write_fd;
+};
+
+
+} // mididings
+
+
+#endif // MIDIDINGS_PROCESS_WORKER_HH
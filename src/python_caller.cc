@@ -37,7 +37,14 @@ PythonCaller::PythonCaller(EngineCallback engine_callback)
   : _rb(new das::ringbuffer<AsyncCallInfo>(config::MAX_ASYNC_CALLS))
   , _engine_callback(engine_callback)
   , _quit(false)
+  , _sync_state(SYNC_IDLE)
+  , _sync_abandoned(false)
+  , _sync_fun(NULL)
+  , _sync_proxy(NULL)
+  , _gil_fallback(GIL_FALLBACK_PASS)
 {
+    _gil_timeouts = 0;
+
     // start async thread
 #if BOOST_VERSION >= 105000
     boost::thread::attributes attr;
@@ -59,15 +66,50 @@ PythonCaller::~PythonCaller()
     _quit = true;
     _cond.notify_one();
 
+    if (_sync_thread) {
+        {
+            boost::mutex::scoped_lock lock(_sync_mutex);
+            _sync_cond.notify_one();
+        }
+        _sync_thread->timed_join(
+            boost::posix_time::milliseconds(config::ASYNC_JOIN_TIMEOUT));
+    }
+
     _thread->timed_join(
         boost::posix_time::milliseconds(config::ASYNC_JOIN_TIMEOUT));
 }
 
 
+void PythonCaller::set_gil_timeout(double timeout, GilFallback fallback)
+{
+    _gil_timeout = boost::posix_time::microseconds(
+                        static_cast<int64_t>(timeout * 1000000.0));
+    _gil_fallback = fallback;
+
+    if (timeout > 0.0 && !_sync_thread) {
+        // start sync thread
+#if BOOST_VERSION >= 105000
+        boost::thread::attributes attr;
+        attr.set_stack_size(config::ASYNC_THREAD_STACK_SIZE);
+        _sync_thread.reset(new boost::thread(attr,
+                            boost::bind(&PythonCaller::sync_thread, this)));
+#else
+        _sync_thread.reset(new boost::thread(
+                            boost::bind(&PythonCaller::sync_thread, this)));
+#endif
+    }
+}
+
+
 template <typename B>
 typename B::Range PythonCaller::call_now(B & buffer, typename B::Iterator it,
                                          bp::object const & fun)
 {
+    if (use_sync_thread(buffer)) {
+        // don't wait for the GIL indefinitely
+        return call_sync(buffer, it, fun, NULL);
+    }
+
     das::python::scoped_gil_lock gil;
 
     try
@@ -103,11 +145,190 @@ typename B::Range PythonCaller::call_now(B & buffer, typename B::Iterator it,
 }
 
 
+template <typename B>
+typename B::Range PythonCaller::call_inplace(B & buffer,
+                typename B::Iterator it, bp::object const & fun,
+                bp::object const & proxy)
+{
+    if (use_sync_thread(buffer)) {
+        return call_sync(buffer, it, fun, &proxy);
+    }
+
+    das::python::scoped_gil_lock gil;
+
+    if (call_function_inplace(fun, proxy, *it)) {
+        return Patch::keep_event(buffer, it);
+    } else {
+        return Patch::delete_event(buffer, it);
+    }
+}
+
+
+bool PythonCaller::use_sync_thread(Patch::EventBufferRT const &) const
+{
+    return _sync_thread && !_gil_timeout.is_zero() &&
+           !das::python::gil_held();
+}
+
+
+bool PythonCaller::use_sync_thread(Patch::EventBuffer const &) const
+{
+    // offline processing has no deadline to meet
+    return false;
+}
+
+
+template <typename B>
+typename B::Range PythonCaller::call_sync(B & buffer, typename B::Iterator it,
+                                          bp::object const & fun,
+                                          bp::object const * proxy)
+{
+    boost::mutex::scoped_lock lock(_sync_mutex);
+
+    if (_sync_state != SYNC_IDLE) {
+        // still busy with a call that missed its deadline earlier
+        return gil_fallback(buffer, it, fun, proxy, false);
+    }
+
+    // pass function/event to sync thread
+    _sync_fun = &fun;
+    _sync_proxy = proxy;
+    _sync_ev = *it;
+    _sync_state = SYNC_PENDING;
+    _sync_cond.notify_one();
+
+    boost::system_time deadline = boost::get_system_time() + _gil_timeout;
+
+    while (_sync_state != SYNC_DONE) {
+        if (!_sync_done_cond.timed_wait(lock, deadline)) {
+            break;
+        }
+    }
+
+    if (_sync_state == SYNC_DONE) {
+        _sync_state = SYNC_IDLE;
+
+        // the result vector is left alone here, it's cleared by the sync
+        // thread
+        if (_sync_result.empty()) {
+            return Patch::delete_event(buffer, it);
+        }
+        else if (_sync_result.size() == 1) {
+            *it = _sync_result.front();
+            return Patch::keep_event(buffer, it);
+        }
+        else {
+            return Patch::replace_event(buffer, it, _sync_result.begin(),
+                                                    _sync_result.end());
+        }
+    }
+
+    // deadline expired. if the function hasn't been called yet, the sync
+    // thread will skip it. otherwise its result will be discarded
+    _sync_abandoned = true;
+    return gil_fallback(buffer, it, fun, proxy, _sync_state == SYNC_CALLING);
+}
+
+
+template <typename B>
+typename B::Range PythonCaller::gil_fallback(B & buffer,
+                typename B::Iterator it, bp::object const & fun,
+                bp::object const * proxy, bool running)
+{
+    // only ever written from the processing thread
+    _gil_timeouts = _gil_timeouts + 1;
+
+    switch (_gil_fallback) {
+      case GIL_FALLBACK_PASS:
+        return Patch::keep_event(buffer, it);
+      case GIL_FALLBACK_DROP:
+        return Patch::delete_event(buffer, it);
+      case GIL_FALLBACK_DEFER:
+      default:
+        if (running) {
+            // the function is already being called asynchronously
+            return Patch::delete_event(buffer, it);
+        } else {
+            AsyncCallInfo c = { &fun, proxy, *it };
+            VERIFY(_rb->write(c));
+            _cond.notify_one();
+            return Patch::delete_event(buffer, it);
+        }
+    }
+}
+
+
+void PythonCaller::call_function(bp::object const & fun, MidiEvent const & ev,
+                                 std::vector<MidiEvent> & result)
+{
+    try
+    {
+        bp::object ret = fun(ev);
+
+        if (ret.ptr() != Py_None) {
+            bp::list ret_list = bp::extract<bp::list>(ret);
+            bp::stl_input_iterator<MidiEvent> begin(ret_list), end;
+            result.assign(begin, end);
+        }
+    }
+    catch (bp::error_already_set const &)
+    {
+        PyErr_Print();
+        result.clear();
+    }
+}
+
+
+bp::object PythonCaller::new_proxy(bp::object const & proxy)
+{
+    bp::object p((MidiEvent()));
+    p.attr("__class__") = proxy.attr("__class__");
+    return p;
+}
+
+
+bool PythonCaller::call_function_inplace(bp::object const & fun,
+                                         bp::object const & proxy,
+                                         MidiEvent & ev)
+{
+    MidiEvent & proxy_ev = bp::extract<MidiEvent &>(proxy);
+    MidiEventType type = ev.type;
+    proxy_ev = ev;
+
+    try
+    {
+        bp::object ret = fun(proxy);
+
+        if (type == MIDI_EVENT_SYSEX || proxy_ev.type == MIDI_EVENT_SYSEX) {
+            // apply changes to the sysex data made from python
+            proxy.attr("_finalize")();
+        }
+
+        if (ret.ptr() == Py_False) {
+            return false;
+        }
+
+        ev = proxy_ev;
+        return true;
+    }
+    catch (bp::error_already_set const &)
+    {
+        PyErr_Print();
+        // the proxy is reused, so sysex data that was never applied must
+        // not show up in the next call
+        if (PyObject_DelAttrString(proxy.ptr(), "_sysex_tmp") == -1) {
+            PyErr_Clear();
+        }
+        return false;
+    }
+}
+
+
 template <typename B>
 typename B::Range PythonCaller::call_deferred(B & buffer,
                 typename B::Iterator it, bp::object const & fun, bool keep)
 {
-    AsyncCallInfo c = { &fun, *it };
+    AsyncCallInfo c = { &fun, NULL, *it };
 
     // queue function/event, notify async thread
     VERIFY(_rb->write(c));
@@ -121,6 +342,31 @@ typename B::Range PythonCaller::call_deferred(B & buffer,
 }
 
 
+template <typename B>
+typename B::Range PythonCaller::call_process(B & buffer,
+                typename B::Iterator it, int function, bp::object const & fun,
+                bool keep)
+{
+    if (!_process_worker) {
+        return call_deferred(buffer, it, fun, keep);
+    }
+
+    _process_worker->call(function, *it);
+
+    if (keep) {
+        return Patch::keep_event(buffer, it);
+    } else {
+        return Patch::delete_event(buffer, it);
+    }
+}
+
+
+void PythonCaller::notify()
+{
+    _cond.notify_one();
+}
+
+
 void PythonCaller::async_thread()
 {
     boost::mutex mutex;
@@ -134,12 +380,18 @@ void PythonCaller::async_thread()
             AsyncCallInfo c;
             _rb->read(c);
 
-            try {
-                // call python function
-                (*c.fun)(bp::ptr(&c.ev));
-            }
-            catch (bp::error_already_set &) {
-                PyErr_Print();
+            if (c.proxy) {
+                // the unit's own proxy may still be in use by a call that
+                // missed its deadline, or by the next synchronous call
+                call_function_inplace(*c.fun, new_proxy(*c.proxy), c.ev);
+            } else {
+                try {
+                    // call python function
+                    (*c.fun)(bp::ptr(&c.ev));
+                }
+                catch (bp::error_already_set &) {
+                    PyErr_Print();
+                }
             }
         }
         else if (_quit) {
@@ -158,6 +410,65 @@ void PythonCaller::async_thread()
 }
 
 
+void PythonCaller::sync_thread()
+{
+    boost::mutex::scoped_lock lock(_sync_mutex);
+
+    for (;;)
+    {
+        while (_sync_state != SYNC_PENDING && !_quit) {
+            _sync_cond.wait(lock);
+        }
+        if (_quit) {
+            return;
+        }
+
+        // never acquire the GIL while holding the mutex
+        lock.unlock();
+        das::python::scoped_gil_lock gil;
+        lock.lock();
+
+        if (_sync_abandoned || _quit) {
+            // the caller gave up before the GIL could be acquired
+            _sync_abandoned = false;
+            _sync_state = SYNC_IDLE;
+            continue;
+        }
+
+        _sync_state = SYNC_CALLING;
+        // the caller may give up and return as soon as the mutex is
+        // released, so take our own references to everything it passed
+        bp::object fun = *_sync_fun;
+        bool inplace = _sync_proxy != NULL;
+        // the call may be abandoned and still be running when the same
+        // unit's proxy is needed again, so it gets its own
+        bp::object proxy = inplace ? new_proxy(*_sync_proxy) : bp::object();
+        MidiEvent ev = _sync_ev;
+        lock.unlock();
+
+        std::vector<MidiEvent> result;
+        if (!inplace) {
+            call_function(fun, ev, result);
+        } else if (call_function_inplace(fun, proxy, ev)) {
+            result.push_back(ev);
+        }
+
+        lock.lock();
+
+        if (_sync_abandoned) {
+            _sync_abandoned = false;
+            _sync_state = SYNC_IDLE;
+        } else {
+            // the previous result is freed here rather than in the
+            // processing thread
+            _sync_result.swap(result);
+            _sync_state = SYNC_DONE;
+            _sync_done_cond.notify_one();
+        }
+    }
+}
+
+
 
 // force template instantiations
 template Patch::EventBufferRT::Range PythonCaller::call_now(
@@ -166,6 +477,20 @@ template Patch::EventBufferRT::Range PythonCaller::call_now(
 template Patch::EventBuffer::Range PythonCaller::call_now(
                         Patch::EventBuffer &, Patch::EventBuffer::Iterator,
                         boost::python::object const &);
+template Patch::EventBufferRT::Range PythonCaller::call_inplace(
+                        Patch::EventBufferRT &, Patch::EventBufferRT::Iterator,
+                        boost::python::object const &,
+                        boost::python::object const &);
+template Patch::EventBuffer::Range PythonCaller::call_inplace(
+                        Patch::EventBuffer &, Patch::EventBuffer::Iterator,
+                        boost::python::object const &,
+                        boost::python::object const &);
+template Patch::EventBufferRT::Range PythonCaller::call_process(
+                        Patch::EventBufferRT &, Patch::EventBufferRT::Iterator,
+                        int, boost::python::object const &, bool);
+template Patch::EventBuffer::Range PythonCaller::call_process(
+                        Patch::EventBuffer &, Patch::EventBuffer::Iterator,
+                        int, boost::python::object const &, bool);
 template Patch::EventBufferRT::Range PythonCaller::call_deferred(
                         Patch::EventBufferRT &, Patch::EventBufferRT::Iterator,
                         boost::python::object const &, bool);
@@ -14,13 +14,17 @@
 
 #include "midi_event.hh"
 #include "patch.hh"
+#include "process_worker.hh"
 
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <vector>
 
 #include <boost/python/object_fwd.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/noncopyable.hpp>
 
 #include "util/ringbuffer.hh"
@@ -29,6 +33,15 @@
 namespace mididings {
 
 
+// what to do with an event if the GIL can't be acquired in time for a
+// synchronous call
+enum GilFallback {
+    GIL_FALLBACK_PASS,
+    GIL_FALLBACK_DROP,
+    GIL_FALLBACK_DEFER
+};
+
+
 class PythonCaller
   : boost::noncopyable
 {
@@ -44,17 +57,90 @@ class PythonCaller
     typename B::Range call_now(B & buf, typename B::Iterator it,
                                boost::python::object const & fun);
 
+    // call python function immediately, passing it the given proxy event
+    // object instead of a new one. the function's return value decides only
+    // whether the (modified) event is kept. calls that aren't made directly
+    // from the processing thread get their own copy of the proxy
+    template <typename B>
+    typename B::Range call_inplace(B & buf, typename B::Iterator it,
+                                   boost::python::object const & fun,
+                                   boost::python::object const & proxy);
+
     // queue python function to be called asynchronously
     template <typename B>
     typename B::Range call_deferred(B & buf, typename B::Iterator it,
                                boost::python::object const & fun, bool keep);
 
+    // queue python function to be called in the worker process, or
+    // asynchronously in this process if there's no worker process
+    template <typename B>
+    typename B::Range call_process(B & buf, typename B::Iterator it,
+                               int function, boost::python::object const & fun,
+                               bool keep);
+
+    // wake up the async thread, making it call the engine callback
+    void notify();
+
+    // use the given worker process for call_process(). must be called while
+    // no events are being processed
+    void set_process_worker(boost::shared_ptr<ProcessWorker> worker) {
+        _process_worker = worker;
+    }
+    ProcessWorker * process_worker() const { return _process_worker.get(); }
+
+    // limit the time call_now() may wait for the GIL to the given number of
+    // seconds, or wait indefinitely if zero. must not be called while
+    // events are being processed
+    void set_gil_timeout(double timeout, GilFallback fallback);
+
+    // number of synchronous calls that missed their GIL deadline
+    std::size_t gil_timeouts() const { return _gil_timeouts; }
+
   private:
 
     void async_thread();
+    void sync_thread();
+
+    // true if a synchronous call needs to go through the sync thread,
+    // because it must not wait for the GIL past the deadline
+    bool use_sync_thread(Patch::EventBufferRT const & buf) const;
+    bool use_sync_thread(Patch::EventBuffer const & buf) const;
+
+    // hand the call over to the sync thread, waiting at most until the GIL
+    // deadline for it to complete
+    template <typename B>
+    typename B::Range call_sync(B & buf, typename B::Iterator it,
+                                boost::python::object const & fun,
+                                boost::python::object const * proxy);
+
+    // handle an event whose synchronous call missed its deadline. running
+    // indicates that the function is being called by the sync thread
+    template <typename B>
+    typename B::Range gil_fallback(B & buf, typename B::Iterator it,
+                                   boost::python::object const & fun,
+                                   boost::python::object const * proxy,
+                                   bool running);
+
+    // call python function, storing the returned events in result.
+    // the GIL must be held
+    static void call_function(boost::python::object const & fun,
+                              MidiEvent const & ev,
+                              std::vector<MidiEvent> & result);
+    // create a new proxy event object of the same type as the given one,
+    // for calls that may overlap with others using the unit's own proxy.
+    // the GIL must be held
+    static boost::python::object new_proxy(
+                                    boost::python::object const & proxy);
+    // call python function on the proxy event, then copy the proxy back to
+    // ev. returns false if the event is to be discarded. the GIL must be held
+    static bool call_function_inplace(boost::python::object const & fun,
+                                      boost::python::object const & proxy,
+                                      MidiEvent & ev);
 
     struct AsyncCallInfo {
         boost::python::object const * fun;
+        // the unit's proxy for in-place calls, only used as a template
+        boost::python::object const * proxy;
         MidiEvent ev;
     };
 
@@ -66,6 +152,33 @@ class PythonCaller
 
     boost::condition _cond;
     volatile bool _quit;
+
+    enum SyncState {
+        SYNC_IDLE,      // no call in progress
+        SYNC_PENDING,   // waiting for the sync thread to acquire the GIL
+        SYNC_CALLING,   // python function is being called
+        SYNC_DONE       // result is available
+    };
+
+    boost::scoped_ptr<boost::thread> _sync_thread;
+
+    boost::mutex _sync_mutex;
+    boost::condition _sync_cond;
+    boost::condition _sync_done_cond;
+
+    SyncState _sync_state;
+    // set when the caller has given up waiting for the current call
+    bool _sync_abandoned;
+    boost::python::object const * _sync_fun;
+    boost::python::object const * _sync_proxy;
+    MidiEvent _sync_ev;
+    std::vector<MidiEvent> _sync_result;
+
+    boost::shared_ptr<ProcessWorker> _process_worker;
+
+    boost::posix_time::time_duration _gil_timeout;
+    GilFallback _gil_fallback;
+    das::atomic_size_t _gil_timeouts;
 };
 
 
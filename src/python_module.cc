@@ -15,13 +15,15 @@
 #include "send_midi.hh"
 #include "midi_event.hh"
 #include "backend/base.hh"
+#include "backend/midi_parser.hh"
 #include "units/base.hh"
 #include "units/engine.hh"
 #include "units/filters.hh"
 #include "units/modifiers.hh"
 #include "units/generators.hh"
 #include "units/call.hh"
-#include "curious_alloc.hh"
+#include "units/timing.hh"
+#include "units/osc.hh"
 
 #include "util/python.hh"
 #include "util/python_sequence_converters.hh"
@@ -67,28 +69,9 @@ std::string alloc_stats(std::string const & name)
                               << std::setw(8) << allocated << " " << leaks;
 }
 
-template <typename T>
-std::string curious_alloc_stats(std::string const & name)
-{
-    return das::make_string() << std::left << std::setw(20) << (name + ": ")
-                              << std::setw(8)
-                              << curious_alloc_base<T>::max_utilization()
-                              << " "
-                              << curious_alloc_base<T>::fallback_count();
-}
-
 void unload()
 {
-#ifdef ENABLE_BENCHMARK
-    std::cerr << '\n'
-              << std::left << std::setw(20) << "number of cycles:"
-              << Engine::num_cycles() << '\n'
-              << std::left << std::setw(20) << "mean duration:"
-              << Engine::cycle_duration_mean() << " µs" << '\n'
-              << std::left << std::setw(20) << "max duration:"
-              << Engine::cycle_duration_max() << " µs" << std::endl;
-#endif
-
+    // allocator and benchmark statistics are printed by each engine
     std::cerr << '\n'
               << alloc_stats<Engine>("Engine") << '\n'
               << alloc_stats<Patch>("Patch") << '\n'
@@ -96,9 +79,7 @@ void unload()
               << alloc_stats<units::Unit>("units::Unit") << '\n'
               << alloc_stats<units::UnitEx>("units::UnitEx") << '\n'
               << alloc_stats<MidiEvent>("MidiEvent") << '\n'
-              << alloc_stats<SysExData>("SysExData") << '\n'
-              << curious_alloc_stats<MidiEvent>("MidiEvent alloc")
-              << std::endl;
+              << alloc_stats<SysExData>("SysExData") << std::endl;
 }
 
 #endif // ENABLE_DEBUG_STATS
@@ -113,9 +94,20 @@ class EngineWrap
       , _self(self)
     { }
 
+    ~EngineWrap()
+    {
+        // the python object is being destroyed. no callback must use it
+        // from now on, even one that's waiting for the GIL right now
+        _self = NULL;
+        shutdown();
+    }
+
     void scene_switch_callback(int scene, int subscene)
     {
         das::python::scoped_gil_lock gil;
+        if (!_self) {
+            return;
+        }
         try {
             boost::python::call_method<void>(_self,
                                 "scene_switch_callback", scene, subscene);
@@ -124,6 +116,33 @@ class EngineWrap
         }
     }
 
+    void scene_build_callback(int scene)
+    {
+        das::python::scoped_gil_lock gil;
+        if (!_self) {
+            return;
+        }
+        try {
+            boost::python::call_method<void>(_self,
+                                "scene_build_callback", scene);
+        } catch (boost::python::error_already_set &) {
+            PyErr_Print();
+        }
+    }
+
+    void finished_callback()
+    {
+        das::python::scoped_gil_lock gil;
+        if (!_self) {
+            return;
+        }
+        try {
+            boost::python::call_method<void>(_self, "finished_callback");
+        } catch (boost::python::error_already_set &) {
+            PyErr_Print();
+        }
+    }
+
   private:
     PyObject *_self;
 };
@@ -136,6 +155,42 @@ MidiEvent buffer_to_midi_event(std::vector<unsigned char> const & buffer,
                             &buffer.front(), buffer.size(), port, frame);
 }
 
+std::vector<MidiEvent> midi_parser_decode(
+        backend::MidiParser & parser,
+        std::vector<unsigned char> const & data,
+        uint64_t frame)
+{
+    std::vector<MidiEvent> events;
+    if (!data.empty()) {
+        parser.decode(&data.front(), data.size(), events, frame);
+    }
+    return events;
+}
+
+std::vector<unsigned char> midi_encoder_encode(
+        backend::MidiEncoder & encoder,
+        std::vector<MidiEvent> const & events)
+{
+    std::vector<unsigned char> buffer;
+    encoder.encode(events.begin(), events.end(), buffer);
+    return buffer;
+}
+
+// adding or removing a JACK port may have to wait for the process thread,
+// which in turn may be waiting for the GIL
+int backend_add_port(backend::BackendBase & backend,
+                     bool out, std::string const & name)
+{
+    das::python::scoped_gil_release gil;
+    return backend.add_port(out, name);
+}
+
+void backend_remove_port(backend::BackendBase & backend, bool out, int port)
+{
+    das::python::scoped_gil_release gil;
+    backend.remove_port(out, port);
+}
+
 boost::python::tuple midi_event_to_buffer(MidiEvent const & ev)
 {
     std::vector<unsigned char> buffer(256, 0);
@@ -177,6 +232,9 @@ BOOST_PYTHON_MODULE(_mididings)
     class_<backend::BackendBase, backend::BackendPtr, noncopyable>(
         "BackendBase", bp::no_init)
         .def("connect_ports", &backend::BackendBase::connect_ports)
+        .def("add_port", &backend_add_port)
+        .def("remove_port", &backend_remove_port)
+        .def("stats", &backend::BackendBase::stats)
     ;
 
     // backend creation
@@ -186,23 +244,60 @@ BOOST_PYTHON_MODULE(_mididings)
     def("buffer_to_midi_event", buffer_to_midi_event);
     def("midi_event_to_buffer", midi_event_to_buffer);
 
+    // incremental byte stream parser and encoder, with running status
+    class_<backend::MidiParser>("MidiParser", init<int>())
+        .def("decode", &midi_parser_decode)
+        .def("reset", &backend::MidiParser::reset)
+    ;
+    class_<backend::MidiEncoder>("MidiEncoder", init<>())
+        .def("encode", &midi_encoder_encode)
+        .def("reset", &backend::MidiEncoder::reset)
+    ;
+
 
     // simple MIDI send function, works with no engine running
     def("send_midi", &send_midi);
 
+    // OSC send function, also works with no engine running
+    def("send_osc", &osc::send);
+
+
+    // worker process for Call(process=...), created before forking
+    class_<ProcessWorker, boost::shared_ptr<ProcessWorker>, noncopyable>(
+        "ProcessWorker", init<>())
+        .def("run", &ProcessWorker::run)
+    ;
+
 
     // main engine class, derived from in python
     class_<Engine, EngineWrap, noncopyable>(
         "Engine", init<backend::BackendPtr, bool>())
         .def("add_scene", &Engine::add_scene)
+        .def("set_scene", &Engine::set_scene)
+        .def("unload_scene", &Engine::unload_scene)
         .def("set_processing", &Engine::set_processing)
+        .def("set_tick_interval", &Engine::set_tick_interval)
+        .def("set_bypass", &Engine::set_bypass)
+        .def("set_gil_timeout", &Engine::set_gil_timeout)
+        .def("gil_timeouts", &Engine::gil_timeouts)
+        .def("set_process_worker", &Engine::set_process_worker)
+        .def("stop_process_worker", &Engine::stop_process_worker)
+        .def("open_state_file", &Engine::open_state_file)
+        .def("restored_scene", &Engine::restored_scene)
+        .def("restored_subscene", &Engine::restored_subscene)
+        .def("start_osc_server", &Engine::start_osc_server)
+        .def("stop_osc_server", &Engine::stop_osc_server)
         .def("start", &Engine::start)
-        .def("switch_scene", &Engine::switch_scene)
+        .def("stop", &Engine::stop)
+        .def("switch_scene", &Engine::queue_switch_scene)
         .def("current_scene", &Engine::current_scene)
         .def("current_subscene", &Engine::current_subscene)
         .def("process_event", &Engine::process_event)
         .def("output_event", &Engine::output_event)
+        .def("inject_event", &Engine::inject_event)
         .def("time", &Engine::time)
+        .def("tempo", &Engine::tempo)
+        .def("song_position", &Engine::song_position)
     ;
 
 
@@ -212,7 +307,9 @@ BOOST_PYTHON_MODULE(_mididings)
             "Patch", init<Patch::ModulePtr>());
 
         class_<Patch::Module, noncopyable>(
-            "Module", bp::no_init);
+            "Module", bp::no_init)
+            .def("types", &Patch::Module::types)
+        ;
         class_<Patch::Chain, bases<Patch::Module>, noncopyable>(
             "Chain", init<Patch::ModuleVector>());
         class_<Patch::Fork, bases<Patch::Module>, noncopyable>(
@@ -249,6 +346,7 @@ BOOST_PYTHON_MODULE(_mididings)
         .value("SYSRT_RESET", MIDI_EVENT_SYSRT_RESET)
         .value("SYSRT", MIDI_EVENT_SYSRT)
         .value("SYSTEM", MIDI_EVENT_SYSTEM)
+        .value("TICK", MIDI_EVENT_TICK)
         .value("DUMMY", MIDI_EVENT_DUMMY)
         .value("ANY", MIDI_EVENT_ANY)
     ;
@@ -261,6 +359,7 @@ BOOST_PYTHON_MODULE(_mididings)
         .def_readwrite("data1", &MidiEvent::data1)
         .def_readwrite("data2", &MidiEvent::data2)
         .def_readwrite("sysex_", &MidiEvent::sysex)
+        .def_readwrite("frame", &MidiEvent::frame)
         .def(bp::self == bp::self)
         .def(bp::self != bp::self)
         .enable_pickling()
@@ -268,8 +367,12 @@ BOOST_PYTHON_MODULE(_mididings)
 
 
     // unit base classes
-    class_<Unit, noncopyable>("Unit", bp::no_init);
-    class_<UnitEx, noncopyable>("UnitEx", bp::no_init);
+    class_<Unit, noncopyable>("Unit", bp::no_init)
+        .def("affected_types", &Unit::affected_types)
+    ;
+    class_<UnitEx, noncopyable>("UnitEx", bp::no_init)
+        .def("affected_types", &UnitEx::affected_types)
+    ;
     class_<Filter, bases<Unit>, noncopyable>("Filter", bp::no_init);
 
     // base
@@ -338,6 +441,20 @@ BOOST_PYTHON_MODULE(_mididings)
     // call
     class_<Call, bases<UnitEx>, noncopyable>(
         "Call", init<bp::object, bool, bool>());
+    class_<CallProcess, bases<UnitEx>, noncopyable>(
+        "CallProcess", init<int, bp::object, bool>());
+    class_<CallInPlace, bases<UnitEx>, noncopyable>(
+        "CallInPlace", init<bp::object, bp::object>());
+
+    // timing
+    class_<Delay, bases<UnitEx>, noncopyable>(
+        "Delay", init<double, DelayMode>());
+    class_<ClockDivide, bases<UnitEx>, noncopyable>(
+        "ClockDivide", init<int>());
+
+    // osc
+    class_<SendOSC, bases<UnitEx>, noncopyable>(
+        "SendOSC", init<std::string, int, std::string, bp::object, int>());
 
 
     enum_<TransformMode>("TransformMode")
@@ -348,6 +465,18 @@ BOOST_PYTHON_MODULE(_mididings)
         .value("CURVE", TRANSFORM_MODE_CURVE)
     ;
 
+    enum_<DelayMode>("DelayMode")
+        .value("FRAMES", DELAY_MODE_FRAMES)
+        .value("SECONDS", DELAY_MODE_SECONDS)
+        .value("BEATS", DELAY_MODE_BEATS)
+    ;
+
+    enum_<GilFallback>("GilFallback")
+        .value("PASS", GIL_FALLBACK_PASS)
+        .value("DROP", GIL_FALLBACK_DROP)
+        .value("DEFER", GIL_FALLBACK_DEFER)
+    ;
+
     enum_<EventAttribute>("EventAttribute")
         .value("PORT", EVENT_ATTRIBUTE_PORT)
         .value("CHANNEL", EVENT_ATTRIBUTE_CHANNEL)
@@ -379,6 +508,7 @@ BOOST_PYTHON_MODULE(_mididings)
     das::python::to_bytearray_converter<SysExData, SysExDataConstPtr>();
 
     das::python::from_dict_converter<backend::PortConnectionMap>();
+    das::python::to_dict_converter<backend::BackendStats>();
 
 
 #ifdef ENABLE_DEBUG_STATS
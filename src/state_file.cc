@@ -0,0 +1,138 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.hh"
+#include "state_file.hh"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace mididings {
+
+
+namespace {
+    char const FILE_MAGIC[8] = "mdstate";
+    uint32_t const FILE_VERSION = 1;
+}
+
+
+StateFile::StateFile(std::string const & path)
+{
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd == -1) {
+        throw std::runtime_error("can't open state file '" + path + "'");
+    }
+
+    struct stat st;
+    bool valid_size = (::fstat(_fd, &st) == 0 &&
+                       st.st_size == static_cast<off_t>(sizeof(Layout)));
+
+    if (!valid_size && ::ftruncate(_fd, sizeof(Layout)) != 0) {
+        ::close(_fd);
+        throw std::runtime_error("can't resize state file '" + path + "'");
+    }
+
+    void *p = ::mmap(NULL, sizeof(Layout), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, _fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(_fd);
+        throw std::runtime_error("can't map state file '" + path + "'");
+    }
+    _layout = static_cast<Layout *>(p);
+
+    if (!valid_size ||
+            std::memcmp(_layout->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+            _layout->version != FILE_VERSION ||
+            _layout->size != sizeof(Layout)) {
+        // new file, or one written by an incompatible version
+        std::memset(_layout, 0, sizeof(Layout));
+        std::memcpy(_layout->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        _layout->version = FILE_VERSION;
+        _layout->size = sizeof(Layout);
+    }
+}
+
+
+StateFile::~StateFile()
+{
+    ::munmap(static_cast<void *>(_layout), sizeof(Layout));
+    ::close(_fd);
+}
+
+
+bool StateFile::read(StateSnapshot & s) const
+{
+    int n = current_slot();
+    if (n == -1) {
+        return false;
+    }
+    s = _layout->slots[n].state;
+    return true;
+}
+
+
+void StateFile::write(StateSnapshot const & s)
+{
+    int cur = current_slot();
+    uint32_t seq = cur != -1 ? _layout->slots[cur].seq : 0;
+
+    // overwrite the older slot, leaving the current one intact
+    Slot & slot = _layout->slots[cur == 0 ? 1 : 0];
+
+    slot.seq = 0;
+    __sync_synchronize();
+
+    slot.state = s;
+    slot.checksum = checksum(s);
+    __sync_synchronize();
+
+    // zero marks a slot as invalid, skip it when wrapping around
+    slot.seq = seq + 1 ? seq + 1 : 1;
+}
+
+
+int StateFile::current_slot() const
+{
+    int r = -1;
+    uint32_t seq = 0;
+
+    for (int n = 0; n != 2; ++n) {
+        Slot const & slot = _layout->slots[n];
+        if (slot.seq && slot.checksum == checksum(slot.state) &&
+                (r == -1 || static_cast<int32_t>(slot.seq - seq) > 0)) {
+            r = n;
+            seq = slot.seq;
+        }
+    }
+
+    return r;
+}
+
+
+uint32_t StateFile::checksum(StateSnapshot const & s)
+{
+    // FNV-1a
+    unsigned char const *p = reinterpret_cast<unsigned char const *>(&s);
+    uint32_t h = 2166136261u;
+    for (std::size_t n = 0; n != sizeof(s); ++n) {
+        h = (h ^ p[n]) * 16777619u;
+    }
+    return h;
+}
+
+
+} // mididings
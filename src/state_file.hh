@@ -0,0 +1,100 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_STATE_FILE_HH
+#define MIDIDINGS_STATE_FILE_HH
+
+#include "config.hh"
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+
+
+namespace mididings {
+
+
+/*
+ * a held note or sustain pedal, and the scene/subscene whose patch it was
+ * routed through.
+ */
+struct StateEntry
+{
+    uint32_t key;
+    int32_t scene;
+    int32_t subscene;
+};
+
+
+/*
+ * compact snapshot of the engine's state. plain old data only, so that it
+ * can be copied around in the realtime thread and stored in a file as is.
+ */
+struct StateSnapshot
+{
+    int32_t scene;
+    int32_t subscene;
+    uint32_t num_notes;
+    uint32_t num_sustains;
+    StateEntry notes[config::MAX_SIMULTANEOUS_NOTES];
+    StateEntry sustains[config::MAX_SUSTAIN_PEDALS];
+};
+
+
+/*
+ * memory-mapped file holding the most recent state snapshot.
+ * the file contains two slots which are written alternately, so that the
+ * previous snapshot remains intact if the process dies while writing a new
+ * one.
+ */
+class StateFile
+  : boost::noncopyable
+{
+  public:
+    // open or create the file. throws std::runtime_error on failure
+    StateFile(std::string const & path);
+    ~StateFile();
+
+    // read the most recent complete snapshot. returns false if there is none
+    bool read(StateSnapshot & s) const;
+
+    // store a new snapshot
+    void write(StateSnapshot const & s);
+
+  private:
+    struct Slot {
+        uint32_t seq;       // zero while the slot is being written
+        uint32_t checksum;
+        StateSnapshot state;
+    };
+
+    struct Layout {
+        char magic[8];
+        uint32_t version;
+        uint32_t size;
+        Slot slots[2];
+    };
+
+    static uint32_t checksum(StateSnapshot const & s);
+
+    // index of the slot holding the most recent snapshot, or -1
+    int current_slot() const;
+
+    int _fd;
+    Layout *_layout;
+};
+
+
+} // mididings
+
+
+#endif // MIDIDINGS_STATE_FILE_HH
@@ -34,6 +34,12 @@ class Unit
     virtual ~Unit() { }
 
     virtual bool process(MidiEvent & ev) const = 0;
+
+    // the event types this unit may modify or remove. events of all other
+    // types must be returned unchanged
+    virtual MidiEventType affected_types() const {
+        return MIDI_EVENT_ANY;
+    }
 };
 
 
@@ -51,6 +57,18 @@ class UnitEx
     virtual Patch::EventBuffer::Range
     process(Patch::EventBuffer & buffer,
             Patch::EventBuffer::Iterator it) const = 0;
+
+    // the event types this unit may modify, remove or replace. events of
+    // all other types must be returned unchanged
+    virtual MidiEventType affected_types() const {
+        return MIDI_EVENT_ANY;
+    }
+
+    // true if the unit's output depends only on its input event, and it
+    // has no side effects
+    virtual bool deterministic() const {
+        return false;
+    }
 };
 
 
@@ -91,6 +109,16 @@ class Filter
       , _pass_other(pass_other)
     { }
 
+    virtual MidiEventType affected_types() const
+    {
+        // if other events are discarded, the filter affects everything
+        if (pass_other()) {
+            return types();
+        } else {
+            return MIDI_EVENT_ANY;
+        }
+    }
+
   protected:
     virtual bool process(MidiEvent & ev) const
     {
@@ -129,6 +157,15 @@ class InvertedFilter
       , _negate(negate)
     { }
 
+    virtual MidiEventType affected_types() const
+    {
+        if (!_negate && _filter->pass_other()) {
+            return _filter->types();
+        } else {
+            return MIDI_EVENT_ANY;
+        }
+    }
+
     virtual bool process_filter(MidiEvent & ev) const
     {
         if (_negate) {
@@ -157,6 +194,12 @@ class TypeFilter
       , _types(types)
     { }
 
+    virtual MidiEventType affected_types() const
+    {
+        // events of the selected types always pass unchanged
+        return MIDI_EVENT_ANY & ~_types;
+    }
+
     virtual bool process_filter(MidiEvent & ev) const
     {
         return (ev.type & _types);
@@ -179,6 +222,11 @@ class Pass
         return _pass;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return _pass ? MIDI_EVENT_NONE : MIDI_EVENT_ANY;
+    }
+
   private:
     bool const _pass;
 };
@@ -50,6 +50,54 @@ class Call
 };
 
 
+class CallProcess
+  : public UnitExImpl<CallProcess>
+{
+  public:
+    CallProcess(int function, boost::python::object fun, bool cont)
+      : _function(function)
+      , _fun(fun)
+      , _cont(cont)
+    { }
+
+    template <typename B>
+    typename B::Range process(B & buffer, typename B::Iterator it) const
+    {
+        PythonCaller & c = buffer.engine().python_caller();
+        return c.call_process(buffer, it, _function, _fun, _cont);
+    }
+
+  private:
+    // index of the function in the worker process
+    int const _function;
+    boost::python::object const _fun;
+    bool const _cont;
+};
+
+
+class CallInPlace
+  : public UnitExImpl<CallInPlace>
+{
+  public:
+    CallInPlace(boost::python::object fun, boost::python::object proxy)
+      : _fun(fun)
+      , _proxy(proxy)
+    { }
+
+    template <typename B>
+    typename B::Range process(B & buffer, typename B::Iterator it) const
+    {
+        PythonCaller & c = buffer.engine().python_caller();
+        return c.call_inplace(buffer, it, _fun, _proxy);
+    }
+
+  private:
+    boost::python::object const _fun;
+    // event object passed to every call, modified in place
+    boost::python::object const _proxy;
+};
+
+
 } // units
 } // mididings
 
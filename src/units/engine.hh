@@ -28,6 +28,10 @@ class Sanitize
   public:
     Sanitize() { }
 
+    virtual bool deterministic() const {
+        return true;
+    }
+
     template <typename B>
     typename B::Range process(B & buffer, typename B::Iterator it) const
     {
@@ -48,7 +48,8 @@ class ChannelFilter
 {
   public:
     ChannelFilter(std::vector<int> const & channels)
-      : Filter(~(MIDI_EVENT_SYSTEM | MIDI_EVENT_DUMMY), false)
+      : Filter(~(MIDI_EVENT_SYSTEM | MIDI_EVENT_TICK | MIDI_EVENT_DUMMY),
+               false)
       , _channels(channels)
     { }
 
@@ -51,12 +51,19 @@ class Channel
 
     virtual bool process(MidiEvent & ev) const
     {
-        if (!(ev.type & (MIDI_EVENT_SYSTEM | MIDI_EVENT_DUMMY))) {
+        if (!(ev.type & (MIDI_EVENT_SYSTEM | MIDI_EVENT_TICK |
+                         MIDI_EVENT_DUMMY))) {
             ev.channel = _channel;
         }
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_ANY &
+               ~(MIDI_EVENT_SYSTEM | MIDI_EVENT_TICK | MIDI_EVENT_DUMMY);
+    }
+
   private:
     int const _channel;
 };
@@ -78,6 +85,11 @@ class Transpose
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_NOTE | MIDI_EVENT_POLY_AFTERTOUCH;
+    }
+
   private:
     int const _offset;
 };
@@ -99,6 +111,11 @@ class Key
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_NOTE | MIDI_EVENT_POLY_AFTERTOUCH;
+    }
+
   private:
     int const _note;
 };
@@ -122,6 +139,11 @@ class Velocity
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_NOTEON;
+    }
+
   private:
     float const _param;
     TransformMode const _mode;
@@ -161,6 +183,11 @@ class VelocitySlope
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_NOTEON;
+    }
+
   private:
     std::vector<int> const _notes;
     std::vector<float> const _params;
@@ -185,6 +212,11 @@ class CtrlMap
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_CTRL;
+    }
+
   private:
     int const _ctrl_in;
     int const _ctrl_out;
@@ -214,6 +246,11 @@ class CtrlRange
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_CTRL;
+    }
+
   private:
     int const _ctrl;
     int const _min;
@@ -241,6 +278,11 @@ class CtrlCurve
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_CTRL;
+    }
+
   private:
     int const _ctrl;
     float const _param;
@@ -271,6 +313,11 @@ class PitchbendRange
         return true;
     }
 
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_PITCHBEND;
+    }
+
   private:
     int const _min;
     int const _max;
@@ -0,0 +1,97 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_UNITS_OSC_HH
+#define MIDIDINGS_UNITS_OSC_HH
+
+#include "units/base.hh"
+#include "units/util.hh"
+#include "osc.hh"
+#include "patch.hh"
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/python/object_fwd.hpp>
+
+
+namespace mididings {
+namespace units {
+
+
+class SendOSC
+  : public UnitExImpl<SendOSC>
+{
+  public:
+    SendOSC(std::string const & host, int port, std::string const & path,
+            boost::python::object args, int data_offset)
+      : _addr(osc::resolve(host, port))
+      , _path(path)
+      , _args(osc::make_arguments(args))
+      , _types(osc::type_tags(_args))
+      , _data_offset(data_offset)
+      , _sender(osc::Sender::get())
+    { }
+
+    template <typename B>
+    typename B::Range process(B & buffer, typename B::Iterator it) const
+    {
+        osc::Packet p;
+        p.addr = _addr;
+
+        osc::Writer w(p.data, sizeof(p.data));
+        w.string(_path);
+        w.string(_types);
+
+        for (osc::ArgumentVector::const_iterator a = _args.begin();
+                a != _args.end(); ++a) {
+            switch (a->type) {
+              case 'i':
+                if (a->attribute) {
+                    w.int32(get_parameter(a->i, *it) +
+                            (a->offset ? _data_offset : 0));
+                } else {
+                    w.int32(a->i);
+                }
+                break;
+              case 'f':
+                w.float32(a->f);
+                break;
+              case 's':
+                w.string(a->s);
+                break;
+            }
+        }
+
+        if (w.ok()) {
+            p.size = w.size();
+            // packets are dropped if the queue is full
+            _sender->queue(p);
+        }
+
+        return Patch::delete_event(buffer, it);
+    }
+
+  private:
+    sockaddr_in const _addr;
+    std::string const _path;
+    osc::ArgumentVector const _args;
+    std::string const _types;
+    int const _data_offset;
+    boost::shared_ptr<osc::Sender> _sender;
+};
+
+
+} // units
+} // mididings
+
+
+#endif // MIDIDINGS_UNITS_OSC_HH
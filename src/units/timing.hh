@@ -0,0 +1,116 @@
+/*
+ * mididings
+ *
+ * Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIDINGS_UNITS_TIMING_HH
+#define MIDIDINGS_UNITS_TIMING_HH
+
+#include "units/base.hh"
+#include "engine.hh"
+#include "patch.hh"
+
+
+namespace mididings {
+namespace units {
+
+
+enum DelayMode {
+    DELAY_MODE_FRAMES = 1,
+    DELAY_MODE_SECONDS = 2,
+    DELAY_MODE_BEATS = 3,
+};
+
+
+class Delay
+  : public UnitExImpl<Delay>
+{
+  public:
+    Delay(double delay, DelayMode mode)
+      : _delay(delay)
+      , _mode(mode)
+    { }
+
+    virtual bool deterministic() const {
+        // the tempo may change at any time
+        return _mode != DELAY_MODE_BEATS;
+    }
+
+    template <typename B>
+    typename B::Range process(B & buffer, typename B::Iterator it) const
+    {
+        Engine & engine = buffer.engine();
+        uint64_t frames;
+
+        if (_mode == DELAY_MODE_SECONDS) {
+            frames = static_cast<uint64_t>(
+                        _delay * engine.samplerate() + 0.5);
+        } else if (_mode == DELAY_MODE_BEATS) {
+            double tempo = engine.tempo();
+            if (tempo == 0.0) {
+                tempo = config::CLOCK_DEFAULT_TEMPO;
+            }
+            frames = static_cast<uint64_t>(
+                        _delay * 60.0 / tempo * engine.samplerate() + 0.5);
+        } else {
+            frames = static_cast<uint64_t>(_delay);
+        }
+
+        // the backend will hold back the event until its frame is reached
+        it->frame += frames;
+
+        return Patch::keep_event(buffer, it);
+    }
+
+  private:
+    double const _delay;
+    DelayMode const _mode;
+};
+
+
+class ClockDivide
+  : public UnitExImpl<ClockDivide>
+{
+  public:
+    ClockDivide(int divisor)
+      : _divisor(divisor)
+    { }
+
+    template <typename B>
+    typename B::Range process(B & buffer, typename B::Iterator it) const
+    {
+        if (it->type != MIDI_EVENT_SYSRT_CLOCK) {
+            return Patch::keep_event(buffer, it);
+        }
+
+        // the engine has already counted the current clock
+        std::size_t position = buffer.engine().clock_tracker().position();
+
+        if (position && (position - 1) % _divisor == 0) {
+            return Patch::keep_event(buffer, it);
+        } else {
+            return Patch::delete_event(buffer, it);
+        }
+    }
+
+    virtual MidiEventType affected_types() const
+    {
+        return MIDI_EVENT_SYSRT_CLOCK;
+    }
+
+  private:
+    int const _divisor;
+};
+
+
+} // units
+} // mididings
+
+
+#endif // MIDIDINGS_UNITS_TIMING_HH
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2009-2012  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DAS_UTIL_MPSC_QUEUE_HH
+#define DAS_UTIL_MPSC_QUEUE_HH
+
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+    #include <atomic>
+#else
+    #include <glib.h>
+#endif
+
+
+namespace das {
+
+
+namespace detail {
+
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+    typedef std::size_t mpsc_index;
+
+    struct mpsc_atomic {
+        mpsc_index load() const {
+            return _value.load(std::memory_order_acquire);
+        }
+        void store(mpsc_index i) {
+            _value.store(i, std::memory_order_release);
+        }
+        bool compare_and_swap(mpsc_index expected, mpsc_index desired) {
+            return _value.compare_exchange_weak(expected, desired);
+        }
+      private:
+        std::atomic<std::size_t> _value;
+    };
+#else
+    typedef unsigned int mpsc_index;
+
+    /*
+     * a simple glib-based replacement for the bits of std::atomic needed
+     * here. indices wrap around at 2^32, which the queue handles just fine.
+     */
+    struct mpsc_atomic {
+        mpsc_index load() const {
+            return static_cast<mpsc_index>(g_atomic_int_get(&_value));
+        }
+        void store(mpsc_index i) {
+            g_atomic_int_set(&_value, static_cast<gint>(i));
+        }
+        bool compare_and_swap(mpsc_index expected, mpsc_index desired) {
+            return g_atomic_int_compare_and_exchange(&_value,
+                        static_cast<gint>(expected), static_cast<gint>(desired));
+        }
+      private:
+        mutable gint _value;
+    };
+#endif
+
+} // namespace detail
+
+
+/*
+ * bounded lock-free multi-producer/single-consumer queue, supports storing
+ * C++ objects. any number of threads may push items concurrently, while
+ * items must only be popped by one thread at a time.
+ * based on Dmitry Vyukov's bounded MPMC queue.
+ */
+template <typename T>
+class mpsc_queue : boost::noncopyable
+{
+  public:
+    // size is rounded up to the next power of two
+    mpsc_queue(std::size_t size)
+      : _size(round_up(size))
+      , _mask(_size - 1)
+      , _buf_array(new unsigned char[_size * sizeof(T)])
+      , _buf(reinterpret_cast<T*>(_buf_array))
+      , _seq(_size)
+    {
+        for (std::size_t n = 0; n != _size; ++n) {
+            _seq[n].store(n);
+        }
+        _push_idx.store(0);
+        _pop_idx = 0;
+    }
+
+    ~mpsc_queue() {
+        T item;
+        while (pop(item)) { }
+        delete[] _buf_array;
+    }
+
+    std::size_t capacity() const {
+        return _size;
+    }
+
+    // add an item to the queue. returns false if the queue is full.
+    bool push(T const & item) {
+        detail::mpsc_index pos = _push_idx.load();
+
+        for (;;) {
+            detail::mpsc_index seq = _seq[pos & _mask].load();
+            long diff = static_cast<long>(
+                            static_cast<signed_index>(seq - pos));
+
+            if (diff == 0) {
+                // slot is free, try to claim it
+                if (_push_idx.compare_and_swap(pos, pos + 1)) {
+                    break;
+                }
+                pos = _push_idx.load();
+            } else if (diff < 0) {
+                // slot still holds an item from the previous lap
+                return false;
+            } else {
+                // another thread claimed this slot first
+                pos = _push_idx.load();
+            }
+        }
+
+        new (static_cast<void*>(_buf + (pos & _mask))) T(item);
+        _seq[pos & _mask].store(pos + 1);
+        return true;
+    }
+
+    // remove the oldest item from the queue. returns false if the queue is
+    // empty, or the oldest item hasn't been completely written yet.
+    bool pop(T & dst) {
+        if (empty()) {
+            return false;
+        }
+
+        T *p = _buf + (_pop_idx & _mask);
+        dst = *p;
+        p->~T();
+        _seq[_pop_idx & _mask].store(_pop_idx + _mask + 1);
+        ++_pop_idx;
+        return true;
+    }
+
+    // returns true if there's no item ready to be popped.
+    // must only be called by the consumer.
+    bool empty() const {
+        return _seq[_pop_idx & _mask].load() != _pop_idx + 1;
+    }
+
+  private:
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+    typedef long signed_index;
+#else
+    typedef int signed_index;
+#endif
+
+    static std::size_t round_up(std::size_t size) {
+        std::size_t n = 1;
+        while (n < size) {
+            n <<= 1;
+        }
+        return n;
+    }
+
+    std::size_t _size;
+    detail::mpsc_index _mask;
+
+    unsigned char *_buf_array;
+    T *_buf;
+
+    // sequence number of each slot, tells producers and consumer whose turn
+    // it is to use the slot
+    std::vector<detail::mpsc_atomic> _seq;
+
+    detail::mpsc_atomic _push_idx;
+    detail::mpsc_index _pop_idx;
+};
+
+
+} // namespace das
+
+
+#endif // DAS_UTIL_MPSC_QUEUE_HH
@@ -36,6 +36,18 @@ class scoped_gil_lock
 };
 
 
+// returns true if the calling thread currently holds the GIL
+inline bool gil_held()
+{
+#if PY_VERSION_HEX >= 0x03040000
+    return PyGILState_Check();
+#else
+    PyThreadState *tstate = PyGILState_GetThisThreadState();
+    return tstate && tstate == _PyThreadState_Current;
+#endif
+}
+
+
 class scoped_gil_release
   : boost::noncopyable
 {
@@ -14,6 +14,7 @@
 #include "util/to_python_converter.hh"
 
 #include <boost/python/extract.hpp>
+#include <boost/python/dict.hpp>
 
 
 namespace das {
@@ -47,6 +48,29 @@ struct from_dict_converter
 };
 
 
+/**
+ * Converter from std::map to Python dictionary.
+ */
+template <typename T, typename P=T>
+struct to_dict_converter
+  : to_python_converter<T, P, to_dict_converter<T, P> >
+{
+    static PyObject *convert(T const & map) {
+        boost::python::dict ret;
+        for (typename T::const_iterator it = map.begin();
+                it != map.end(); ++it) {
+            ret[it->first] = it->second;
+        }
+
+        return boost::python::incref(ret.ptr());
+    }
+
+    static PyTypeObject const *get_pytype() {
+        return &PyDict_Type;
+    }
+};
+
+
 } // namespace python
 } // namespace das
 
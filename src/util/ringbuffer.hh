@@ -11,6 +11,7 @@
 #define DAS_UTIL_RINGBUFFER_HH
 
 #include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
 
 
 #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
@@ -24,6 +25,16 @@ namespace das {
 
 #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
     using std::atomic_size_t;
+    using std::atomic_int;
+    using std::atomic_uint64_t;
+
+    template <typename T>
+    struct atomic_pointer : std::atomic<T *> {
+        atomic_pointer() : std::atomic<T *>(0) { }
+        atomic_pointer(atomic_pointer const & other)
+          : std::atomic<T *>(other.load()) { }
+        using std::atomic<T *>::operator=;
+    };
 #else
     /*
      * a simple glib-based C++98 replacement for std::atomic_size_t.
@@ -39,6 +50,57 @@ namespace das {
       private:
         int _index;
     };
+
+    /*
+     * signed counterpart of atomic_size_t.
+     */
+    struct atomic_int {
+      public:
+        void operator=(int i) {
+            g_atomic_int_set(&_value, i);
+        }
+        operator int() const {
+            return g_atomic_int_get(&_value);
+        }
+      private:
+        int _value;
+    };
+
+    /*
+     * 64-bit counterpart of atomic_size_t. glib's atomic operations only
+     * work on ints and pointers, so this uses gcc's builtins instead.
+     */
+    struct atomic_uint64_t {
+      public:
+        void operator=(uint64_t i) {
+            uint64_t old = _value;
+            while (!__sync_bool_compare_and_swap(&_value, old, i)) {
+                old = _value;
+            }
+        }
+        operator uint64_t() const {
+            return __sync_add_and_fetch(const_cast<uint64_t *>(&_value), 0);
+        }
+      private:
+        volatile uint64_t _value;
+    };
+
+    /*
+     * pointer counterpart of atomic_size_t.
+     */
+    template <typename T>
+    struct atomic_pointer {
+      public:
+        atomic_pointer() : _pointer(NULL) { }
+        void operator=(T *p) {
+            g_atomic_pointer_set(&_pointer, p);
+        }
+        operator T *() const {
+            return static_cast<T *>(g_atomic_pointer_get(&_pointer));
+        }
+      private:
+        gpointer _pointer;
+    };
 #endif
 
 
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2009-2012  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DAS_UTIL_SHM_RINGBUFFER_HH
+#define DAS_UTIL_SHM_RINGBUFFER_HH
+
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+
+#include <sys/mman.h>
+
+#include <boost/noncopyable.hpp>
+
+#include "util/ringbuffer.hh"
+
+
+namespace das {
+
+
+/*
+ * lock-free single-producer/single-consumer ring buffer in an anonymous
+ * shared memory mapping. the buffer must be created before calling fork(),
+ * after which parent and child processes can each use one end of it.
+ * alternatively, the buffer can be placed in memory provided by the caller,
+ * such as a named shared memory segment mapped by unrelated processes.
+ * only plain old data types can be stored, as no constructors or destructors
+ * are run.
+ */
+template <typename T>
+class shm_ringbuffer : boost::noncopyable
+{
+  public:
+    shm_ringbuffer(std::size_t size)
+      : _size(size)
+      , _length(memory_size(size))
+      , _owned(true)
+    {
+        void *p = ::mmap(NULL, _length, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("can't map shared memory");
+        }
+
+        _header = new (p) header;
+        _buf = reinterpret_cast<T*>(static_cast<unsigned char*>(p) +
+                                    sizeof(header));
+        reset();
+    }
+
+    // use memory_size(size) bytes at mem, which must remain mapped for the
+    // lifetime of this object. the buffer is initialized only if init is
+    // true, otherwise it's assumed that some other process already did so.
+    // if mem is NULL, the buffer can't be used until assign() is called
+    shm_ringbuffer(void *mem, std::size_t size, bool init)
+      : _size(size)
+      , _length(memory_size(size))
+      , _owned(false)
+      , _header(NULL)
+      , _buf(NULL)
+    {
+        if (mem) {
+            assign(mem, init);
+        }
+    }
+
+    // switch to the memory at mem, as if it had been passed to the
+    // constructor. only for buffers not in their own mapping, and must not
+    // be called while the buffer is in use
+    void assign(void *mem, bool init) {
+        _header = init ? new (mem) header
+                       : static_cast<header*>(mem);
+        _buf = reinterpret_cast<T*>(static_cast<unsigned char*>(mem) +
+                                    sizeof(header));
+        if (init) {
+            reset();
+        }
+    }
+
+    ~shm_ringbuffer() {
+        if (_owned) {
+            _header->~header();
+            ::munmap(static_cast<void*>(_header), _length);
+        }
+    }
+
+    // the number of bytes needed for a buffer of the given size
+    static std::size_t memory_size(std::size_t size) {
+        return sizeof(header) + size * sizeof(T);
+    }
+
+    void reset() {
+        _header->write_idx = 0;
+        _header->read_idx = 0;
+    }
+
+    std::size_t write_space() const {
+        std::size_t const w = _header->write_idx;
+        std::size_t const r = _header->read_idx;
+
+        if (w > r) {
+            return ((r - w + _size) % _size) - 1;
+        } else if (w < r) {
+            return (r - w) - 1;
+        } else {
+            return _size - 1;
+        }
+    }
+
+    std::size_t read_space() const {
+        std::size_t const w = _header->write_idx;
+        std::size_t const r = _header->read_idx;
+
+        if (w > r) {
+            return w - r;
+        } else {
+            return (w - r + _size) % _size;
+        }
+    }
+
+    std::size_t capacity() const {
+        return _size;
+    }
+
+    bool write(T const & src) {
+        if (write_space()) {
+            std::size_t const priv_write_idx = _header->write_idx;
+            _buf[priv_write_idx] = src;
+            _header->write_idx = (priv_write_idx + 1) % _size;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool read(T & dst) {
+        if (read_space()) {
+            std::size_t const priv_read_idx = _header->read_idx;
+            dst = _buf[priv_read_idx];
+            _header->read_idx = (priv_read_idx + 1) % _size;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // write all n elements, or none of them if there's not enough space.
+    // the reader never sees only some of them
+    bool write(T const *src, std::size_t n) {
+        if (write_space() < n) {
+            return false;
+        }
+        std::size_t const priv_write_idx = _header->write_idx;
+        std::size_t const first = std::min(n, _size - priv_write_idx);
+        std::copy(src, src + first, _buf + priv_write_idx);
+        std::copy(src + first, src + n, _buf);
+        _header->write_idx = (priv_write_idx + n) % _size;
+        return true;
+    }
+
+    // read up to n elements, and return the number of elements read
+    std::size_t read(T *dst, std::size_t n) {
+        n = std::min(n, read_space());
+        std::size_t const priv_read_idx = _header->read_idx;
+        std::size_t const first = std::min(n, _size - priv_read_idx);
+        std::copy(_buf + priv_read_idx, _buf + priv_read_idx + first, dst);
+        std::copy(_buf, _buf + (n - first), dst + first);
+        _header->read_idx = (priv_read_idx + n) % _size;
+        return n;
+    }
+
+  private:
+    struct header {
+        atomic_size_t write_idx;
+        atomic_size_t read_idx;
+    };
+
+    std::size_t _size;
+    std::size_t _length;
+    // true if the buffer is in its own mapping
+    bool _owned;
+
+    header *_header;
+    T *_buf;
+};
+
+
+} // namespace das
+
+
+#endif // DAS_UTIL_SHM_RINGBUFFER_HH
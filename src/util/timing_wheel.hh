@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2009-2012  Dominic Sacré  <dominic.sacre@gmx.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DAS_UTIL_TIMING_WHEEL_HH
+#define DAS_UTIL_TIMING_WHEEL_HH
+
+#include <vector>
+#include <new>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+
+namespace das {
+
+
+/*
+ * hashed timing wheel, storing C++ objects keyed by an absolute time value.
+ * all memory is allocated up front, so scheduling and expiring items is
+ * realtime-safe. items within each slot are kept sorted by time.
+ * not thread-safe, all access must be from the same thread.
+ */
+template <typename T>
+class timing_wheel : boost::noncopyable
+{
+  public:
+    /*
+     * capacity:   maximum number of items that can be scheduled at once.
+     * num_slots:  number of slots, must be a power of two.
+     * slot_shift: each slot covers a time span of (1 << slot_shift).
+     */
+    timing_wheel(std::size_t capacity, std::size_t num_slots,
+                 unsigned int slot_shift)
+      : _capacity(capacity)
+      , _mask(num_slots - 1)
+      , _shift(slot_shift)
+      , _node_array(new unsigned char[capacity * sizeof(node)])
+      , _nodes(reinterpret_cast<node*>(_node_array))
+      , _slots(num_slots)
+    {
+        reset();
+    }
+
+    ~timing_wheel() {
+        clear();
+        delete[] _node_array;
+    }
+
+    // remove all scheduled items, and start over at time zero.
+    void reset() {
+        clear();
+        _now = 0;
+    }
+
+    // remove all scheduled items.
+    void clear() {
+        for (std::size_t n = 0; n != _slots.size(); ++n) {
+            while (_slots[n]) {
+                node *p = _slots[n];
+                _slots[n] = p->next;
+                release(p);
+            }
+        }
+        _free = NULL;
+        for (std::size_t n = 0; n != _capacity; ++n) {
+            _nodes[n].next = _free;
+            _free = _nodes + n;
+        }
+        _size = 0;
+    }
+
+    std::size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    std::size_t capacity() const {
+        return _capacity;
+    }
+
+    // schedule an item. returns false if there's no space left.
+    bool schedule(T const & item, uint64_t time) {
+        if (!_free) {
+            return false;
+        }
+
+        node *p = _free;
+        _free = p->next;
+
+        new (static_cast<void*>(&p->item)) T(item);
+        p->time = time;
+
+        // items that are already due go into the slot expired next
+        node **q = &_slots[slot(time < _now ? _now : time)];
+
+        // keep items sorted by time, preserving the insertion order of
+        // items with the same time
+        while (*q && (*q)->time <= time) {
+            q = &(*q)->next;
+        }
+        p->next = *q;
+        *q = p;
+
+        ++_size;
+        return true;
+    }
+
+    /*
+     * remove all items scheduled before the given time, calling f(item, time)
+     * for each of them. items are returned in order, unless the time since
+     * the previous call exceeds the wheel's total time span.
+     */
+    template <typename F>
+    void expire(uint64_t until, F f) {
+        if (until <= _now) {
+            return;
+        }
+
+        uint64_t first = _now >> _shift;
+        uint64_t last = (until - 1) >> _shift;
+        if (last - first > _mask) {
+            last = first + _mask;
+        }
+
+        for (uint64_t s = first; s <= last && _size; ++s) {
+            node **q = &_slots[s & _mask];
+
+            while (*q && (*q)->time < until) {
+                node *p = *q;
+                *q = p->next;
+                f(p->item, p->time);
+                release(p);
+                --_size;
+            }
+        }
+
+        _now = until;
+    }
+
+  private:
+    struct node {
+        T item;
+        uint64_t time;
+        node *next;
+    };
+
+    std::size_t slot(uint64_t time) const {
+        return static_cast<std::size_t>(time >> _shift) & _mask;
+    }
+
+    void release(node *p) {
+        p->item.~T();
+        p->next = _free;
+        _free = p;
+    }
+
+    std::size_t _capacity;
+    std::size_t _mask;
+    unsigned int _shift;
+
+    unsigned char *_node_array;
+    node *_nodes;
+    node *_free;
+
+    std::vector<node *> _slots;
+
+    std::size_t _size;
+    uint64_t _now;
+};
+
+
+} // namespace das
+
+
+#endif // DAS_UTIL_TIMING_WHEEL_HH
@@ -19,6 +19,9 @@ import random
 import itertools
 import sys
 import copy
+import os
+import select
+import time
 
 from mididings import *
 from mididings import setup, engine, misc, constants
@@ -50,6 +53,39 @@ class MididingsTestCase(unittest.TestCase):
         self.mididings_dict = mididings.__dict__.copy()
         self.mididings_dict.update(mididings.event.__dict__)
 
+    def tearDown(self):
+        self.reset_backend()
+
+    def reset_backend(self):
+        """
+        Drop the backend shared by all engines, so that the next engine
+        creates a new one.
+        """
+        engine._TheBackend = None
+        engine._TheBackendConfig = None
+
+    def read_pipe(self, fd, n, timeout=5.0):
+        """
+        Read n bytes from the given file descriptor, or as many as arrive
+        before the timeout.
+        """
+        data = b''
+        deadline = time.time() + timeout
+        while len(data) < n and time.time() < deadline:
+            if select.select([fd], [], [], 0.01)[0]:
+                data += os.read(fd, n - len(data))
+        return data
+
+    def process_event(self, e, ev):
+        """
+        Process a single event with the given engine, return the list of
+        resulting events.
+        """
+        r = e.process_event(ev)[:]
+        for rev in r:
+            rev.__class__ = MidiEvent
+        return r
+
     def check_patch(self, patch, d):
         """
         Test the given patch. d must be a mapping from events to the expected
@@ -117,6 +153,8 @@ class MididingsTestCase(unittest.TestCase):
         for r in r1:
             for ev in r:
                 rebuilt = eval(repr(ev), self.mididings_dict)
+                # timestamps aren't part of an event's repr()
+                rebuilt.frame = ev.frame
                 self.assertEqual(rebuilt, ev)
 
         rebuilt = self._rebuild_repr(scenes)
@@ -139,10 +177,7 @@ class MididingsTestCase(unittest.TestCase):
         # process each event, append each list of output events to the
         # returned list of lists
         for ev in events:
-            ret = e.process_event(ev)[:]
-            for rev in ret:
-                rev.__class__ = MidiEvent
-            r.append(ret)
+            r.append(self.process_event(e, ev))
         return r
 
     def _rebuild_repr(self, scenes):
@@ -184,7 +219,7 @@ class MididingsTestCase(unittest.TestCase):
         if type is None:
             if channel is None:
                 type = random.choice(list(set(constants._EVENT_TYPES.values())
-                                        - set([DUMMY])))
+                                        - set([TICK, DUMMY])))
             else:
                 type = random.choice([NOTEON, NOTEOFF, CTRL, PITCHBEND,
                                       AFTERTOUCH, POLY_AFTERTOUCH, PROGRAM])
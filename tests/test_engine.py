@@ -13,7 +13,19 @@
 from tests.helpers import *
 
 from mididings import *
-from mididings import engine
+from mididings import engine, util
+
+import _mididings
+import socket
+import struct
+import time
+import sys
+import os
+import tempfile
+import threading
+import ctypes
+import subprocess
+import unittest
 
 
 class EngineTestCase(MididingsTestCase):
@@ -34,6 +46,48 @@ class EngineTestCase(MididingsTestCase):
         config(out_ports = 3)
         self.assertEqual(engine.out_ports(), ['out_0', 'out_1', 'out_2'])
 
+    def test_add_remove_ports(self):
+        class Backend(object):
+            def __init__(self):
+                self.ports = {False: 2, True: 1}
+                self.removed = []
+                self.connections = []
+            def add_port(self, out, name):
+                self.ports[out] += 1
+                return self.ports[out] - 1
+            def remove_port(self, out, port):
+                self.removed.append((out, port))
+            def connect_ports(self, in_ports, out_ports):
+                self.connections.append((in_ports, out_ports))
+
+        config(in_ports = ['foo', 'bar'], out_ports = ['baz'])
+        backend = Backend()
+        backend_config = (None, None, engine.in_ports(), engine.out_ports())
+        engine._TheBackend = backend
+        engine._TheBackendConfig = backend_config
+        self.assertEqual(engine.add_in_port(), 2)
+        self.assertEqual(engine.add_out_port('qux', 'synth.*'), 1)
+        self.assertEqual(backend.connections,
+                         [({}, {'qux': ['synth.*']})])
+
+        self.assertEqual(engine.in_ports(), ['foo', 'bar', 'in_2'])
+        self.assertEqual(engine.out_ports(), ['baz', 'qux'])
+
+        engine.remove_in_port('bar')
+        engine.remove_out_port(0)
+        self.assertEqual(backend.removed, [(False, 1), (True, 0)])
+
+        # the other ports keep their numbers
+        self.assertEqual(engine.in_ports(), ['foo', '', 'in_2'])
+        self.assertEqual(engine.out_ports(), ['', 'qux'])
+        self.assertEqual(util.port_number('in_2'), 2)
+        self.assertEqual(util.port_number('qux'), 1)
+
+        # the configuration the backend was created with is unchanged
+        self.assertEqual(engine._TheBackendConfig, backend_config)
+        self.assertEqual(backend_config[2], ['foo', 'bar'])
+        self.assertEqual(backend_config[3], ['baz'])
+
     def test_active(self):
         self.assertFalse(engine.active())
 
@@ -41,3 +95,998 @@ class EngineTestCase(MididingsTestCase):
             self.assertTrue(engine.active())
 
         self.run_patch(Process(foo), self.make_event())
+
+    def test_tick_interval(self):
+        # 441 frames at the offline sample rate
+        config(tick_interval = 0.01)
+
+        ev1 = self.make_event(NOTEON, port=0, channel=0)
+        ev1.frame = 1000
+        ev2 = self.make_event(NOTEON, port=0, channel=0)
+        ev2.frame = 1500
+
+        def tick(n):
+            r = CtrlEvent(0, 0, 1, n)
+            r.frame = n * 441
+            return r
+
+        patch = Filter(TICK) >> Ctrl(0, 0, 1, EVENT_DATA1)
+        self.assertEqual(self.run_patch(patch, [ev1, ev2]),
+                         [tick(0), tick(1), tick(2), tick(3)])
+
+        # ticks are never sent to the output
+        self.assertEqual(self.run_patch(Pass(), [ev1]), [ev1])
+
+        # bypassed events still advance the ticks up to their frame
+        config(bypass = {SYSRT_CLOCK: 0})
+        clock = MidiEvent(SYSRT_CLOCK, 0)
+        clock.frame = 1000
+        self.assertEqual(self.run_patch(patch, [clock]),
+                         [tick(0), tick(1), tick(2), clock])
+
+    def test_tempo(self):
+        def check_tempo(ev):
+            self.assertAlmostEqual(engine.tempo(), 110.25)
+            self.assertEqual(engine.song_position(), 0.25)
+
+        events = []
+        for n in range(6):
+            clock = MidiEvent(SYSRT_CLOCK)
+            clock.frame = n * 1000
+            events.append(clock)
+        events.append(self.make_event(NOTEON))
+
+        self.run_patch(Filter(NOTE) % Process(check_tempo), events)
+
+    def test_bypass(self):
+        config(out_ports = 2, bypass = {SYSRT_CLOCK: 1, SYSRT_SENSING: None})
+
+        clock = MidiEvent(SYSRT_CLOCK, 0)
+        sensing = MidiEvent(SYSRT_SENSING, 0)
+        ev = self.make_event(NOTEON, port=0)
+
+        self.check_patch(Discard(), {
+            clock: [MidiEvent(SYSRT_CLOCK, 1)],
+            sensing: [],
+            ev: [],
+        })
+
+        with self.assertRaises(TypeError):
+            config(bypass = {SYSRT_CLOCK: 1.5})
+
+    def test_lazy_scenes(self):
+        config(silent = True, lazy_scenes = True, max_resident_scenes = 3)
+
+        def scene(n):
+            return Split({
+                PROGRAM:  SceneSwitch(),
+                ~PROGRAM: Channel(n),
+            })
+        scenes = dict((n, scene(n)) for n in range(8))
+
+        def program(n):
+            return self.make_event(PROGRAM, 0, 0, 0, n)
+
+        def note(t, n, channel=0):
+            return self.make_event(t, 0, channel, n, 64)
+
+        events = [
+            note(NOTEON, 60),
+            program(5),
+            note(NOTEON, 62),
+            program(2),
+            note(NOTEOFF, 62),
+            program(7),
+            program(0),
+            note(NOTEOFF, 60),
+        ]
+        self.assertEqual(self.run_scenes(scenes, events), [
+            [note(NOTEON, 60, 0)],
+            [],
+            [note(NOTEON, 62, 5)],
+            [],
+            [note(NOTEOFF, 62, 5)],
+            [],
+            [],
+            [note(NOTEOFF, 60, 0)],
+        ])
+
+        e = engine.Engine()
+        e.setup(scenes, None, None, None)
+        self.assertEqual(list(e._resident_scenes), [0])
+
+        e.process_event(note(NOTEON, 60))
+        e.process_event(program(5))
+        # the current scene and its neighbours are built, but the least
+        # recently used scene can't be unloaded while a note is still held
+        # there
+        self.assertEqual(list(e._resident_scenes), [0, 6, 5])
+        e.process_event(program(2))
+        self.assertEqual(list(e._resident_scenes), [0, 3, 2])
+        e.process_event(note(NOTEOFF, 60))
+        e.process_event(program(7))
+        self.assertEqual(list(e._resident_scenes), [2, 6, 7])
+
+    def test_lazy_scenes_single_resident(self):
+        config(silent = True, lazy_scenes = True, max_resident_scenes = 1)
+
+        scenes = dict((n, Split({
+            PROGRAM:  SceneSwitch(),
+            ~PROGRAM: Channel(n),
+        })) for n in range(8))
+
+        program = self.make_event(PROGRAM, 0, 0, 0, 5)
+        note = self.make_event(NOTEON, 0, 0, 60, 64)
+
+        e = engine.Engine(backend='dummy')
+        e.setup(scenes, None, None, None)
+        self.assertEqual(list(e._resident_scenes), [0])
+
+        # the scene built for the switch must not be unloaded again before
+        # the switch is done
+        e.process_event(program)
+        self.assertEqual(e.current_scene(), 5)
+        self.assertEqual(list(e._resident_scenes), [5])
+        self.assertEqual(e.process_event(note),
+                         [self.make_event(NOTEON, 0, 5, 60, 64)])
+
+    def test_scene_switch_init_exit(self):
+        config(silent = True)
+
+        calls = []
+        def count(ev):
+            calls.append(ev.type)
+            return ev
+
+        scenes = {
+            0: Scene('foo', Filter(PROGRAM) % SceneSwitch(),
+                     init_patch=Program(0, 0, 10) >> Channel(2),
+                     exit_patch=[Ctrl(0, 0, 7, 0), Ctrl(0, 0, 10, 64)]),
+            1: Scene('bar', Filter(PROGRAM) % SceneSwitch(),
+                     init_patch=Process(count) >> Program(0, 0, 11)),
+        }
+
+        def program(n):
+            return self.make_event(PROGRAM, 0, 0, 0, n)
+
+        exit_0 = [self.make_event(CTRL, 0, 0, 7, 0),
+                  self.make_event(CTRL, 0, 0, 10, 64)]
+        init_0 = [self.make_event(PROGRAM, 0, 2, 0, 10)]
+        init_1 = [self.make_event(PROGRAM, 0, 0, 0, 11)]
+
+        # the output of deterministic init/exit patches is precomputed,
+        # all others still run on every scene switch.
+        # (scene 0 is never entered properly when processing offline, so
+        # its exit patch doesn't run the first time)
+        self.assertEqual(self._run_scenes_impl(scenes, [
+            program(1), program(0), program(1), program(0),
+        ]), [
+            init_1,
+            init_0,
+            exit_0 + init_1,
+            init_0,
+        ])
+        self.assertEqual(calls, [DUMMY] * 2)
+
+    def test_scene_switch_notification(self):
+        config(silent = True)
+
+        class Hook(object):
+            def __init__(self):
+                self.switches = []
+            def on_switch_scene(self, scene, subscene):
+                self.switches.append((scene, subscene))
+
+        h = Hook()
+        hook(h)
+
+        scenes = {
+            0: Filter(PROGRAM) % SceneSwitch(),
+            1: SceneGroup('foo', [
+                Filter(PROGRAM) % SceneSwitch(),
+                Filter(PROGRAM) % SceneSwitch(),
+            ]),
+        }
+        events = [
+            self.make_event(PROGRAM, 0, 0, 0, 1),
+            self.make_event(PROGRAM, 0, 0, 0, 5),
+            self.make_event(PROGRAM, 0, 0, 0, 0),
+        ]
+        self._run_scenes_impl(scenes, events)
+        # each switch is reported by the time process_event() returns, and
+        # nonexistent scenes are not reported to hooks
+        self.assertEqual(h.switches, [(1, 0), (0, 0)])
+
+    def test_gil_timeout(self):
+        config(gil_timeout = 0.01, gil_fallback = 'drop')
+
+        def foo(ev):
+            ev.note += 1
+            return ev
+
+        setup._config_impl(backend='dummy')
+        e = engine.Engine()
+        e.setup({0: Process(foo)}, None, None, None)
+
+        # when the GIL is already held by the calling thread, there's no
+        # need to wait for it
+        ev = self.make_event(NOTEON, 0, 0, 60, 100)
+        self.assertEqual(e.process_event(ev)[:],
+                         [self.make_event(NOTEON, 0, 0, 61, 100)])
+        self.assertEqual(e.gil_timeouts(), 0)
+
+        with self.assertRaises(ValueError):
+            config(gil_fallback = 'ignore')
+        with self.assertRaises(TypeError):
+            config(gil_timeout = 0)
+
+    def test_gil_timeout_fallback(self):
+        libc = ctypes.PyDLL(None)
+
+        def run(fallback, inplace=False):
+            in_r, in_w = os.pipe()
+            out_r, out_w = os.pipe()
+            calls = []
+            proxies = []
+
+            def foo(ev):
+                calls.append(ev.note)
+                ev.note += 1
+                return ev
+
+            def foo_inplace(ev):
+                calls.append(ev.note)
+                proxies.append(ev)
+                ev.note += 1
+
+            interval = sys.getswitchinterval()
+            try:
+                config(silent = True,
+                       in_ports = ['fd:%d' % in_r],
+                       out_ports = ['fd:%d' % out_w],
+                       gil_timeout = 0.05, gil_fallback = fallback)
+                setup._config_impl(backend='raw')
+
+                e = engine.Engine()
+                if inplace:
+                    patch = Process(inplace=foo_inplace)
+                else:
+                    patch = Process(foo)
+                e.setup({0: patch}, None, None, None)
+                e.start(0, -1)
+
+                # nothing else needs the GIL
+                os.write(in_w, b'\x90\x3c\x64')
+                self.assertEqual(self.read_pipe(out_r, 3), b'\x90\x3d\x64')
+                self.assertEqual(e.gil_timeouts(), 0)
+
+                # hold on to the GIL for much longer than the timeout. unlike
+                # os.write(), functions called through PyDLL don't release it
+                sys.setswitchinterval(2.0)
+                try:
+                    libc.write(in_w, b'\x90\x3e\x64', 3)
+                    until = time.time() + 0.5
+                    while time.time() < until:
+                        pass
+                finally:
+                    sys.setswitchinterval(interval)
+
+                output = self.read_pipe(out_r, 3, 0.5)
+                # give deferred calls a chance to run
+                time.sleep(0.1)
+                timeouts = e.gil_timeouts()
+
+                e.stop()
+                del e
+                if inplace:
+                    # the deferred call didn't share its event object with
+                    # the call that may still have been running
+                    self.assertIsNot(proxies[0], proxies[1])
+                return output, calls, timeouts
+            finally:
+                self.reset_backend()
+                for fd in (in_r, in_w, out_r, out_w):
+                    os.close(fd)
+
+        # the function isn't called once the deadline has passed, unless the
+        # call is deferred. the output uses running status
+        self.assertEqual(run('pass'), (b'\x3e\x64', [60], 1))
+        self.assertEqual(run('drop'), (b'', [60], 1))
+        self.assertEqual(run('defer'), (b'', [60, 62], 1))
+        self.assertEqual(run('defer', True), (b'', [60, 62], 1))
+
+    def test_independent_engines(self):
+        config(silent = True)
+        setup._config_impl(backend='dummy')
+        main = engine.Engine()
+        main.setup({0: Pass()}, None, None, None)
+
+        engines = [engine.Engine(backend='dummy') for n in range(4)]
+        for n, e in enumerate(engines):
+            e.setup({0: Transpose(n) >> [Pass(), Transpose(12)]},
+                    None, None, None)
+
+        # module-level functions still refer to the main engine
+        self.assertIs(engine._TheEngine(), main)
+
+        results = [None] * len(engines)
+
+        def process(n):
+            results[n] = [
+                [ev.data1 for ev in engines[n].process_event(
+                    self.make_event(NOTEON, 0, 0, note, 100))]
+                for note in range(100)
+            ]
+
+        # each engine processes its events in a separate thread, at the same
+        # time
+        threads = [threading.Thread(target=process, args=(n,))
+                   for n in range(len(engines))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        for n, r in enumerate(results):
+            self.assertEqual(r, [[note + n, note + n + 12]
+                                 for note in range(100)])
+
+    def test_commands(self):
+        config(silent = True)
+
+        setup._config_impl(backend='dummy')
+        e = engine.Engine()
+        e.setup({
+            0: Pass(),
+            1: Transpose(12),
+        }, None, None, None)
+
+        note = self.make_event(NOTEON, 0, 0, 60, 100)
+        ctrl = self.make_event(CTRL, 0, 0, 7, 42)
+
+        # commands queued between events are carried out before the next
+        # event is processed, in the order they were queued
+        e.output_event(ctrl)
+        e.inject_event(note)
+        self.assertEqual(self.process_event(e, note), [ctrl, note, note])
+
+        e.switch_scene(1)
+        e.inject_event(note)
+        self.assertEqual(self.process_event(e, note),
+                         [self.modify_event(note, note=72)] * 2)
+        self.assertEqual(e.current_scene(), 1)
+
+        # commands queued while processing an event are carried out right
+        # after it
+        e = engine.Engine()
+        e.setup({0: Process(lambda ev: e.output_event(ctrl))},
+                None, None, None)
+        self.assertEqual(self.process_event(e, note), [ctrl])
+
+    def _osc_socket(self):
+        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        s.bind(('127.0.0.1', 0))
+        s.settimeout(5.0)
+        return s, s.getsockname()[1]
+
+    def test_osc_send(self):
+        s, port = self._osc_socket()
+
+        _mididings.send_osc('', port, '/foo',
+                            [('i', 42), ('f', 0.5), ('s', 'bar')])
+        self.assertEqual(s.recv(1024),
+                         b'/foo\0\0\0\0,ifs\0\0\0\0' +
+                         struct.pack('>if', 42, 0.5) + b'bar\0')
+
+        from mididings.extra.osc import SendOSC
+        config(silent = True)
+        setup._config_impl(backend='dummy')
+        e = engine.Engine()
+        e.setup({0: SendOSC(port, '/note', EVENT_NOTE, EVENT_CHANNEL, 'x',
+                            -1, -5)},
+                None, None, None)
+
+        ev = self.make_event(NOTEON, 0, 3, 60, 100)
+        self.assertEqual(e.process_event(ev)[:], [])
+        # negative integers are sent as they are, not as event attributes
+        self.assertEqual(s.recv(1024),
+                         b'/note\0\0\0,iisii\0\0' +
+                         struct.pack('>ii', 60, 3) + b'x\0\0\0' +
+                         struct.pack('>ii', -1, -5))
+        s.close()
+
+    def test_osc_interface_send(self):
+        import mididings.extra.osc as osc
+        s, port = self._osc_socket()
+
+        liblo = osc._liblo
+        osc._liblo = None
+        try:
+            config(silent = True)
+            iface = osc.OSCInterface(None, port)
+            # can't be sent natively, and is skipped
+            iface._send(port, '/foo', 'bar', None)
+            iface._send(port, '/foo', 'bar')
+        finally:
+            osc._liblo = liblo
+
+        self.assertEqual(s.recv(1024), b'/foo\0\0\0\0,s\0\0bar\0')
+        s.close()
+
+    def test_osc_server(self):
+        config(silent = True, data_offset = 1)
+        setup._config_impl(backend='dummy')
+        e = engine.Engine()
+        e.setup({1: Pass(), 2: Pass()}, None, None, None)
+
+        s, port = self._osc_socket()
+        s.close()
+
+        received = []
+        e.start_osc_server(port, 1,
+                lambda path, types, args: received.append((path, types, args)))
+
+        def wait(condition):
+            for n in range(500):
+                if condition():
+                    return True
+                time.sleep(0.01)
+            return False
+
+        note = self.make_event(NOTEON, 1, 1, 60, 100)
+
+        # scene switches are queued as engine commands, without calling
+        # into python
+        _mididings.send_osc('', port, '/mididings/switch_scene', [('i', 2)])
+        self.assertTrue(wait(lambda: self.process_event(e, note) == [note] and
+                                     e.current_scene() == 2))
+
+        _mididings.send_osc('', port, '/mididings/prev_scene', [])
+        self.assertTrue(wait(lambda: self.process_event(e, note) == [note] and
+                                     e.current_scene() == 1))
+
+        _mididings.send_osc('', port, '/mididings/panic', [])
+        r = []
+        self.assertTrue(wait(lambda: r.extend(self.process_event(e, note)) or
+                                     len(r) > 1))
+        ctrls = [x for x in r if x.type == CTRL]
+        self.assertEqual(len(ctrls), 32 * len(engine.out_ports()))
+        self.assertEqual(set(x.ctrl for x in ctrls), set([64, 123]))
+
+        # everything else goes to the callback
+        _mididings.send_osc('', port, '/foo', [('i', 1), ('s', 'bar')])
+        self.assertTrue(wait(lambda: received))
+        self.assertEqual(received, [('/foo', 'is', [1, 'bar'])])
+
+        e.stop_osc_server()
+
+    def test_warm_restart(self):
+        in_r, in_w = os.pipe()
+        out_r, out_w = os.pipe()
+        ports = dict(in_ports = ['fd:%d' % in_r], out_ports = ['fd:%d' % out_w])
+
+        fd, script = tempfile.mkstemp(suffix='.py')
+        os.write(fd, ("from mididings import *\n"
+                      "from mididings import setup\n"
+                      "config(silent=True, data_offset=0, **%r)\n"
+                      "setup._config_impl(backend='raw')\n"
+                      "run({0: Pass(), 1: Transpose(12)})\n" % ports).encode())
+        os.close(fd)
+
+        def current_engine():
+            return engine._TheEngine() if engine._TheEngine else None
+
+        result = {}
+
+        def control(first):
+            try:
+                os.write(in_w, b'\x90\x3c\x64')
+                result['before'] = self.read_pipe(out_r, 3)
+
+                first.switch_scene(1)
+                os.write(in_w, b'\x3e\x64')
+                result['switched'] = self.read_pipe(out_r, 2)
+
+                first.restart(warm=True)
+
+                # wait for the engine set up by the script to run
+                for i in range(500):
+                    e = current_engine()
+                    if e is not None and e is not first:
+                        result['engine'] = e
+                        break
+                    time.sleep(0.01)
+
+                result['restarted'] = self.read_pipe(out_r, 2)
+            finally:
+                for i in range(500):
+                    e = current_engine()
+                    if e is not None and (e is not first or
+                                          'engine' not in result):
+                        e.quit()
+                        break
+                    time.sleep(0.01)
+
+        reload_script = engine._reload_script
+
+        def reload_script_with_input():
+            # input arriving while no engine is running
+            os.write(in_w, b'\x40\x64')
+            return reload_script()
+
+        argv = sys.argv
+        sys.argv = [script]
+        engine._reload_script = reload_script_with_input
+        try:
+            config(silent = True, **ports)
+            setup._config_impl(backend='raw')
+            e = engine.Engine()
+            backend = engine._TheBackend
+            e.setup({0: Pass(), 1: Pass()}, None, None, None)
+
+            t = threading.Thread(target=control, args=(e,))
+            t.start()
+            engine._run_engine(e)
+            t.join()
+        finally:
+            engine._reload_script = reload_script
+            sys.argv = argv
+            if 'engine' in result:
+                result['engine'].stop()
+            for fd in (in_r, in_w, out_r, out_w):
+                os.close(fd)
+            os.remove(script)
+
+        self.assertFalse(engine._restarting)
+        self.assertEqual(result['before'], b'\x90\x3c\x64')
+        self.assertEqual(result['switched'], b'\x3e\x64')
+
+        # the script was executed again, and the new engine reused the
+        # backend
+        e2 = result['engine']
+        self.assertFalse(e2 is e)
+        self.assertTrue(e2._backend is backend)
+        self.assertEqual(sorted(e2.scenes()), [0, 1])
+
+        # the new engine stayed in the current scene, and processed the
+        # input received during the restart. the backend's running status
+        # carried over in both directions
+        self.assertEqual(e2.current_scene(), 1)
+        self.assertEqual(result['restarted'], b'\x4c\x64')
+
+    def test_state_file(self):
+        fd, state_file = tempfile.mkstemp()
+        os.close(fd)
+
+        scenes = {0: Pass(), 1: Transpose(12)}
+        noteon = self.make_event(NOTEON, 0, 0, 60, 100)
+        noteoff = self.make_event(NOTEOFF, 0, 0, 60, 0)
+
+        def restored_engine():
+            e = engine.Engine()
+            e.setup(scenes, None, None, None)
+            return e
+
+        try:
+            config(silent = True, state_file = state_file)
+            setup._config_impl(backend='dummy')
+
+            e = restored_engine()
+            self.assertEqual(e.restored_scene(), -1)
+            e.switch_scene(1)
+            self.assertEqual(self.process_event(e, noteon),
+                             [self.modify_event(noteon, note=72)])
+
+            # the state is written asynchronously
+            for n in range(100):
+                if restored_engine().restored_scene() == 1:
+                    break
+                time.sleep(0.05)
+            del e
+
+            # a new engine resumes in the stored scene, and routes the
+            # note-off through the scene the note was started in
+            e = restored_engine()
+            self.assertEqual(e.restored_scene(), 1)
+            self.assertEqual(e.restored_subscene(), 0)
+            self.assertEqual(self.process_event(e, noteoff),
+                             [self.modify_event(noteoff, note=72)])
+
+            del e
+            with open(state_file, 'rb') as f:
+                state = f.read()
+
+            # an independent engine neither resumes from the state file, nor
+            # overwrites it
+            e = engine.Engine(backend='dummy')
+            e.setup(scenes, None, None, None)
+            self.assertEqual(e.restored_scene(), -1)
+            self.process_event(e, noteon)
+            time.sleep(0.2)
+            del e
+            with open(state_file, 'rb') as f:
+                self.assertEqual(f.read(), state)
+        finally:
+            os.remove(state_file)
+
+    def test_raw_backend(self):
+        in_r, in_w = os.pipe()
+        out_r, out_w = os.pipe()
+
+        try:
+            config(silent = True,
+                   in_ports = ['fd:%d' % in_r], out_ports = ['fd:%d' % out_w])
+            setup._config_impl(backend='raw')
+
+            e = engine.Engine()
+            e.setup({0: Transpose(12)}, None, None, None)
+            e.start(0, -1)
+
+            # running status both ways, with a clock in the middle of the
+            # second note
+            os.write(in_w, b'\x90\x3c\x64\x40\xf8\x7f')
+            self.assertEqual(self.read_pipe(out_r, 6),
+                             b'\x90\x48\x64\xf8\x4c\x7f')
+
+            # sysex split across several writes
+            os.write(in_w, b'\xf0\x7e\x7f')
+            os.write(in_w, b'\x06\x01\xf7')
+            self.assertEqual(self.read_pipe(out_r, 6),
+                             b'\xf0\x7e\x7f\x06\x01\xf7')
+
+            # commands are carried out by the processing thread, which is
+            # woken up rather than waiting for more input
+            e.output_event(self.make_event(NOTEON, 0, 0, 62, 100))
+            self.assertEqual(self.read_pipe(out_r, 3), b'\x90\x3e\x64')
+
+            e.stop()
+            del e
+        finally:
+            for fd in (in_r, in_w, out_r, out_w):
+                os.close(fd)
+
+    def test_raw_backend_eof(self):
+        in_r, in_w = os.pipe()
+        out_r, out_w = os.pipe()
+
+        try:
+            config(silent = True,
+                   in_ports = ['fd:%d' % in_r], out_ports = ['fd:%d' % out_w])
+            setup._config_impl(backend='raw')
+
+            e = engine.Engine()
+            e.setup({0: Transpose(12)}, None, None, None)
+
+            os.write(in_w, b'\x90\x3c\x64')
+            os.close(in_w)
+            in_w = None
+
+            # in case the engine doesn't stop by itself
+            timer = threading.Timer(5.0, e.quit)
+            timer.start()
+            # returns once the input is closed, without interrupting the
+            # whole process
+            e.run()
+            stopped = timer.is_alive()
+            timer.cancel()
+
+            e.stop()
+            del e
+        finally:
+            for fd in (in_r, in_w, out_r, out_w):
+                if fd is not None:
+                    os.close(fd)
+
+        self.assertTrue(stopped)
+
+    def test_udp_backend(self):
+        def packet(seq, payload):
+            return b'MD\x01\x00' + struct.pack('>IQ', seq, 0) + payload
+
+        # find a free port to listen on
+        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        s.bind(('127.0.0.1', 0))
+        in_port = s.getsockname()[1]
+        s.close()
+
+        recv = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        recv.bind(('127.0.0.1', 0))
+        recv.settimeout(5.0)
+        send = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+        try:
+            config(silent = True,
+                   in_ports = ['127.0.0.1:%d' % in_port],
+                   out_ports = ['127.0.0.1:%d' % recv.getsockname()[1]])
+            setup._config_impl(backend='udp')
+
+            e = engine.Engine()
+            e.setup({0: Transpose(12)}, None, None, None)
+            e.start(0, -1)
+
+            # both notes are sent in a single packet, using running status
+            send.sendto(packet(0, b'\x90\x3c\x64\x40\x7f'),
+                        ('127.0.0.1', in_port))
+            data = recv.recv(2048)
+            self.assertEqual(data[:4], b'MD\x01\x00')
+            self.assertEqual(struct.unpack('>I', data[4:8])[0], 0)
+            self.assertEqual(data[16:], b'\x90\x48\x64\x4c\x7f')
+
+            # packet 1 is lost, and running status doesn't carry over
+            send.sendto(packet(2, b'\x7f\x7f'), ('127.0.0.1', in_port))
+            send.sendto(b'garbage', ('127.0.0.1', in_port))
+            send.sendto(packet(3, b'\x80\x3c\x00'), ('127.0.0.1', in_port))
+            data = recv.recv(2048)
+            self.assertEqual(struct.unpack('>I', data[4:8])[0], 1)
+            self.assertEqual(data[16:], b'\x80\x48\x00')
+
+            stats = engine.backend_stats()
+            self.assertEqual(stats['packets_received'], 3)
+            self.assertEqual(stats['packets_lost'], 1)
+            self.assertEqual(stats['packets_invalid'], 1)
+            self.assertEqual(stats['events_sent'], 3)
+
+            e.stop()
+            del e
+        finally:
+            recv.close()
+            send.close()
+
+    def test_udp_backend_jitter_buffer(self):
+        def packet(seq, sent, note):
+            return (b'MD\x01\x00' + struct.pack('>IQ', seq, sent) +
+                    struct.pack('BBB', 0x90, note, 100))
+
+        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        s.bind(('127.0.0.1', 0))
+        in_port = s.getsockname()[1]
+        s.close()
+
+        recv = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        recv.bind(('127.0.0.1', 0))
+        recv.settimeout(5.0)
+        send = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+        def receive(n):
+            # running status may or may not be used, depending on how the
+            # events were split into packets
+            data = b''
+            while len(data) < n:
+                data += recv.recv(2048)[16:].replace(b'\x90', b'')
+            return data
+
+        try:
+            config(silent = True,
+                   in_ports = ['127.0.0.1:%d' % in_port],
+                   out_ports = ['127.0.0.1:%d' % recv.getsockname()[1]])
+            setup._config_impl(backend='udp')
+
+            e = engine.Engine()
+            e.setup({0: Pass()}, None, None, None)
+            e.start(0, -1)
+
+            # the first packet is held back by the full playout delay
+            t = time.time()
+            send.sendto(packet(0, 10000000, 60), ('127.0.0.1', in_port))
+            self.assertEqual(receive(2), b'\x3c\x64')
+            self.assertGreaterEqual(time.time() - t, 0.002)
+
+            # sent 50ms earlier than it appears to have been, so it's
+            # overdue. the next one was sent 50ms later, so it becomes the
+            # new reference. both are delivered in order
+            send.sendto(packet(1, 9950000, 62), ('127.0.0.1', in_port))
+            send.sendto(packet(2, 10050000, 64), ('127.0.0.1', in_port))
+            self.assertEqual(receive(4), b'\x3e\x64\x40\x64')
+
+            stats = engine.backend_stats()
+            self.assertEqual(stats['packets_received'], 3)
+            self.assertEqual(stats['packets_overdue'], 1)
+
+            e.stop()
+            del e
+        finally:
+            recv.close()
+            send.close()
+
+    def test_shm_backend(self):
+        client = 'mididings-test-%d' % os.getpid()
+        received = []
+        done = threading.Event()
+
+        def record(ev):
+            received.append(ev.note)
+            done.set()
+
+        try:
+            # both output ports loop back to our own input ports
+            config(silent = True, client_name = client,
+                   in_ports = ['a', 'b'],
+                   out_ports = [client + ':a', client + ':b'])
+            setup._config_impl(backend='shm')
+
+            e = engine.Engine()
+            e.setup({0: [
+                PortFilter(0) >> Transpose(12) >> Port(1),
+                PortFilter(1) >> Process(record) >> Discard(),
+            ]}, None, None, None)
+            e.start(0, -1)
+
+            e.output_event(NoteOnEvent(0, 0, 60, 100))
+            self.assertTrue(done.wait(5.0))
+            self.assertEqual(received, [72])
+
+            stats = engine.backend_stats()
+            self.assertEqual(stats['events_sent'], 2)
+            self.assertEqual(stats['events_received'], 2)
+
+            e.stop()
+            del e
+        finally:
+            self.reset_backend()
+
+        # the segment is removed along with the backend
+        self.assertFalse(os.path.exists('/dev/shm/mididings-' + client))
+
+    def test_shm_backend_takeover(self):
+        client = 'mididings-test-%d' % os.getpid()
+        received = []
+        done = threading.Event()
+
+        def record(ev):
+            received.append(ev.note)
+            if len(received) == 2:
+                done.set()
+
+        # sends a single note from a separate process, which then exits
+        # without letting go of the port, as if it had crashed
+        producer = '\n'.join([
+            'import os, sys, time',
+            'from mididings import *',
+            'from mididings import engine, setup',
+            'from mididings.event import NoteOnEvent',
+            'config(silent = True, data_offset = 0,',
+            '       client_name = sys.argv[1] + "-out",',
+            '       out_ports = [sys.argv[1] + ":a"])',
+            'setup._config_impl(backend="shm")',
+            'e = engine.Engine()',
+            'e.setup({0: Pass()}, None, None, None)',
+            'e.start(0, -1)',
+            'e.output_event(NoteOnEvent(0, 0, int(sys.argv[2]), 100))',
+            'while not engine.backend_stats()["events_sent"]:',
+            '    time.sleep(0.01)',
+            'os._exit(0)',
+        ])
+
+        def run_producer(note):
+            pid = os.spawnv(os.P_WAIT, sys.executable, [
+                sys.executable, '-c', producer, client, str(note)])
+            self.assertEqual(pid, 0)
+
+        try:
+            config(silent = True, client_name = client, in_ports = ['a'],
+                   out_ports = [])
+            setup._config_impl(backend='shm')
+
+            e = engine.Engine()
+            e.setup({0: Process(record) >> Discard()}, None, None, None)
+            e.start(0, -1)
+
+            # the second producer replaces both the first one's segment and
+            # its claim on our input port
+            run_producer(60)
+            run_producer(62)
+            self.assertTrue(done.wait(5.0))
+            self.assertEqual(received, [60, 62])
+
+            e.stop()
+            del e
+        finally:
+            if os.path.exists('/dev/shm/mididings-%s-out' % client):
+                os.unlink('/dev/shm/mididings-%s-out' % client)
+
+    def test_shm_backend_consumer_restart(self):
+        client = 'mididings-test-%d' % os.getpid()
+
+        # prints the first note received, then exits without removing its
+        # segment, as if it had crashed
+        consumer = '\n'.join([
+            'import os, sys',
+            'from mididings import *',
+            'config(silent = True, backend = "shm",',
+            '       client_name = sys.argv[1] + "-in",',
+            '       in_ports = ["a"], out_ports = [])',
+            'def received(ev):',
+            '    os.write(1, ("%d" % ev.note).encode())',
+            '    os._exit(0)',
+            'run(Process(received))',
+        ])
+
+        def run_consumer(note):
+            proc = subprocess.Popen([sys.executable, '-c', consumer, client],
+                                    stdout=subprocess.PIPE)
+            try:
+                # the consumer is attached to once it has started up
+                deadline = time.time() + 5.0
+                while proc.poll() is None and time.time() < deadline:
+                    e.output_event(NoteOnEvent(0, 0, note, 100))
+                    time.sleep(0.02)
+            finally:
+                if proc.poll() is None:
+                    proc.kill()
+            return proc.communicate()[0]
+
+        try:
+            config(silent = True, client_name = client, in_ports = [],
+                   out_ports = [client + '-in:a'])
+            setup._config_impl(backend='shm')
+
+            e = engine.Engine()
+            e.setup({0: Pass()}, None, None, None)
+            e.start(0, -1)
+
+            # the restarted consumer replaces the segment the first one left
+            # behind, and output moves on to the new one
+            self.assertEqual(run_consumer(60), b'60')
+            self.assertEqual(run_consumer(62), b'62')
+
+            e.stop()
+            del e
+        finally:
+            if os.path.exists('/dev/shm/mididings-%s-in' % client):
+                os.unlink('/dev/shm/mididings-%s-in' % client)
+
+    @unittest.skipUnless('alsa' in _mididings.available_backends() and
+                         os.path.exists('/dev/snd/seq'),
+                         "ALSA sequencer not available")
+    def test_alsa_port_watcher(self):
+        client = 'mididings-test-%d' % os.getpid()
+
+        # exits as soon as the first event arrives
+        receiver = '\n'.join([
+            'import os, sys',
+            'from mididings import *',
+            'config(silent = True, backend = "alsa",',
+            '       client_name = sys.argv[1], in_ports = ["in"])',
+            'run(Process(lambda ev: os._exit(0)))',
+        ])
+
+        # the port to connect to doesn't exist yet
+        config(silent = True, client_name = client, in_ports = [],
+               out_ports = [('out', client + '-in:in')])
+        setup._config_impl(backend='alsa')
+
+        e = engine.Engine()
+        e.setup({0: Pass()}, None, None, None)
+        e.start(0, -1)
+
+        proc = subprocess.Popen([sys.executable, '-c', receiver,
+                                 client + '-in'])
+        try:
+            # events only get through once the new port is connected
+            deadline = time.time() + 5.0
+            while proc.poll() is None and time.time() < deadline:
+                e.output_event(NoteOnEvent(0, 0, 60, 100))
+                time.sleep(0.05)
+            self.assertEqual(proc.poll(), 0)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+            proc.wait()
+
+        e.stop()
+        del e
+
+    def test_shm_backend_invalid_segment(self):
+        client = 'mididings-test-%d' % os.getpid()
+        path = '/dev/shm/mididings-' + client
+
+        # a segment that's never completed is not removed
+        open(path, 'w').close()
+        try:
+            config(silent = True, client_name = client)
+            setup._config_impl(backend='shm')
+            with self.assertRaises(RuntimeError):
+                engine.Engine()
+            self.assertTrue(os.path.exists(path))
+        finally:
+            os.unlink(path)
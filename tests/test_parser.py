@@ -0,0 +1,116 @@
+# -*- coding: utf-8 -*-
+#
+# mididings
+#
+# Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+
+from tests.helpers import *
+
+from mididings import *
+from mididings.event import MidiEvent
+
+import _mididings
+
+
+class ParserTestCase(MididingsTestCase):
+
+    def decode(self, parser, data, frame=0):
+        r = parser.decode(list(bytearray(data)), frame)
+        for ev in r:
+            ev.__class__ = MidiEvent
+        return r
+
+    def test_running_status(self):
+        p = _mididings.MidiParser(0)
+        self.assertEqual(self.decode(p, b'\x90\x3c\x64\x40\x7f\x80\x3c\x00'), [
+            self.make_event(NOTEON, 0, 0, 60, 100),
+            self.make_event(NOTEON, 0, 0, 64, 127),
+            self.make_event(NOTEOFF, 0, 0, 60, 0),
+        ])
+        # note-on with zero velocity is a note-off
+        self.assertEqual(self.decode(p, b'\x3c\x00'), [
+            self.make_event(NOTEOFF, 0, 0, 60, 0),
+        ])
+
+    def test_split_messages(self):
+        p = _mididings.MidiParser(1)
+        self.assertEqual(self.decode(p, b'\xb3\x07'), [])
+        self.assertEqual(self.decode(p, b'\x40\x08'), [
+            self.make_event(CTRL, 1, 3, 7, 64),
+        ])
+        self.assertEqual(self.decode(p, b'\x20'), [
+            self.make_event(CTRL, 1, 3, 8, 32),
+        ])
+
+    def test_realtime(self):
+        p = _mididings.MidiParser(0)
+        # realtime messages don't interrupt other messages, nor do they
+        # cancel running status
+        r = self.decode(p, b'\x90\x3c\xf8\x64\x3e\xfe\x50')
+        self.assertEqual([ev.type for ev in r],
+                         [SYSRT_CLOCK, NOTEON, SYSRT_SENSING, NOTEON])
+        self.assertEqual(r[3].note, 62)
+
+    def test_system_common(self):
+        p = _mididings.MidiParser(0)
+        # system common messages cancel running status, the following data
+        # bytes are ignored
+        r = self.decode(p, b'\xc5\x0a\xf3\x02\x0b\x0c\xf6')
+        self.assertEqual([ev.type for ev in r],
+                         [PROGRAM, SYSCM_SONGSEL, SYSCM_TUNEREQ])
+
+    def test_sysex(self):
+        p = _mididings.MidiParser(0)
+        self.assertEqual(self.decode(p, b'\xf0\x7e\x7f'), [])
+        self.assertEqual(self.decode(p, b'\xf8\x06'), [
+            self.make_event(SYSRT_CLOCK, 0, 0, 0, 0),
+        ])
+        r = self.decode(p, b'\x01\xf7\x90\x3c\x64', 42)
+        self.assertEqual(len(r), 2)
+        self.assertEqual(r[0].type, SYSEX)
+        self.assertEqual(bytearray(r[0].sysex),
+                         bytearray(b'\xf0\x7e\x7f\x06\x01\xf7'))
+        self.assertEqual(r[1].note, 60)
+
+    def test_sysex_aborted(self):
+        p = _mididings.MidiParser(0)
+        # a status byte other than EOX ends sysex, and is parsed normally
+        self.assertEqual(self.decode(p, b'\xf0\x7e\x7f\x90\x3c\x64'), [
+            self.make_event(NOTEON, 0, 0, 60, 100),
+        ])
+
+    def test_encoder(self):
+        e = _mididings.MidiEncoder()
+        events = [
+            self.make_event(NOTEON, 0, 0, 60, 100),
+            self.make_event(SYSRT_CLOCK, 0, 0, 0, 0),
+            self.make_event(NOTEON, 0, 0, 64, 127),
+            self.make_event(NOTEON, 0, 1, 67, 80),
+            self.make_event(SYSCM_SONGSEL, 0, 0, 3, 0),
+            self.make_event(NOTEON, 0, 1, 67, 0),
+        ]
+        data = bytearray(e.encode(events))
+        self.assertEqual(data, bytearray(
+            b'\x90\x3c\x64\xf8\x40\x7f\x91\x43\x50\xf3\x03\x91\x43\x00'))
+
+        # the running status carries over into the next call
+        data = bytearray(e.encode([self.make_event(NOTEON, 0, 1, 60, 0)]))
+        self.assertEqual(data, bytearray(b'\x3c\x00'))
+
+    def test_roundtrip(self):
+        events = [
+            self.make_event(NOTEON, 0, 2, 60, 100),
+            self.make_event(NOTEON, 0, 2, 62, 100),
+            self.make_event(CTRL, 0, 2, 7, 100),
+            self.make_event(PITCHBEND, 0, 2, 0, -1000),
+            self.make_event(PITCHBEND, 0, 2, 0, 8191),
+            self.make_event(AFTERTOUCH, 0, 2, 0, 50),
+        ]
+        data = _mididings.MidiEncoder().encode(events)
+        self.assertEqual(self.decode(_mididings.MidiParser(0), data), events)
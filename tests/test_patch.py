@@ -13,6 +13,7 @@
 from tests.helpers import *
 
 from mididings import *
+from mididings import patch
 
 
 class PatchTestCase(MididingsTestCase):
@@ -47,3 +48,174 @@ class PatchTestCase(MididingsTestCase):
         self.run_patch(p, self.make_event())
         self.assertEqual(order, [1, 2, 3, 3, 4, 5, 6, 7, 8, 8,
                                  4, 5, 6, 7, 8, 8, 9, 9, 9, 9, 9, 9])
+
+    def test_type_masks(self):
+        def types(p):
+            return patch.Patch(Pass()).build(p).types()
+
+        self.assertEqual(types(Transpose(12)), NOTE | POLY_AFTERTOUCH)
+        self.assertEqual(types(Transpose(12) >> CtrlMap(1, 2)),
+                         NOTE | POLY_AFTERTOUCH | CTRL)
+        self.assertEqual(types(KeyFilter(60)), NOTE | POLY_AFTERTOUCH)
+        self.assertEqual(types(CtrlFilter(7)), ANY)
+        self.assertEqual(types(Pass()), NONE)
+        self.assertEqual(types(Discard()), ANY)
+        self.assertEqual(types(Filter(NOTE)), ANY & ~NOTE)
+        self.assertEqual(types(Filter(NOTE) >> Velocity(10)),
+                         ANY & ~NOTEOFF)
+        self.assertEqual(types(Fork([Velocity(10), CtrlMap(1, 2)])),
+                         NOTEON | CTRL)
+        self.assertEqual(types(Fork([Velocity(10), CtrlMap(1, 2)],
+                                    remove_duplicates=False)), ANY)
+
+        # events that can't be affected skip the whole chain, and come out
+        # unchanged
+        ctrl = self.make_event(CTRL, ctrl=64)
+        note = self.make_event(NOTEON, note=60, velocity=64)
+        p = Transpose(12) >> Velocity(fixed=100) >> [Key(0), Transpose(1)]
+        self.check_patch(p, {
+            ctrl: [ctrl],
+            note: [self.modify_event(note, note=0, velocity=100),
+                   self.modify_event(note, note=73, velocity=100)],
+        })
+
+    def test_optimize(self):
+        def optimize(p):
+            optimizer = patch._Optimizer()
+            return optimizer.optimize(p), optimizer.removed
+
+        def check(p, expected):
+            self.assertEqual(repr(optimize(p)[0]), repr(expected))
+
+        # no-op units and nesting
+        check(Pass() >> Transpose(12) >> Pass(), Transpose(12))
+        check(Chain(Pass(), Pass()), Pass())
+        check([Transpose(12), Fork([Velocity(10), Discard()])],
+              [Transpose(12), Velocity(10)])
+        check([[Transpose(12), Transpose(7)], Key(60)],
+              [Transpose(12), Transpose(7), Key(60)])
+        check([Fork([Transpose(12), Transpose(7)], remove_duplicates=False),
+               Key(60)],
+              [Fork([Transpose(12), Transpose(7)], remove_duplicates=False),
+               Key(60)])
+
+        # branches that can never pass
+        check([Channel(1) >> ChannelFilter(3), Transpose(12)], Transpose(12))
+        check([Port(1) >> Velocity(10) >> PortFilter(2), Key(60)], Key(60))
+        check(Filter(NOTE) >> Transpose(12) >> Filter(CTRL), Discard())
+        check(Print() >> Filter(NOTE) >> Filter(CTRL),
+              Print() >> Filter(NOTE) >> Discard())
+        p, removed = optimize([Channel(1) >> ChannelFilter(3), Discard()])
+        self.assertEqual(repr(p), repr(Discard()))
+        self.assertEqual(len(removed), 2)
+
+        # init and exit patches are not part of the event processing
+        p, removed = optimize([Init(Program(1)), Exit(Program(2)),
+                               Transpose(12)])
+        self.assertEqual(repr(p), repr(Transpose(12)))
+        self.assertEqual(removed, [])
+        p, removed = optimize(Init(Program(1)) >> Exit(Program(2)))
+        self.assertEqual(repr(p), repr(Discard()))
+        self.assertEqual(removed, [])
+
+        # filters that always pass
+        check(Channel(2) >> Filter(NOTE) >> ChannelFilter(2),
+              Channel(2) >> Filter(NOTE))
+        check(Port(2) >> PortFilter(2), Port(2))
+        check(Channel(2) >> ChannelFilter(2), Channel(2) >> ChannelFilter(2))
+
+        # constant generators
+        check(Transpose(12) >> Program(3) >> Port(2) >> Channel(4),
+              Program(2, 4, 3))
+        check(NoteOn(60, 100) >> Channel(3),
+              NoteOn(EVENT_PORT, 3, 60, 100))
+        check(Transpose(12) >> NoteOn(60, 100),
+              Transpose(12) >> NoteOn(60, 100))
+        check(Program(3) >> Filter(PROGRAM) >> Port(2) >> PortFilter(2),
+              Program(2, EVENT_CHANNEL, 3))
+        check(Program(1, 1, 3) >> ChannelFilter(2), Discard())
+
+        # the optimized patch must behave like the original one
+        note = self.make_event(NOTEON, port=1, channel=1, note=60)
+        ctrl = self.make_event(CTRL, port=1, channel=2, ctrl=7)
+        p = [
+            Channel(3) >> [ChannelFilter(1), ChannelFilter(3) >> Port(2)],
+            Filter(NOTE) >> [Pass(), Program(5) >> Channel(1)],
+            Discard(),
+        ]
+        self.check_patch(p, {
+            note: [self.modify_event(note, port=2, channel=3),
+                   note,
+                   self.make_event(PROGRAM, port=1, channel=1, program=5)],
+            ctrl: [self.modify_event(ctrl, port=2, channel=3)],
+        })
+
+    def test_optimize_common_prefix(self):
+        def optimize(p):
+            return patch._Optimizer().optimize(p)
+
+        def check(p, expected):
+            self.assertEqual(repr(optimize(p)), repr(expected))
+
+        check([ChannelFilter(1) >> KeyFilter(60) >> Transpose(1),
+               ChannelFilter(1) >> KeyFilter(60) >> Transpose(2),
+               Velocity(3)],
+              [ChannelFilter(1) >> KeyFilter(60) >>
+                    [Transpose(1), Transpose(2)],
+               Velocity(3)])
+        check([ChannelFilter(1) >> Transpose(1),
+               ChannelFilter(1),
+               ChannelFilter(2)],
+              [ChannelFilter(1) >> [Transpose(1), Pass()],
+               ChannelFilter(2)])
+        check(Fork([~KeyFilter(60) >> Transpose(1),
+                    ~KeyFilter(60) >> Transpose(2)],
+                   remove_duplicates=False),
+              ~KeyFilter(60) >> Fork([Transpose(1), Transpose(2)],
+                                     remove_duplicates=False))
+
+        # only adjacent branches are merged, to keep the output order
+        check([ChannelFilter(1) >> Transpose(1),
+               ChannelFilter(2),
+               ChannelFilter(1) >> Transpose(2)],
+              [ChannelFilter(1) >> Transpose(1),
+               ChannelFilter(2),
+               ChannelFilter(1) >> Transpose(2)])
+        # different parameters, or units with side effects
+        check([Transpose(1) >> Key(60), Transpose(2) >> Key(60)],
+              [Transpose(1) >> Key(60), Transpose(2) >> Key(60)])
+        check([Print() >> Transpose(1), Print() >> Transpose(2)],
+              [Print() >> Transpose(1), Print() >> Transpose(2)])
+
+        ev = self.make_event(NOTEON, channel=1, note=60)
+        p = [ChannelFilter(1) >> Transpose(1), ChannelFilter(1), Pass()]
+        self.check_patch(p, {
+            ev: [self.modify_event(ev, note=61), ev],
+        })
+
+    def test_shared_modules(self):
+        modules = {}
+        a = patch.Patch(Pass(), modules)
+        b = patch.Patch(Pass(), modules)
+
+        p = ChannelFilter(1) >> [Transpose(12), ~KeyFilter(60)]
+        self.assertIs(a.build(p), b.build(p))
+        self.assertIs(a.build(p), b.build(ChannelFilter(1) >>
+                                          [Transpose(12), ~KeyFilter(60)]))
+        self.assertIs(a.build(SysEx([0xf0, 0xf7])),
+                      b.build(SysEx([0xf0, 0xf7])))
+        self.assertIs(a.build(NOTE), b.build(NOTE))
+
+        self.assertIsNot(a.build(Transpose(12)), a.build(Transpose(7)))
+        self.assertIsNot(a.build(~KeyFilter(60)), a.build(-KeyFilter(60)))
+        self.assertIsNot(a.build(Fork([Transpose(12), Key(60)])),
+                         a.build(Fork([Transpose(12), Key(60)],
+                                      remove_duplicates=False)))
+        self.assertIsNot(a.build(Transpose(12) >> Key(60)),
+                         a.build([Transpose(12), Key(60)]))
+        self.assertIsNot(a.build(Process(lambda ev: ev)),
+                         a.build(Process(lambda ev: ev)))
+
+        # patches that don't share a dict don't share any modules
+        c = patch.Patch(Pass())
+        self.assertIsNot(a.build(p), c.build(p))
@@ -15,6 +15,9 @@ from tests.helpers import *
 from mididings import *
 
 import threading
+import tempfile
+import time
+import os
 
 
 class CallTestCase(MididingsTestCase):
@@ -62,6 +65,45 @@ class CallTestCase(MididingsTestCase):
             ev: [ev, ev]
         })
 
+    @data_offsets
+    def test_Process_inplace(self, off):
+        events = []
+        def foo(ev):
+            events.append(ev)
+            if ev.type == NOTEON:
+                ev.note += 1
+                ev.channel = off(3)
+            elif ev.type == SYSEX:
+                ev.sysex = ev.sysex[:-1] + b'\x42\xf7'
+            else:
+                return False
+
+        self.check_patch(Process(inplace=foo), {
+            self.make_event(NOTEON, off(0), off(0), 66, 23):
+                [self.make_event(NOTEON, off(0), off(3), 67, 23)],
+            self.make_event(SYSEX, off(0), sysex=b'\xf0\x01\xf7'):
+                [self.make_event(SYSEX, off(0), sysex=b'\xf0\x01\x42\xf7')],
+            self.make_event(CTRL): [],
+        })
+        # the same event object is reused for every call
+        self.assertTrue(all(ev is events[0] for ev in events))
+
+    def test_Process_inplace_sysex_exception(self):
+        def foo(ev):
+            ev.sysex = ev.sysex[:-1] + b'\x42\xf7'
+            if ev.sysex[1] == 0x01:
+                raise ValueError
+
+        # sysex data changed by a call that raised is discarded, rather than
+        # leaking into the next call
+        r = self.run_patch(Process(inplace=foo), [
+            self.make_event(SYSEX, 0, sysex=b'\xf0\x01\xf7'),
+            self.make_event(SYSEX, 0, sysex=b'\xf0\x02\xf7'),
+        ])
+        self.assertEqual(r, [
+            self.make_event(SYSEX, 0, sysex=b'\xf0\x02\x42\xf7'),
+        ])
+
     @data_offsets
     def test_Call(self, off):
         event = threading.Event()
@@ -132,3 +174,117 @@ class CallTestCase(MididingsTestCase):
         ev = self.make_event(NOTEON)
         self.check_patch(Call(obj), { ev: [] })
         self.assertTrue(event.wait(1.0))
+
+    def test_Call_process(self):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+
+        def foo(ev):
+            # runs in the worker process, so the only way to get results
+            # back is via the file system
+            with open(path, 'a') as f:
+                f.write('%s\n' % (list(ev.sysex) if ev.type == SYSEX
+                                                   else ev.note))
+
+        # the function must be known before forking the worker
+        patch = Call(process=foo)
+        setup._config_impl(backend='dummy')
+        worker = engine._fork_process_worker()
+        e = engine.Engine()
+        e._set_process_worker(worker)
+        e.setup({0: patch}, None, None, None)
+        try:
+            for note in (60, 61):
+                ev = self.make_event(NOTEON, 0, 0, note, 100)
+                self.assertEqual(e.process_event(ev)[:], [])
+            ev = self.make_event(SYSEX, 0, sysex=b'\xf0\x01\xf7')
+            self.assertEqual(e.process_event(ev)[:], [])
+        finally:
+            # waits for the worker process to exit
+            e._stop_process_worker()
+
+        with open(path) as f:
+            self.assertEqual(f.read(), '60\n61\n[240, 1, 247]\n')
+        os.remove(path)
+
+    def test_Call_process_warm_restart(self):
+        event = threading.Event()
+        pid = os.getpid()
+
+        def foo(ev):
+            self.assertEqual(os.getpid(), pid)
+            event.set()
+
+        def fork():
+            raise AssertionError("forked during a warm restart")
+
+        patch = Call(process=foo)
+        setup._config_impl(backend='dummy')
+        os_fork = engine._os.fork
+        engine._os.fork = fork
+        engine._restarting = True
+        try:
+            e = engine._setup_engine({0: patch}, None, None, None)
+            ev = self.make_event(NOTEON, 0, 0, 60, 100)
+            self.assertEqual(e.process_event(ev)[:], [])
+        finally:
+            engine._restarting = False
+            engine._os.fork = os_fork
+
+        # called asynchronously in this process instead
+        self.assertTrue(event.wait(1.0))
+
+    def test_Call_process_realtime(self):
+        in_r, in_w = os.pipe()
+        out_r, out_w = os.pipe()
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+
+        def foo(ev):
+            with open(path, 'a') as f:
+                f.write('%d %d\n' % (os.getpid(), ev.note))
+
+        def lines():
+            with open(path) as f:
+                return f.read().splitlines()
+
+        def control():
+            try:
+                os.write(in_w, b'\x90\x3c\x64\x3d\x64')
+                for i in range(500):
+                    if len(lines()) == 2:
+                        break
+                    time.sleep(0.01)
+            finally:
+                engine.quit()
+
+        try:
+            config(silent = True,
+                   in_ports = ['fd:%d' % in_r], out_ports = ['fd:%d' % out_w])
+            setup._config_impl(backend='raw')
+
+            t = threading.Thread(target=control)
+            t.start()
+            # forks the worker process, and waits for it to exit when done
+            run(Call(process=foo))
+            t.join()
+        finally:
+            for fd in (in_r, in_w, out_r, out_w):
+                os.close(fd)
+
+        calls = [l.split() for l in lines()]
+        os.remove(path)
+        self.assertEqual([n for p, n in calls], ['60', '61'])
+        self.assertTrue(all(int(p) != os.getpid() for p, n in calls))
+
+    def test_Call_process_no_worker(self):
+        event = threading.Event()
+
+        def foo(ev):
+            self.assertEqual(ev.type, NOTEON)
+            event.set()
+
+        # without a worker process, the function is called asynchronously
+        ev = self.make_event(NOTEON)
+        self.check_patch(Call(process=foo), { ev: [] })
+        self.assertTrue(event.wait(1.0))
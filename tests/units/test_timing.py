@@ -0,0 +1,74 @@
+# -*- coding: utf-8 -*-
+#
+# mididings
+#
+# Copyright (C) 2008-2014  Dominic Sacré  <dominic.sacre@gmx.de>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+
+from tests.helpers import *
+
+from mididings import *
+
+
+class TimingTestCase(MididingsTestCase):
+
+    def test_Delay(self):
+        ev = self.make_event(NOTEON)
+
+        self.check_patch(Delay(0), {
+            ev: [ev],
+        })
+        self.check_patch(Delay(1000), {
+            ev: [self.modify_event(ev, frame=1000)],
+        })
+        self.check_patch(Delay(frames=64) >> Delay(frames=64), {
+            ev: [self.modify_event(ev, frame=128)],
+        })
+        # no backend, so the offline sample rate of 44100 Hz applies
+        self.check_patch(Delay(seconds=0.5), {
+            ev: [self.modify_event(ev, frame=22050)],
+        })
+        self.check_patch(Pass() // Delay(100), {
+            ev: [ev, self.modify_event(ev, frame=100)],
+        })
+
+        with self.assertRaises(TypeError):
+            Delay(123.456)
+        with self.assertRaises(ValueError):
+            Delay(-1)
+        with self.assertRaises(ValueError):
+            Delay(seconds=-0.5)
+
+    def test_Delay_beats(self):
+        ev = self.make_event(NOTEON)
+
+        # no clock, 120 BPM
+        self.check_patch(Delay(beats=1), {
+            ev: [self.modify_event(ev, frame=22050)],
+        })
+
+        # clocks 1000 frames apart, 110.25 BPM
+        clocks = []
+        for n in range(4):
+            clock = MidiEvent(SYSRT_CLOCK)
+            clock.frame = n * 1000
+            clocks.append(clock)
+
+        r = self.run_patch(Filter(NOTE) % Delay(beats=1), clocks + [ev])
+        self.assertEqual(r, clocks + [self.modify_event(ev, frame=24000)])
+
+    def test_ClockDivide(self):
+        start = MidiEvent(SYSRT_START)
+        clock = MidiEvent(SYSRT_CLOCK)
+        ev = self.make_event(NOTEON)
+
+        r = self.run_patch(ClockDivide(3), [start] + [clock] * 7 + [ev])
+        self.assertEqual(r, [start, clock, clock, clock, ev])
+
+        with self.assertRaises(ValueError):
+            ClockDivide(0)